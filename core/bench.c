@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+
+#include "bench.h"
+
+#include <math.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+struct bench_config
+{
+    bool loaded;
+    enum bench_format format;
+    double time_ms;
+    bool header_printed;
+    char tag[128];
+    double flops;
+    double bytes;
+    size_t threads[2];
+    bool counting;
+    struct hw_counters counters;
+};
+
+static struct bench_config config;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1.0e3 + (double)ts.tv_nsec / 1.0e6;
+}
+
+static void load_config(void)
+{
+    config.loaded = true;
+    config.format = BENCH_FORMAT_TEXT;
+    config.time_ms = BENCH_TIME_MS;
+
+    const char *format = getenv("BENCH_FORMAT");
+    if (format != nullptr && strcmp(format, "csv") == 0)
+        config.format = BENCH_FORMAT_CSV;
+    else if (format != nullptr && strcmp(format, "json") == 0)
+        config.format = BENCH_FORMAT_JSON;
+    else if (format != nullptr && format[0] != '\0' && strcmp(format, "text") != 0)
+        die("BENCH_FORMAT must be text, csv or json");
+
+    const char *time_ms = getenv("BENCH_TIME_MS");
+    if (time_ms != nullptr && time_ms[0] != '\0')
+    {
+        config.time_ms = strtod(time_ms, nullptr);
+        if (!(config.time_ms > 0.0))
+            die("BENCH_TIME_MS must be a positive number of milliseconds");
+    }
+
+    const char *cpu = getenv("BENCH_CPU");
+    if (cpu != nullptr && cpu[0] != '\0' && !bench_pin_cpu(atoi(cpu)))
+        fprintf(stderr, "BENCH_CPU=%s: cannot pin, running unpinned\n", cpu);
+
+    const char *counters = getenv("BENCH_COUNTERS");
+    if (counters != nullptr && counters[0] != '\0' && strcmp(counters, "0") != 0)
+    {
+        config.counting = hw_counters_open(&config.counters);
+        if (!config.counting)
+            fprintf(stderr, "BENCH_COUNTERS: no hardware counters available, timing only\n");
+    }
+}
+
+bool bench_pin_cpu(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+void bench_run_init(struct bench_run *run)
+{
+    if (!config.loaded)
+        load_config();
+    run->batch = 1;
+    run->measuring = false;
+    run->warmup_ms = 0.0;
+    run->measured_ms = 0.0;
+    run->count = 0;
+    run->start_ms = -1.0;
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+        run->counters[i] = -1.0;
+}
+
+bool bench_run_next(struct bench_run *run)
+{
+    double now = now_ms();
+    if (run->start_ms < 0.0)
+    {
+        run->start_ms = now;
+        return true;
+    }
+    double elapsed = now - run->start_ms;
+
+    if (!run->measuring)
+    {
+        run->warmup_ms += elapsed;
+        if (run->warmup_ms < BENCH_WARMUP_MS)
+        {
+            run->batch *= 2;
+            run->start_ms = now_ms();
+            return true;
+        }
+        double per_iteration = elapsed / (double)run->batch;
+        double batch = per_iteration > 0.0 ? ceil(BENCH_SAMPLE_MS / per_iteration) : 1.0;
+        run->batch = batch < 1.0 ? 1 : (size_t)batch;
+        run->measuring = true;
+        if (config.counting)
+            hw_counters_start(&config.counters);
+        run->start_ms = now_ms();
+        return true;
+    }
+
+    run->samples[run->count++] = elapsed / (double)run->batch;
+    run->measured_ms += elapsed;
+    bool enough = run->count >= BENCH_MIN_SAMPLES && run->measured_ms >= config.time_ms;
+    if (enough || run->count == BENCH_MAX_SAMPLES)
+    {
+        if (config.counting)
+            hw_counters_stop(&config.counters, run->counters);
+        return false;
+    }
+    run->start_ms = now_ms();
+    return true;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted values.
+static double percentile(const double *sorted, size_t count, double p)
+{
+    size_t rank = (size_t)ceil(p * (double)count);
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+void bench_run_stats(const struct bench_run *run, struct bench_stats *stats)
+{
+    size_t n = run->count;
+    double sorted[BENCH_MAX_SAMPLES];
+    memcpy(sorted, run->samples, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_double);
+
+    stats->iterations = run->batch;
+    stats->samples = n;
+    stats->min_ms = sorted[0];
+    stats->median_ms = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+    stats->p95_ms = percentile(sorted, n, 0.95);
+
+    double q1 = percentile(sorted, n, 0.25);
+    double q3 = percentile(sorted, n, 0.75);
+    double low = q1 - 1.5 * (q3 - q1);
+    double high = q3 + 1.5 * (q3 - q1);
+    double sum = 0.0;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++)
+        if (sorted[i] >= low && sorted[i] <= high)
+        {
+            sum += sorted[i];
+            kept++;
+        }
+    stats->outliers = n - kept;
+    stats->mean_ms = sum / (double)kept;
+    double squares = 0.0;
+    for (size_t i = 0; i < n; i++)
+        if (sorted[i] >= low && sorted[i] <= high)
+            squares += (sorted[i] - stats->mean_ms) * (sorted[i] - stats->mean_ms);
+    stats->stddev_ms = kept > 1 ? sqrt(squares / (double)(kept - 1)) : 0.0;
+
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+        stats->counters[i] = run->counters[i] < 0.0 ? -1.0 : run->counters[i] / (double)(run->batch * n);
+}
+
+void bench_tag(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(config.tag, sizeof(config.tag), format, args);
+    va_end(args);
+}
+
+void bench_work(double flops, double bytes)
+{
+    config.flops = flops;
+    config.bytes = bytes;
+}
+
+void bench_threads(size_t scalar, size_t vector)
+{
+    config.threads[0] = scalar;
+    config.threads[1] = vector;
+}
+
+enum derived
+{
+    DERIVED_IPC,
+    DERIVED_GFLOPS,
+    DERIVED_GB_PER_S,
+    DERIVED_BYTES_PER_CYCLE,
+    DERIVED_FLOPS_PER_FP_OP,
+    DERIVED_COUNT
+};
+
+static const char *const derived_names[] = {"ipc", "gflops", "gb_per_s", "bytes_per_cycle", "flops_per_fp_op"};
+
+// -1 where an input is missing.
+static void derive(const struct bench_stats *s, double values[DERIVED_COUNT])
+{
+    double cycles = s->counters[HW_COUNTER_CYCLES];
+    double instructions = s->counters[HW_COUNTER_INSTRUCTIONS];
+    double fp_ops = s->counters[HW_COUNTER_FP_OPS];
+    values[DERIVED_IPC] = cycles > 0.0 && instructions >= 0.0 ? instructions / cycles : -1.0;
+    values[DERIVED_GFLOPS] = config.flops > 0.0 && s->median_ms > 0.0 ? config.flops / (s->median_ms * 1.0e6) : -1.0;
+    values[DERIVED_GB_PER_S] = config.bytes > 0.0 && s->median_ms > 0.0 ? config.bytes / (s->median_ms * 1.0e6) : -1.0;
+    values[DERIVED_BYTES_PER_CYCLE] = config.bytes > 0.0 && cycles > 0.0 ? config.bytes / cycles : -1.0;
+    // FP_OPS counts an instruction once per operation, whatever its width, so
+    // this is the average number of lanes the kernel fills.
+    values[DERIVED_FLOPS_PER_FP_OP] = config.flops > 0.0 && fp_ops > 0.0 ? config.flops / fp_ops : -1.0;
+}
+
+// Prints value with the given separator before it, or missing instead.
+static void print_value(const char *separator, double value, const char *missing)
+{
+    if (value < 0.0)
+        printf("%s%s", separator, missing);
+    else
+        printf("%s%.6g", separator, value);
+}
+
+static void report_csv(size_t label, const char *variant, const struct bench_stats *s)
+{
+    printf("%s,%zu,%s,%.6f,%.6f,%.6f,%.6f,%.6f,%zu,%zu,%zu", config.tag, label, variant, s->min_ms, s->median_ms,
+           s->p95_ms, s->mean_ms, s->stddev_ms, s->iterations, s->samples, s->outliers);
+    double derived[DERIVED_COUNT];
+    derive(s, derived);
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+        print_value(",", s->counters[i], "");
+    for (int i = 0; i < DERIVED_COUNT; i++)
+        print_value(",", derived[i], "");
+    printf("\n");
+}
+
+static void report_json(size_t label, const char *variant, const struct bench_stats *s)
+{
+    printf("{\"tag\":\"%s\",\"label\":%zu,\"variant\":\"%s\",\"min_ms\":%.6f,\"median_ms\":%.6f,\"p95_ms\":%.6f,"
+           "\"mean_ms\":%.6f,\"stddev_ms\":%.6f,\"iterations\":%zu,\"samples\":%zu,\"outliers\":%zu",
+           config.tag, label, variant, s->min_ms, s->median_ms, s->p95_ms, s->mean_ms, s->stddev_ms, s->iterations,
+           s->samples, s->outliers);
+    double derived[DERIVED_COUNT];
+    derive(s, derived);
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+    {
+        printf(",\"%s\":", hw_counter_name((enum hw_counter)i));
+        print_value("", s->counters[i], "null");
+    }
+    for (int i = 0; i < DERIVED_COUNT; i++)
+    {
+        printf(",\"%s\":", derived_names[i]);
+        print_value("", derived[i], "null");
+    }
+    printf("}\n");
+}
+
+static void report_derived(size_t label, const struct bench_stats *scalar, const struct bench_stats *vector)
+{
+    double scalar_derived[DERIVED_COUNT], vector_derived[DERIVED_COUNT];
+    derive(scalar, scalar_derived);
+    derive(vector, vector_derived);
+    printf("# %s%s%zu", config.tag, config.tag[0] ? " " : "", label);
+    for (int i = 0; i < DERIVED_COUNT; i++)
+    {
+        printf(" %s", derived_names[i]);
+        print_value(" ", scalar_derived[i], "-");
+        print_value(" ", vector_derived[i], "-");
+    }
+    printf("\n");
+}
+
+void bench_report(size_t label, const struct bench_stats *scalar_stats, const struct bench_stats *vector_stats)
+{
+    if (!config.loaded)
+        load_config();
+    struct bench_stats sides[2] = {*scalar_stats, *vector_stats};
+    for (size_t side = 0; side < 2; side++)
+        if (config.threads[side] > 1)
+            for (int i = 0; i < HW_COUNTER_COUNT; i++)
+                sides[side].counters[i] = -1.0;
+    const struct bench_stats *scalar = &sides[0];
+    const struct bench_stats *vector = &sides[1];
+    switch (config.format)
+    {
+    case BENCH_FORMAT_CSV:
+        if (!config.header_printed)
+        {
+            printf("tag,label,variant,min_ms,median_ms,p95_ms,mean_ms,stddev_ms,iterations,samples,outliers");
+            for (int i = 0; i < HW_COUNTER_COUNT; i++)
+                printf(",%s", hw_counter_name((enum hw_counter)i));
+            for (int i = 0; i < DERIVED_COUNT; i++)
+                printf(",%s", derived_names[i]);
+            printf("\n");
+        }
+        config.header_printed = true;
+        report_csv(label, "scalar", scalar);
+        report_csv(label, "vector", vector);
+        break;
+    case BENCH_FORMAT_JSON:
+        report_json(label, "scalar", scalar);
+        report_json(label, "vector", vector);
+        break;
+    default:
+        printf("%s%s%zu %.6f %.6f\n", config.tag, config.tag[0] ? " " : "", label, scalar->median_ms, vector->median_ms);
+        if (config.counting)
+            report_derived(label, scalar, vector);
+        break;
+    }
+    fflush(stdout);
+    config.tag[0] = '\0';
+    config.flops = 0.0;
+    config.bytes = 0.0;
+    config.threads[0] = 1;
+    config.threads[1] = 1;
+}
@@ -1,47 +1,122 @@
 #ifndef BENCH_H
 #define BENCH_H
 
+#include <stdbool.h>
 #include <stddef.h>
-#include <stdio.h>
-#include <time.h>
-
-#define BENCH(label, iter_count, expr_scalar, expr_vector)                    \
-    do                                                                        \
-    {                                                                         \
-        size_t bench_iter = (iter_count);                                     \
-        struct timespec bench_start, bench_end;                               \
-        clock_gettime(CLOCK_MONOTONIC, &bench_start);                         \
-        for (size_t bench_i = 0; bench_i < bench_iter; bench_i++)             \
-        {                                                                     \
-            expr_scalar;                                                      \
-        }                                                                     \
-        clock_gettime(CLOCK_MONOTONIC, &bench_end);                           \
-        long bench_sec = bench_end.tv_sec - bench_start.tv_sec;               \
-        long bench_nsec = bench_end.tv_nsec - bench_start.tv_nsec;            \
-        if (bench_nsec < 0)                                                   \
-        {                                                                     \
-            bench_nsec += 1000000000L;                                        \
-            bench_sec -= 1;                                                   \
-        }                                                                     \
-        double bench_scalar_ns = 1.0e9 * (double)bench_sec + (double)bench_nsec; \
-        bench_scalar_ns /= (double)bench_iter;                                \
-        clock_gettime(CLOCK_MONOTONIC, &bench_start);                         \
-        for (size_t bench_j = 0; bench_j < bench_iter; bench_j++)             \
-        {                                                                     \
-            expr_vector;                                                      \
-        }                                                                     \
-        clock_gettime(CLOCK_MONOTONIC, &bench_end);                           \
-        bench_sec = bench_end.tv_sec - bench_start.tv_sec;                    \
-        bench_nsec = bench_end.tv_nsec - bench_start.tv_nsec;                 \
-        if (bench_nsec < 0)                                                   \
-        {                                                                     \
-            bench_nsec += 1000000000L;                                        \
-            bench_sec -= 1;                                                   \
-        }                                                                     \
-        double bench_vector_ns = 1.0e9 * (double)bench_sec + (double)bench_nsec; \
-        bench_vector_ns /= (double)bench_iter;                                \
-        printf("%zu %.6f %.6f\n", (size_t)(label),                            \
-               bench_scalar_ns / 1.0e6, bench_vector_ns / 1.0e6);             \
+
+#include "counters.h"
+
+// Each measured expression first runs in doubling batches for at least
+// BENCH_WARMUP_MS, which also calibrates how many iterations make one sample of
+// about BENCH_SAMPLE_MS. Samples are then taken until BENCH_TIME_MS has passed,
+// but never fewer than BENCH_MIN_SAMPLES or more than BENCH_MAX_SAMPLES.
+#define BENCH_WARMUP_MS 20.0
+#define BENCH_SAMPLE_MS 2.0
+#define BENCH_TIME_MS 200.0
+#define BENCH_MIN_SAMPLES 5
+#define BENCH_MAX_SAMPLES 200
+
+enum bench_format
+{
+    BENCH_FORMAT_TEXT,
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON
+};
+
+// Per-iteration times of one expression. Mean and stddev leave out samples
+// beyond the 1.5 IQR fences, which are counted in outliers. Counters are
+// per-iteration averages over the sampling phase, -1 when not collected.
+struct bench_stats
+{
+    double min_ms;
+    double median_ms;
+    double p95_ms;
+    double mean_ms;
+    double stddev_ms;
+    size_t iterations;
+    size_t samples;
+    size_t outliers;
+    double counters[HW_COUNTER_COUNT];
+};
+
+// Loop state behind BENCH_MEASURE; batch is the iteration count of the sample
+// being timed.
+struct bench_run
+{
+    size_t batch;
+    bool measuring;
+    double start_ms;
+    double warmup_ms;
+    double measured_ms;
+    size_t count;
+    double samples[BENCH_MAX_SAMPLES];
+    double counters[HW_COUNTER_COUNT];
+};
+
+// Settings come from the environment on first use: BENCH_FORMAT=text|csv|json,
+// BENCH_TIME_MS for the sampling budget, BENCH_CPU to pin the calling thread and
+// BENCH_COUNTERS=1 to read hardware counters during sampling. Counters follow
+// the calling thread only, so work done by scheduler threads is not in them;
+// see bench_threads.
+void bench_run_init(struct bench_run *run);
+// Closes the batch that just ran and starts the next; false once done.
+bool bench_run_next(struct bench_run *run);
+void bench_run_stats(const struct bench_run *run, struct bench_stats *stats);
+
+// Pins the calling thread to one CPU; false if the kernel refused.
+bool bench_pin_cpu(int cpu);
+
+// Words that name the next reported line, printf-style, e.g. "pair random".
+void bench_tag(const char *format, ...);
+// Work of one iteration of the next reported expressions, used to derive
+// GFLOP/s, GB/s, bytes per cycle and flops per FP instruction; zero leaves the
+// figure out.
+void bench_work(double flops, double bytes);
+// Threads that run the scalar and the vector expression of the next report, one
+// by default. Counters of a side on more than one thread miss the helpers' work,
+// so they and the figures derived from them are reported as unknown.
+void bench_threads(size_t scalar, size_t vector);
+// Text lines are "[tag] label scalar_median_ms vector_median_ms", which plot.py
+// has always read, followed with counters on by a "# [tag] label ipc ... gflops
+// ... gb_per_s ... bytes_per_cycle ... flops_per_fp_op ..." line giving scalar
+// and vector values,
+// "-" when unknown. CSV and JSON lines carry every statistic and counter of both sides.
+void bench_report(size_t label, const struct bench_stats *scalar, const struct bench_stats *vector);
+
+// Keeps the computation behind p: the compiler must assume the pointed-to
+// memory is read here.
+static inline void bench_do_not_optimize(const void *p)
+{
+    __asm__ volatile("" : : "g"(p) : "memory");
+}
+
+// Forces pending stores to memory and later loads to come from it.
+static inline void bench_clobber_memory(void)
+{
+    __asm__ volatile("" : : : "memory");
+}
+
+#define BENCH_MEASURE(stats, expr)                                           \
+    do                                                                       \
+    {                                                                        \
+        struct bench_run bench_run_;                                         \
+        bench_run_init(&bench_run_);                                         \
+        while (bench_run_next(&bench_run_))                                  \
+            for (size_t bench_i_ = 0; bench_i_ < bench_run_.batch; bench_i_++) \
+            {                                                                \
+                expr;                                                        \
+                bench_clobber_memory();                                      \
+            }                                                                \
+        bench_run_stats(&bench_run_, (stats));                               \
+    } while (false)
+
+#define BENCH(label, expr_scalar, expr_vector)                               \
+    do                                                                       \
+    {                                                                        \
+        struct bench_stats bench_scalar_, bench_vector_;                     \
+        BENCH_MEASURE(&bench_scalar_, expr_scalar);                          \
+        BENCH_MEASURE(&bench_vector_, expr_vector);                          \
+        bench_report((size_t)(label), &bench_scalar_, &bench_vector_);       \
     } while (false)
 
 #endif
@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+
+#include "counters.h"
+
+#include <cpuid.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// FP_ARITH_INST_RETIRED with every umask bit: scalar, 128, 256 and 512-bit,
+// single and double precision.
+#define INTEL_FP_ARITH_ALL 0xffc7u
+
+static const char *const counter_names[] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "fp_ops",
+};
+
+static bool is_intel(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return ebx == 0x756e6547u && edx == 0x49656e69u && ecx == 0x6c65746eu;
+}
+
+static void describe(enum hw_counter counter, struct perf_event_attr *attr)
+{
+    switch (counter)
+    {
+    case HW_COUNTER_CYCLES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case HW_COUNTER_INSTRUCTIONS:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case HW_COUNTER_L1D_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case HW_COUNTER_LLC_MISSES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    case HW_COUNTER_BRANCH_MISSES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    default:
+        attr->type = PERF_TYPE_RAW;
+        attr->config = INTEL_FP_ARITH_ALL;
+        break;
+    }
+}
+
+bool hw_counters_open(struct hw_counters *counters)
+{
+    bool intel = is_intel();
+    bool any = false;
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+    {
+        counters->fds[i] = -1;
+        if (i == HW_COUNTER_FP_OPS && !intel)
+            continue;
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        describe((enum hw_counter)i, &attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        any |= counters->fds[i] >= 0;
+    }
+    return any;
+}
+
+void hw_counters_close(struct hw_counters *counters)
+{
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+    {
+        if (counters->fds[i] >= 0)
+            close(counters->fds[i]);
+        counters->fds[i] = -1;
+    }
+}
+
+void hw_counters_start(struct hw_counters *counters)
+{
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+        if (counters->fds[i] >= 0)
+        {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+void hw_counters_stop(struct hw_counters *counters, double values[HW_COUNTER_COUNT])
+{
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+        if (counters->fds[i] >= 0)
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (int i = 0; i < HW_COUNTER_COUNT; i++)
+    {
+        values[i] = -1.0;
+        // value, time enabled, time running
+        uint64_t data[3];
+        if (counters->fds[i] < 0 || read(counters->fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+            continue;
+        values[i] = (double)data[0] * ((double)data[1] / (double)data[2]);
+    }
+}
+
+const char *hw_counter_name(enum hw_counter counter)
+{
+    return counter_names[counter];
+}
@@ -0,0 +1,40 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdbool.h>
+
+enum hw_counter
+{
+    HW_COUNTER_CYCLES,
+    HW_COUNTER_INSTRUCTIONS,
+    HW_COUNTER_L1D_MISSES,
+    HW_COUNTER_LLC_MISSES,
+    HW_COUNTER_BRANCH_MISSES,
+    // FP arithmetic instructions retired, any width: a packed instruction
+    // counts once, an FMA twice. Only on Intel, through the raw
+    // FP_ARITH_INST_RETIRED event.
+    HW_COUNTER_FP_OPS,
+    HW_COUNTER_COUNT
+};
+
+// One perf_event_open descriptor per event, user space only, following the
+// calling thread. Events the kernel or the CPU refuses stay closed; that is the
+// normal case in containers and VMs without a virtual PMU.
+struct hw_counters
+{
+    int fds[HW_COUNTER_COUNT];
+};
+
+// False if not a single event could be opened.
+bool hw_counters_open(struct hw_counters *counters);
+void hw_counters_close(struct hw_counters *counters);
+
+// Resets and enables every open event.
+void hw_counters_start(struct hw_counters *counters);
+// Disables the events and stores their counts, scaled up when the kernel had to
+// multiplex them; -1 for events that are not open.
+void hw_counters_stop(struct hw_counters *counters, double values[HW_COUNTER_COUNT]);
+
+const char *hw_counter_name(enum hw_counter counter);
+
+#endif // COUNTERS_H
@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cpu.h"
+
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+// XCR0 bits the OS sets when it saves the register state on context switches.
+#define XCR0_YMM 0x6u
+#define XCR0_ZMM 0xe6u
+
+static const char *const level_names[] = {"scalar", "sse4.2", "avx2", "avx512"};
+
+// Not thread-safe on purpose: the first call happens in a constructor, before
+// main can start any threads.
+static int cached_level = -1;
+
+static uint64_t read_xcr0(void)
+{
+    uint32_t lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static enum cpu_level probe_level(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_2))
+        return CPU_LEVEL_SCALAR;
+    bool avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX) && (ecx & bit_FMA);
+    if (!avx || (read_xcr0() & XCR0_YMM) != XCR0_YMM)
+        return CPU_LEVEL_SSE42;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX2))
+        return CPU_LEVEL_SSE42;
+    unsigned int avx512 = bit_AVX512F | bit_AVX512BW | bit_AVX512DQ | bit_AVX512VL;
+    if ((ebx & avx512) != avx512 || (read_xcr0() & XCR0_ZMM) != XCR0_ZMM)
+        return CPU_LEVEL_AVX2;
+    return CPU_LEVEL_AVX512;
+}
+
+enum cpu_level cpu_level(void)
+{
+    if (cached_level >= 0)
+        return (enum cpu_level)cached_level;
+
+    enum cpu_level level = probe_level();
+    const char *forced = getenv("SIMD_LEVEL");
+    if (forced != nullptr && forced[0] != '\0')
+    {
+        size_t wanted = 0;
+        while (wanted < sizeof(level_names) / sizeof(level_names[0]) && strcmp(forced, level_names[wanted]) != 0)
+            wanted++;
+        if (wanted == sizeof(level_names) / sizeof(level_names[0]))
+            die("SIMD_LEVEL must be one of scalar, sse4.2, avx2, avx512");
+        if (wanted > level)
+            fprintf(stderr, "SIMD_LEVEL=%s is not supported here, using %s\n", forced, level_names[level]);
+        else
+            level = (enum cpu_level)wanted;
+    }
+    cached_level = (int)level;
+    return level;
+}
+
+const char *cpu_level_name(enum cpu_level level)
+{
+    return level_names[level];
+}
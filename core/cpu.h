@@ -0,0 +1,21 @@
+#ifndef CPU_H
+#define CPU_H
+
+// Ordered, so a kernel with a variant for a level runs on every level above it.
+enum cpu_level
+{
+    CPU_LEVEL_SCALAR,
+    CPU_LEVEL_SSE42,
+    CPU_LEVEL_AVX2,
+    CPU_LEVEL_AVX512
+};
+
+// Highest level both the CPU and the OS support, probed with cpuid on the first
+// call; modules call it from their startup constructors to bind kernels once.
+// SIMD_LEVEL=scalar|sse4.2|avx2|avx512 in the environment lowers the result,
+// which is how benchmarks pin a variant. AVX2 includes FMA; AVX-512 means the
+// F, BW, DQ and VL subsets.
+enum cpu_level cpu_level(void);
+const char *cpu_level_name(enum cpu_level level);
+
+#endif // CPU_H
@@ -42,3 +42,23 @@ void *safe_realloc(void *memory, size_t count, size_t element_size)
 
     return memory;
 }
+
+void *safe_aligned_alloc(size_t alignment, size_t count, size_t element_size)
+{
+    size_t memory_size;
+    if (ckd_mul(&memory_size, count, element_size))
+        die("memory allocation error: size overflow");
+
+    size_t padded_size;
+    if (ckd_add(&padded_size, memory_size, alignment - 1))
+        die("memory allocation error: size overflow");
+    padded_size -= padded_size % alignment;
+    if (padded_size == 0)
+        padded_size = alignment;
+
+    void *memory = aligned_alloc(alignment, padded_size);
+    if (memory == NULL)
+        die("memory allocation error: out of memory");
+
+    return memory;
+}
@@ -8,9 +8,11 @@
 
 void *safe_alloc(size_t count, size_t element_size, bool zeroing);
 void *safe_realloc(void *memory, size_t count, size_t element_size);
+void *safe_aligned_alloc(size_t alignment, size_t count, size_t element_size);
 
 #define new(T) ((T *)safe_alloc(1, sizeof(T), true))
 #define newarr(T, count) ((T *)safe_alloc((count), sizeof(T), false))
 #define resize(memory, T, count) ((T *)safe_realloc((memory), (count), sizeof(T)))
+#define newarr_aligned(T, count, alignment) ((T *)safe_aligned_alloc((alignment), (count), sizeof(T)))
 
 #endif // UTIL_H
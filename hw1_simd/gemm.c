@@ -0,0 +1,317 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "gemm.h"
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/cpu.h"
+#include "../core/util.h"
+
+// Micro-kernel computing a full mr x nr tile from packed panels into out (row
+// stride ldo), with the panel shape it expects.
+struct gemm_kernel
+{
+    size_t mr;
+    size_t nr;
+    void (*micro)(size_t kc, const float *pa, const float *pb, float *out, size_t ldo, bool accumulate);
+};
+
+static struct gemm_kernel kernel;
+
+static size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+// Packs an mc x kc block of a into mr-row panels, column-major inside a panel.
+// Rows past mc are zero-filled so the micro-kernel never needs a row bound.
+static void pack_a(const float *a, size_t lda, size_t mc, size_t kc, size_t mr, float *packed)
+{
+    for (size_t i = 0; i < mc; i += mr)
+    {
+        size_t rows = min_size(mr, mc - i);
+        for (size_t p = 0; p < kc; p++)
+        {
+            size_t r = 0;
+            for (; r < rows; r++)
+                packed[r] = a[(i + r) * lda + p];
+            for (; r < mr; r++)
+                packed[r] = 0.0f;
+            packed += mr;
+        }
+    }
+}
+
+// Packs a kc x nc block of b into nr-column panels, row-major inside a panel.
+static void pack_b(const float *b, size_t ldb, size_t kc, size_t nc, size_t nr, float *packed)
+{
+    for (size_t j = 0; j < nc; j += nr)
+    {
+        size_t cols = min_size(nr, nc - j);
+        for (size_t p = 0; p < kc; p++)
+        {
+            const float *row = b + p * ldb + j;
+            if (cols == nr)
+            {
+                memcpy(packed, row, nr * sizeof(float));
+            }
+            else
+            {
+                size_t c = 0;
+                for (; c < cols; c++)
+                    packed[c] = row[c];
+                for (; c < nr; c++)
+                    packed[c] = 0.0f;
+            }
+            packed += nr;
+        }
+    }
+}
+
+static void micro_kernel_scalar(size_t kc, const float *pa, const float *pb, float *out, size_t ldo, bool accumulate)
+{
+    float acc[GEMM_MR][GEMM_NR] = {0};
+    for (size_t p = 0; p < kc; p++)
+    {
+        for (size_t r = 0; r < GEMM_MR; r++)
+            for (size_t c = 0; c < GEMM_NR; c++)
+                acc[r][c] += pa[r] * pb[c];
+        pa += GEMM_MR;
+        pb += GEMM_NR;
+    }
+    for (size_t r = 0; r < GEMM_MR; r++)
+        for (size_t c = 0; c < GEMM_NR; c++)
+            out[r * ldo + c] = accumulate ? out[r * ldo + c] + acc[r][c] : acc[r][c];
+}
+
+// No FMA below AVX2, so each step is a multiply and an add.
+[[gnu::target("sse4.2")]] static void micro_kernel_sse42(size_t kc, const float *pa, const float *pb, float *out, size_t ldo, bool accumulate)
+{
+    __m128 acc[GEMM_MR][2];
+    for (size_t r = 0; r < GEMM_MR; r++)
+        acc[r][0] = acc[r][1] = _mm_setzero_ps();
+
+    for (size_t p = 0; p < kc; p++)
+    {
+        __m128 b0 = _mm_load_ps(pb);
+        __m128 b1 = _mm_load_ps(pb + 4);
+#pragma GCC unroll 6
+        for (size_t r = 0; r < GEMM_MR; r++)
+        {
+            __m128 a = _mm_set1_ps(pa[r]);
+            acc[r][0] = _mm_add_ps(acc[r][0], _mm_mul_ps(a, b0));
+            acc[r][1] = _mm_add_ps(acc[r][1], _mm_mul_ps(a, b1));
+        }
+        pa += GEMM_MR;
+        pb += GEMM_NR_SSE42;
+    }
+
+    for (size_t r = 0; r < GEMM_MR; r++)
+    {
+        float *row = out + r * ldo;
+        if (accumulate)
+        {
+            acc[r][0] = _mm_add_ps(acc[r][0], _mm_loadu_ps(row));
+            acc[r][1] = _mm_add_ps(acc[r][1], _mm_loadu_ps(row + 4));
+        }
+        _mm_storeu_ps(row, acc[r][0]);
+        _mm_storeu_ps(row + 4, acc[r][1]);
+    }
+}
+
+[[gnu::target("avx2,fma")]] static void micro_kernel_avx2(size_t kc, const float *pa, const float *pb, float *out, size_t ldo, bool accumulate)
+{
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+    for (size_t p = 0; p < kc; p++)
+    {
+        __m256 b0 = _mm256_load_ps(pb);
+        __m256 b1 = _mm256_load_ps(pb + 8);
+        __m256 a;
+
+        a = _mm256_broadcast_ss(pa + 0);
+        c00 = _mm256_fmadd_ps(a, b0, c00);
+        c01 = _mm256_fmadd_ps(a, b1, c01);
+        a = _mm256_broadcast_ss(pa + 1);
+        c10 = _mm256_fmadd_ps(a, b0, c10);
+        c11 = _mm256_fmadd_ps(a, b1, c11);
+        a = _mm256_broadcast_ss(pa + 2);
+        c20 = _mm256_fmadd_ps(a, b0, c20);
+        c21 = _mm256_fmadd_ps(a, b1, c21);
+        a = _mm256_broadcast_ss(pa + 3);
+        c30 = _mm256_fmadd_ps(a, b0, c30);
+        c31 = _mm256_fmadd_ps(a, b1, c31);
+        a = _mm256_broadcast_ss(pa + 4);
+        c40 = _mm256_fmadd_ps(a, b0, c40);
+        c41 = _mm256_fmadd_ps(a, b1, c41);
+        a = _mm256_broadcast_ss(pa + 5);
+        c50 = _mm256_fmadd_ps(a, b0, c50);
+        c51 = _mm256_fmadd_ps(a, b1, c51);
+
+        pa += GEMM_MR;
+        pb += GEMM_NR;
+    }
+
+    __m256 acc[GEMM_MR][2] = {
+        {c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    for (size_t r = 0; r < GEMM_MR; r++)
+    {
+        float *row = out + r * ldo;
+        if (accumulate)
+        {
+            acc[r][0] = _mm256_add_ps(acc[r][0], _mm256_loadu_ps(row));
+            acc[r][1] = _mm256_add_ps(acc[r][1], _mm256_loadu_ps(row + 8));
+        }
+        _mm256_storeu_ps(row, acc[r][0]);
+        _mm256_storeu_ps(row + 8, acc[r][1]);
+    }
+}
+
+// B is read once per step as two zmm rows and each packed A value is broadcast
+// straight into its two FMAs.
+[[gnu::target("avx512f")]] static void micro_kernel_avx512(size_t kc, const float *pa, const float *pb, float *out, size_t ldo, bool accumulate)
+{
+    __m512 acc[GEMM_MR_AVX512][2];
+    for (size_t r = 0; r < GEMM_MR_AVX512; r++)
+        acc[r][0] = acc[r][1] = _mm512_setzero_ps();
+
+    for (size_t p = 0; p < kc; p++)
+    {
+        __m512 b0 = _mm512_load_ps(pb);
+        __m512 b1 = _mm512_load_ps(pb + 16);
+#pragma GCC unroll 12
+        for (size_t r = 0; r < GEMM_MR_AVX512; r++)
+        {
+            __m512 a = _mm512_set1_ps(pa[r]);
+            acc[r][0] = _mm512_fmadd_ps(a, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(a, b1, acc[r][1]);
+        }
+        pa += GEMM_MR_AVX512;
+        pb += GEMM_NR_AVX512;
+    }
+
+    for (size_t r = 0; r < GEMM_MR_AVX512; r++)
+    {
+        float *row = out + r * ldo;
+        if (accumulate)
+        {
+            acc[r][0] = _mm512_add_ps(acc[r][0], _mm512_loadu_ps(row));
+            acc[r][1] = _mm512_add_ps(acc[r][1], _mm512_loadu_ps(row + 16));
+        }
+        _mm512_storeu_ps(row, acc[r][0]);
+        _mm512_storeu_ps(row + 16, acc[r][1]);
+    }
+}
+
+[[gnu::constructor]] static void gemm_dispatch(void)
+{
+    switch (cpu_level())
+    {
+    case CPU_LEVEL_AVX512:
+        kernel = (struct gemm_kernel){GEMM_MR_AVX512, GEMM_NR_AVX512, micro_kernel_avx512};
+        break;
+    case CPU_LEVEL_AVX2:
+        kernel = (struct gemm_kernel){GEMM_MR, GEMM_NR, micro_kernel_avx2};
+        break;
+    case CPU_LEVEL_SSE42:
+        kernel = (struct gemm_kernel){GEMM_MR, GEMM_NR_SSE42, micro_kernel_sse42};
+        break;
+    default:
+        kernel = (struct gemm_kernel){GEMM_MR, GEMM_NR, micro_kernel_scalar};
+        break;
+    }
+}
+
+static void macro_kernel(size_t mc,
+                         size_t nc,
+                         size_t kc,
+                         const float *packed_a,
+                         const float *packed_b,
+                         float *c,
+                         size_t ldc,
+                         bool accumulate)
+{
+    size_t mr = kernel.mr;
+    size_t nr = kernel.nr;
+    float edge[GEMM_MR_AVX512 * GEMM_NR_AVX512];
+
+    for (size_t j = 0; j < nc; j += nr)
+    {
+        size_t cols = min_size(nr, nc - j);
+        const float *pb = packed_b + j * kc;
+        for (size_t i = 0; i < mc; i += mr)
+        {
+            size_t rows = min_size(mr, mc - i);
+            const float *pa = packed_a + i * kc;
+            float *tile = c + i * ldc + j;
+
+            if (rows == mr && cols == nr)
+            {
+                kernel.micro(kc, pa, pb, tile, ldc, accumulate);
+                continue;
+            }
+
+            kernel.micro(kc, pa, pb, edge, nr, false);
+            for (size_t r = 0; r < rows; r++)
+                for (size_t q = 0; q < cols; q++)
+                    tile[r * ldc + q] = accumulate
+                        ? tile[r * ldc + q] + edge[r * nr + q]
+                        : edge[r * nr + q];
+        }
+    }
+}
+
+void gemm(size_t m,
+          size_t n,
+          size_t k,
+          const float *a,
+          size_t lda,
+          const float *b,
+          size_t ldb,
+          float *c,
+          size_t ldc)
+{
+    if (m == 0 || n == 0)
+        return;
+
+    if (k == 0)
+    {
+        for (size_t i = 0; i < m; i++)
+            memset(c + i * ldc, 0, n * sizeof(float));
+        return;
+    }
+
+    size_t mr = kernel.mr;
+    size_t nr = kernel.nr;
+    size_t mc_max = min_size(GEMM_MC, (m + mr - 1) / mr * mr);
+    size_t nc_max = min_size(GEMM_NC, (n + nr - 1) / nr * nr);
+    size_t kc_max = min_size(GEMM_KC, k);
+    float *packed_a = newarr_aligned(float, mc_max * kc_max, 64);
+    float *packed_b = newarr_aligned(float, kc_max * nc_max, 64);
+
+    for (size_t jc = 0; jc < n; jc += GEMM_NC)
+    {
+        size_t nc = min_size(GEMM_NC, n - jc);
+        for (size_t pc = 0; pc < k; pc += GEMM_KC)
+        {
+            size_t kc = min_size(GEMM_KC, k - pc);
+            pack_b(b + pc * ldb + jc, ldb, kc, nc, nr, packed_b);
+            for (size_t ic = 0; ic < m; ic += GEMM_MC)
+            {
+                size_t mc = min_size(GEMM_MC, m - ic);
+                pack_a(a + ic * lda + pc, lda, mc, kc, mr, packed_a);
+                macro_kernel(mc, nc, kc, packed_a, packed_b, c + ic * ldc + jc, ldc, pc != 0);
+            }
+        }
+    }
+
+    free(packed_a);
+    free(packed_b);
+}
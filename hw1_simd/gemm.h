@@ -0,0 +1,29 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stddef.h>
+
+// Micro-tile shapes, picked at startup for the CPU: AVX2 and the scalar fallback
+// use GEMM_MR x GEMM_NR (twelve ymm accumulators), SSE4.2 GEMM_MR x
+// GEMM_NR_SSE42 (twelve xmm), AVX-512 GEMM_MR_AVX512 x GEMM_NR_AVX512 (24 zmm).
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_NR_SSE42 8
+#define GEMM_MR_AVX512 12
+#define GEMM_NR_AVX512 32
+#define GEMM_MC 120
+#define GEMM_KC 256
+#define GEMM_NC 4096
+
+// c[m x n] = a[m x k] * b[k x n], all row-major with leading dimensions lda, ldb, ldc.
+void gemm(size_t m,
+          size_t n,
+          size_t k,
+          const float *a,
+          size_t lda,
+          const float *b,
+          size_t ldb,
+          float *c,
+          size_t ldc);
+
+#endif // GEMM_H
@@ -1,19 +1,20 @@
 #define _POSIX_C_SOURCE 200809L
 
-#include <immintrin.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include "gemm.h"
+#include "../core/cpu.h"
 #include "../core/util.h"
 #include "../core/bench.h"
 
-static void fill_matrix(float *data, size_t n, unsigned int seed)
+static void fill_matrix(float *data, size_t rows, size_t cols, unsigned int seed)
 {
     srand(seed);
-    size_t total = n * n;
+    size_t total = rows * cols;
     for (size_t i = 0; i < total; i++)
     {
         float r = (float)rand() / (float)RAND_MAX;
@@ -21,72 +22,25 @@ static void fill_matrix(float *data, size_t n, unsigned int seed)
     }
 }
 
-static void transpose(const float *src, float *dst, size_t n)
+static void matmul_scalar(const float *a, const float *b, float *c, size_t m, size_t n, size_t k)
 {
-    for (size_t i = 0; i < n; i++)
-    {
-        for (size_t j = 0; j < n; j++)
-        {
-            dst[j * n + i] = src[i * n + j];
-        }
-    }
-}
-
-static void matmul_scalar(const float *a, const float *b, float *c, size_t n)
-{
-    for (size_t i = 0; i < n; i++)
+    for (size_t i = 0; i < m; i++)
     {
         for (size_t j = 0; j < n; j++)
         {
             float sum = 0.0f;
-            for (size_t k = 0; k < n; k++)
+            for (size_t p = 0; p < k; p++)
             {
-                sum += a[i * n + k] * b[k * n + j];
+                sum += a[i * k + p] * b[p * n + j];
             }
             c[i * n + j] = sum;
         }
     }
 }
 
-static float hsum256_ps(__m256 v)
-{
-    __m128 low = _mm256_castps256_ps128(v);
-    __m128 high = _mm256_extractf128_ps(v, 1);
-    __m128 sum = _mm_add_ps(low, high);
-    sum = _mm_hadd_ps(sum, sum);
-    sum = _mm_hadd_ps(sum, sum);
-    return _mm_cvtss_f32(sum);
-}
-
-static void matmul_avx(const float *a, const float *bt, float *c, size_t n)
+static int compare(const float *a, const float *b, size_t count)
 {
-    const size_t step = 8;
-    for (size_t i = 0; i < n; i++)
-    {
-        for (size_t j = 0; j < n; j++)
-        {
-            __m256 acc = _mm256_setzero_ps();
-            size_t k = 0;
-            for (; k + step <= n; k += step)
-            {
-                __m256 va = _mm256_loadu_ps(a + i * n + k);
-                __m256 vb = _mm256_loadu_ps(bt + j * n + k);
-                acc = _mm256_add_ps(acc, _mm256_mul_ps(va, vb));
-            }
-            float sum = hsum256_ps(acc);
-            for (; k < n; k++)
-            {
-                sum += a[i * n + k] * bt[j * n + k];
-            }
-            c[i * n + j] = sum;
-        }
-    }
-}
-
-static int compare(const float *a, const float *b, size_t n)
-{
-    size_t total = n * n;
-    for (size_t i = 0; i < total; i++)
+    for (size_t i = 0; i < count; i++)
     {
         float d = fabsf(a[i] - b[i]);
         if (d > 1e-3f)
@@ -98,54 +52,80 @@ static int compare(const float *a, const float *b, size_t n)
 static void matmul_scalar_run(const float *a, const float *b, float *c, size_t n)
 {
     memset(c, 0, n * n * sizeof(float));
-    matmul_scalar(a, b, c, n);
+    matmul_scalar(a, b, c, n, n, n);
 }
 
-static void matmul_avx_run(const float *a, const float *bt, float *c, size_t n)
+static void matmul_gemm_run(const float *a, const float *b, float *c, size_t n)
 {
-    memset(c, 0, n * n * sizeof(float));
-    matmul_avx(a, bt, c, n);
+    gemm(n, n, n, a, n, b, n, c, n);
+}
+
+static int check_shape(size_t m, size_t n, size_t k)
+{
+    float *a = newarr(float, m * k);
+    float *b = newarr(float, k * n);
+    float *c_scalar = newarr(float, m * n);
+    float *c_gemm = newarr(float, m * n);
+
+    fill_matrix(a, m, k, (unsigned int)(m + 1));
+    fill_matrix(b, k, n, (unsigned int)(n + 2));
+    matmul_scalar(a, b, c_scalar, m, n, k);
+    gemm(m, n, k, a, k, b, n, c_gemm, n);
+    int ok = compare(c_scalar, c_gemm, m * n);
+
+    free(a);
+    free(b);
+    free(c_scalar);
+    free(c_gemm);
+    return ok;
 }
 
 int main(void)
 {
     size_t sizes[] = {128, 192, 256, 320, 384, 448, 512};
     size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
-    size_t repeats = 5;
+    fprintf(stderr, "gemm: %s\n", cpu_level_name(cpu_level()));
+
+    size_t shapes[][3] = {{1, 1, 1}, {7, 13, 5}, {67, 131, 45}, {130, 17, 300}, {250, 4100, 9}};
+    for (size_t idx = 0; idx < sizeof(shapes) / sizeof(shapes[0]); idx++)
+    {
+        if (!check_shape(shapes[idx][0], shapes[idx][1], shapes[idx][2]))
+        {
+            fprintf(stderr, "mismatch at shape %zux%zux%zu\n", shapes[idx][0], shapes[idx][1], shapes[idx][2]);
+            return EXIT_FAILURE;
+        }
+    }
 
     for (size_t idx = 0; idx < size_count; idx++)
     {
         size_t n = sizes[idx];
         float *a = newarr(float, n * n);
         float *b = newarr(float, n * n);
-        float *bt = newarr(float, n * n);
         float *c_scalar = newarr(float, n * n);
-        float *c_avx = newarr(float, n * n);
+        float *c_gemm = newarr(float, n * n);
 
-        fill_matrix(a, n, (unsigned int)(n + 1));
-        fill_matrix(b, n, (unsigned int)(n + 2));
-        transpose(b, bt, n);
+        fill_matrix(a, n, n, (unsigned int)(n + 1));
+        fill_matrix(b, n, n, (unsigned int)(n + 2));
 
         matmul_scalar_run(a, b, c_scalar, n);
-        matmul_avx_run(a, bt, c_avx, n);
-        if (!compare(c_scalar, c_avx, n))
+        matmul_gemm_run(a, b, c_gemm, n);
+        if (!compare(c_scalar, c_gemm, n * n))
         {
             fprintf(stderr, "mismatch at size %zu\n", n);
             free(a);
             free(b);
-            free(bt);
             free(c_scalar);
-            free(c_avx);
+            free(c_gemm);
             return EXIT_FAILURE;
         }
 
-        BENCH(n, repeats, matmul_scalar_run(a, b, c_scalar, n), matmul_avx_run(a, bt, c_avx, n));
+        bench_work(2.0 * (double)n * (double)n * (double)n, 3.0 * (double)(n * n) * sizeof(float));
+        BENCH(n, matmul_scalar_run(a, b, c_scalar, n), matmul_gemm_run(a, b, c_gemm, n));
 
         free(a);
         free(b);
-        free(bt);
         free(c_scalar);
-        free(c_avx);
+        free(c_gemm);
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+
+#include "conv.h"
+#include "conv_util.h"
+#include "../core/util.h"
+
+// Files read ahead of the workers; bounds the memory held by compressed inputs.
+#define BATCH_PREFETCH_PER_WORKER 2
+#define BATCH_QUALITY 90
+
+struct batch_item
+{
+    const char *path;
+    const char *name;
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+};
+
+struct item_queue
+{
+    struct batch_item **items;
+    size_t slots;
+    size_t head;
+    size_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+struct batch
+{
+    const struct conv_plan *plan;
+    const char *output_dir;
+    char **paths;
+    // Output file names, unique within output_dir.
+    char **names;
+    size_t path_count;
+    size_t worker_count;
+    struct batch_item *items;
+    size_t item_count;
+    struct item_queue free_items;
+    struct item_queue full_items;
+    atomic_size_t processed;
+    atomic_size_t failed;
+};
+
+// Everything a worker needs per image, grown to the largest image seen so far.
+struct batch_scratch
+{
+    struct conv_image image;
+    struct conv_image output;
+    float *luma;
+    size_t luma_capacity;
+    float *values;
+    size_t values_capacity;
+    unsigned char *jpeg;
+    size_t jpeg_capacity;
+};
+
+static void item_queue_init(struct item_queue *queue, size_t slots)
+{
+    queue->items = newarr(struct batch_item *, slots);
+    queue->slots = slots;
+    queue->head = 0;
+    queue->count = 0;
+    if (pthread_mutex_init(&queue->mutex, nullptr) != 0)
+        die("mutex init failed");
+    if (pthread_cond_init(&queue->cond, nullptr) != 0)
+        die("cond init failed");
+}
+
+static void item_queue_destroy(struct item_queue *queue)
+{
+    free(queue->items);
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->cond);
+}
+
+static void item_queue_push(struct item_queue *queue, struct batch_item *item)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->items[(queue->head + queue->count) % queue->slots] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static struct batch_item *item_queue_pop(struct item_queue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    struct batch_item *item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->slots;
+    queue->count--;
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+static bool read_file(const char *path, struct batch_item *item)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+    item->size = 0;
+    for (;;)
+    {
+        if (item->size == item->capacity)
+        {
+            item->capacity = item->capacity == 0 ? 1 << 16 : item->capacity * 2;
+            item->data = resize(item->data, unsigned char, item->capacity);
+        }
+        size_t got = fread(item->data + item->size, 1, item->capacity - item->size, file);
+        item->size += got;
+        if (got == 0)
+            break;
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+// Reads whole files ahead of the workers, so disk latency overlaps with decoding
+// and convolution; one nullptr per worker ends the run.
+static void *reader_run(void *arg)
+{
+    struct batch *batch = arg;
+    for (size_t i = 0; i < batch->path_count; i++)
+    {
+        struct batch_item *item = item_queue_pop(&batch->free_items);
+        if (!read_file(batch->paths[i], item))
+        {
+            perror(batch->paths[i]);
+            atomic_fetch_add(&batch->failed, 1);
+            item_queue_push(&batch->free_items, item);
+            continue;
+        }
+        item->path = batch->paths[i];
+        item->name = batch->names[i];
+        item_queue_push(&batch->full_items, item);
+    }
+    for (size_t i = 0; i < batch->worker_count; i++)
+        item_queue_push(&batch->full_items, nullptr);
+    return nullptr;
+}
+
+static float *grow(float *data, size_t *capacity, size_t count)
+{
+    if (*capacity >= count)
+        return data;
+    free(data);
+    *capacity = count;
+    return newarr_aligned(float, count, 64);
+}
+
+static void grow_planes(struct conv_image *image, size_t count)
+{
+    if (image->capacity >= count)
+        return;
+    image->r = resize(image->r, unsigned char, count);
+    image->g = resize(image->g, unsigned char, count);
+    image->b = resize(image->b, unsigned char, count);
+    image->capacity = count;
+}
+
+static bool process(struct batch *batch, struct batch_scratch *scratch, struct batch_item *item)
+{
+    const struct conv_plan *plan = batch->plan;
+    struct conv_image *image = &scratch->image;
+    bool decoded = decode_jpeg(item->data, item->size, image);
+    const char *path = item->path;
+    const char *name = item->name;
+    item_queue_push(&batch->free_items, item);
+    if (!decoded)
+    {
+        fprintf(stderr, "%s: cannot decode\n", path);
+        return false;
+    }
+
+    size_t ih = image->height;
+    size_t iw = image->width;
+    if (ih < plan->rows || iw < plan->cols)
+    {
+        fprintf(stderr, "%s: image is smaller than the kernel\n", path);
+        return false;
+    }
+    size_t total = ih * iw;
+    scratch->luma = grow(scratch->luma, &scratch->luma_capacity, total);
+    conv_image_to_luma(image, scratch->luma);
+
+    size_t oh = ih - plan->rows + 1;
+    size_t ow = iw - plan->cols + 1;
+    size_t out_total = oh * ow;
+    scratch->values = grow(scratch->values, &scratch->values_capacity, out_total);
+    conv_apply(plan, scratch->luma, ih, iw, scratch->values, nullptr);
+
+    struct conv_image *output = &scratch->output;
+    grow_planes(output, out_total);
+    output->width = (unsigned int)ow;
+    output->height = (unsigned int)oh;
+    luma_to_conv_image(scratch->values, output);
+    size_t size = encode_jpeg(output, BATCH_QUALITY, &scratch->jpeg, &scratch->jpeg_capacity);
+
+    char out_path[4096];
+    if (snprintf(out_path, sizeof(out_path), "%s/%s", batch->output_dir, name) >= (int)sizeof(out_path))
+    {
+        fprintf(stderr, "%s: output path too long\n", path);
+        return false;
+    }
+    FILE *file = fopen(out_path, "wb");
+    if (file == nullptr)
+    {
+        perror(out_path);
+        return false;
+    }
+    bool ok = fwrite(scratch->jpeg, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        perror(out_path);
+    return ok;
+}
+
+static void *worker_run(void *arg)
+{
+    struct batch *batch = arg;
+    struct batch_scratch scratch = {0};
+    conv_image_init(&scratch.image);
+    conv_image_init(&scratch.output);
+
+    struct batch_item *item;
+    while ((item = item_queue_pop(&batch->full_items)) != nullptr)
+    {
+        if (process(batch, &scratch, item))
+            atomic_fetch_add(&batch->processed, 1);
+        else
+            atomic_fetch_add(&batch->failed, 1);
+    }
+
+    conv_image_free(&scratch.image);
+    conv_image_free(&scratch.output);
+    free(scratch.luma);
+    free(scratch.values);
+    free(scratch.jpeg);
+    return nullptr;
+}
+
+static bool is_jpeg_name(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot != nullptr && (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void add_path(struct batch *batch, size_t *capacity, const char *path)
+{
+    if (batch->path_count == *capacity)
+    {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        batch->paths = resize(batch->paths, char *, *capacity);
+    }
+    char *copy = strdup(path);
+    if (copy == nullptr)
+        die("out of memory");
+    batch->paths[batch->path_count++] = copy;
+}
+
+// A directory contributes its .jpg/.jpeg entries in name order; any other file
+// is read as a list of paths, one per line.
+static void collect_inputs(struct batch *batch, const char *source)
+{
+    size_t capacity = 0;
+    struct stat st;
+    if (stat(source, &st) != 0)
+    {
+        perror(source);
+        exit(EXIT_FAILURE);
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(source);
+        if (dir == nullptr)
+        {
+            perror(source);
+            exit(EXIT_FAILURE);
+        }
+        struct dirent *entry;
+        char path[4096];
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            if (!is_jpeg_name(entry->d_name))
+                continue;
+            if (snprintf(path, sizeof(path), "%s/%s", source, entry->d_name) < (int)sizeof(path))
+                add_path(batch, &capacity, path);
+        }
+        closedir(dir);
+        qsort(batch->paths, batch->path_count, sizeof(char *), compare_paths);
+        return;
+    }
+
+    FILE *list = fopen(source, "r");
+    if (list == nullptr)
+    {
+        perror(source);
+        exit(EXIT_FAILURE);
+    }
+    char *line = nullptr;
+    size_t line_capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, list)) != -1)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+        if (length > 0)
+            add_path(batch, &capacity, line);
+    }
+    free(line);
+    fclose(list);
+}
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash == nullptr ? path : slash + 1;
+}
+
+// Base names of the inputs, with list order as the tie-break.
+static const char *const *sort_paths;
+
+static int compare_by_name(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a;
+    size_t y = *(const size_t *)b;
+    int order = strcmp(base_name(sort_paths[x]), base_name(sort_paths[y]));
+    return order != 0 ? order : (x > y) - (x < y);
+}
+
+// Outputs are named after the input's base name. A list file may name several
+// inputs with the same base name; in list order those get "<stem>-<n><ext>",
+// skipping any n whose name an input already uses. Generated names cannot
+// collide across stems, since stem and n are both recovered from the text
+// around the last '-'.
+static void assign_names(struct batch *batch)
+{
+    size_t count = batch->path_count;
+    const char **bases = newarr(const char *, count + 1);
+    size_t *order = newarr(size_t, count + 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        bases[i] = base_name(batch->paths[i]);
+        order[i] = i;
+    }
+    qsort(bases, count, sizeof(char *), compare_paths);
+    sort_paths = (const char *const *)batch->paths;
+    qsort(order, count, sizeof(size_t), compare_by_name);
+
+    batch->names = newarr(char *, count + 1);
+    for (size_t begin = 0, end; begin < count; begin = end)
+    {
+        const char *base = base_name(batch->paths[order[begin]]);
+        for (end = begin + 1; end < count && strcmp(base_name(batch->paths[order[end]]), base) == 0; end++)
+            ;
+        if (end - begin == 1)
+        {
+            batch->names[order[begin]] = strdup(base);
+            if (batch->names[order[begin]] == nullptr)
+                die("out of memory");
+            continue;
+        }
+
+        const char *dot = strrchr(base, '.');
+        int stem = dot == nullptr ? (int)strlen(base) : (int)(dot - base);
+        const char *ext = dot == nullptr ? "" : dot;
+        size_t n = 0;
+        for (size_t k = begin; k < end; k++)
+        {
+            char *name;
+            for (;;)
+            {
+                if (asprintf(&name, "%.*s-%zu%s", stem, base, ++n, ext) < 0)
+                    die("out of memory");
+                const char *key = name;
+                if (bsearch(&key, bases, count, sizeof(char *), compare_paths) == nullptr)
+                    break;
+                free(name);
+            }
+            batch->names[order[k]] = name;
+        }
+    }
+    free(bases);
+    free(order);
+}
+
+static double get_time_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4 || argc > 5)
+    {
+        fprintf(stderr, "usage: %s <kernel-file> <output-dir> <input-dir | list-file> [workers]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct conv_mat mat;
+    conv_mat_init(&mat);
+    read_conv_mat(argv[1], &mat);
+    struct conv_plan plan;
+    conv_plan_init(&plan, &mat);
+    conv_mat_free(&mat);
+
+    struct batch batch = {0};
+    batch.plan = &plan;
+    batch.output_dir = argv[2];
+    collect_inputs(&batch, argv[3]);
+    assign_names(&batch);
+    batch.worker_count = argc == 5 ? strtoul(argv[4], nullptr, 10) : 0;
+    if (batch.worker_count == 0)
+        batch.worker_count = (size_t)get_nprocs();
+    atomic_init(&batch.processed, 0);
+    atomic_init(&batch.failed, 0);
+
+    batch.item_count = batch.worker_count * BATCH_PREFETCH_PER_WORKER;
+    batch.items = safe_alloc(batch.item_count, sizeof(struct batch_item), true);
+    item_queue_init(&batch.free_items, batch.item_count + 1);
+    item_queue_init(&batch.full_items, batch.item_count + batch.worker_count + 1);
+    for (size_t i = 0; i < batch.item_count; i++)
+        item_queue_push(&batch.free_items, &batch.items[i]);
+
+    double start = get_time_s();
+    pthread_t reader;
+    pthread_t *workers = newarr(pthread_t, batch.worker_count);
+    if (pthread_create(&reader, nullptr, reader_run, &batch) != 0)
+        die("pthread_create failed");
+    for (size_t i = 0; i < batch.worker_count; i++)
+        if (pthread_create(&workers[i], nullptr, worker_run, &batch) != 0)
+            die("pthread_create failed");
+    pthread_join(reader, nullptr);
+    for (size_t i = 0; i < batch.worker_count; i++)
+        pthread_join(workers[i], nullptr);
+    double elapsed = get_time_s() - start;
+
+    size_t processed = atomic_load(&batch.processed);
+    printf("%zu images in %.3f s (%.1f images/s), %zu failed, %zu workers\n",
+           processed, elapsed, elapsed > 0.0 ? processed / elapsed : 0.0,
+           atomic_load(&batch.failed), batch.worker_count);
+
+    for (size_t i = 0; i < batch.item_count; i++)
+        free(batch.items[i].data);
+    for (size_t i = 0; i < batch.path_count; i++)
+    {
+        free(batch.paths[i]);
+        free(batch.names[i]);
+    }
+    free(batch.paths);
+    free(batch.names);
+    free(batch.items);
+    free(workers);
+    item_queue_destroy(&batch.free_items);
+    item_queue_destroy(&batch.full_items);
+    conv_plan_free(&plan);
+    return atomic_load(&batch.failed) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
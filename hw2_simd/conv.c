@@ -0,0 +1,1044 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "conv.h"
+
+#include <immintrin.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/cpu.h"
+#include "../core/util.h"
+
+struct conv_job
+{
+    const struct conv_plan *plan;
+    const float *src;
+    size_t w;
+    float *dst;
+    size_t dst_stride;
+    size_t oh;
+    size_t ow;
+    size_t tile_rows;
+    size_t tile_cols;
+    size_t tiles_x;
+    // Per-part scratch of the separable and FFT paths, scratch_len floats each.
+    float *scratch;
+    float *scratch_im;
+    size_t scratch_len;
+};
+
+struct border_job;
+
+// Tile and row kernels for the widest SIMD level the CPU runs, bound once at
+// startup by conv_dispatch. SSE4.2 gets the scalar ones, which the compiler
+// vectorizes on its own.
+struct conv_kernels
+{
+    void (*tile_3x3)(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1);
+    void (*tile_5x5)(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1);
+    void (*tile_generic)(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1);
+    void (*filter_1d)(const float *in, size_t step, const float *taps, size_t count, float *out, size_t len);
+    void (*border_row)(const struct border_job *job, const long *row_map, float *out);
+};
+
+static struct conv_kernels kernels;
+
+static size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+// Rank-1 test against the largest entry: row and column through the pivot must
+// reproduce every other weight.
+static bool factor_separable(struct conv_plan *plan)
+{
+    size_t rows = plan->rows;
+    size_t cols = plan->cols;
+    const float *k = plan->weights;
+    size_t pivot = 0;
+    for (size_t i = 1; i < rows * cols; i++)
+        if (fabsf(k[i]) > fabsf(k[pivot]))
+            pivot = i;
+    float scale = fabsf(k[pivot]);
+    if (scale == 0.0f)
+        return false;
+
+    size_t pr = pivot / cols;
+    size_t pc = pivot % cols;
+    float *col = newarr(float, rows);
+    float *row = newarr(float, cols);
+    for (size_t i = 0; i < rows; i++)
+        col[i] = k[i * cols + pc];
+    for (size_t j = 0; j < cols; j++)
+        row[j] = k[pr * cols + j] / k[pivot];
+
+    for (size_t i = 0; i < rows; i++)
+        for (size_t j = 0; j < cols; j++)
+            if (fabsf(k[i * cols + j] - col[i] * row[j]) > 1e-5f * scale)
+            {
+                free(col);
+                free(row);
+                return false;
+            }
+
+    plan->col_weights = col;
+    plan->row_weights = row;
+    return true;
+}
+
+static size_t fft_size_for(size_t taps)
+{
+    size_t target = taps * 4 <= 256 ? taps * 4 : taps * 2;
+    size_t n = 32;
+    while (n < target)
+        n *= 2;
+    return n;
+}
+
+static void fft_2d(const struct conv_plan *plan, float *re, float *im, bool inverse);
+
+static void fft_plan_init(struct conv_plan *plan)
+{
+    size_t kmax = plan->rows > plan->cols ? plan->rows : plan->cols;
+    size_t n = fft_size_for(kmax);
+    plan->fft_size = n;
+    plan->twiddle_re = newarr(float, n / 2);
+    plan->twiddle_im = newarr(float, n / 2);
+    for (size_t i = 0; i < n / 2; i++)
+    {
+        double angle = -2.0 * acos(-1.0) * (double)i / (double)n;
+        plan->twiddle_re[i] = (float)cos(angle);
+        plan->twiddle_im[i] = (float)sin(angle);
+    }
+
+    plan->spectrum_re = newarr_aligned(float, n * n, 64);
+    plan->spectrum_im = newarr_aligned(float, n * n, 64);
+    memset(plan->spectrum_re, 0, n * n * sizeof(float));
+    memset(plan->spectrum_im, 0, n * n * sizeof(float));
+    for (size_t i = 0; i < plan->rows; i++)
+        memcpy(plan->spectrum_re + i * n, plan->weights + i * plan->cols, plan->cols * sizeof(float));
+    fft_2d(plan, plan->spectrum_re, plan->spectrum_im, false);
+    for (size_t i = 0; i < n * n; i++)
+        plan->spectrum_im[i] = -plan->spectrum_im[i];
+}
+
+void conv_plan_init(struct conv_plan *plan, const struct conv_mat *mat)
+{
+    plan->rows = mat->rows;
+    plan->cols = mat->cols;
+    plan->path = CONV_PATH_GENERIC;
+    plan->weights = newarr_aligned(float, plan->rows * plan->cols, 64);
+    memcpy(plan->weights, mat->values, plan->rows * plan->cols * sizeof(float));
+    plan->row_weights = nullptr;
+    plan->col_weights = nullptr;
+    plan->fft_size = 0;
+    plan->spectrum_re = nullptr;
+    plan->spectrum_im = nullptr;
+    plan->twiddle_re = nullptr;
+    plan->twiddle_im = nullptr;
+
+    if (plan->rows == 3 && plan->cols == 3)
+        plan->path = CONV_PATH_3X3;
+    else if (plan->rows > 1 && plan->cols > 1 && factor_separable(plan))
+        plan->path = CONV_PATH_SEPARABLE;
+    else if (plan->rows == 5 && plan->cols == 5)
+        plan->path = CONV_PATH_5X5;
+    else if (plan->rows * plan->cols >= CONV_FFT_MIN_TAPS)
+        plan->path = CONV_PATH_FFT;
+
+    if (plan->path == CONV_PATH_FFT)
+        fft_plan_init(plan);
+}
+
+void conv_plan_free(struct conv_plan *plan)
+{
+    free(plan->weights);
+    free(plan->row_weights);
+    free(plan->col_weights);
+    free(plan->spectrum_re);
+    free(plan->spectrum_im);
+    free(plan->twiddle_re);
+    free(plan->twiddle_im);
+    plan->weights = nullptr;
+    plan->row_weights = nullptr;
+    plan->col_weights = nullptr;
+    plan->spectrum_re = nullptr;
+    plan->spectrum_im = nullptr;
+    plan->twiddle_re = nullptr;
+    plan->twiddle_im = nullptr;
+    plan->rows = 0;
+    plan->cols = 0;
+}
+
+const char *conv_path_name(enum conv_path path)
+{
+    switch (path)
+    {
+    case CONV_PATH_3X3:
+        return "3x3";
+    case CONV_PATH_5X5:
+        return "5x5";
+    case CONV_PATH_SEPARABLE:
+        return "separable";
+    case CONV_PATH_FFT:
+        return "fft";
+    default:
+        return "generic";
+    }
+}
+
+[[gnu::target("avx2,fma")]] static inline void accumulate_32(const float *row, const float *weights, size_t kw, __m256 acc[4])
+{
+    for (size_t kj = 0; kj < kw; kj++)
+    {
+        __m256 k = _mm256_broadcast_ss(weights + kj);
+        acc[0] = _mm256_fmadd_ps(_mm256_loadu_ps(row + kj), k, acc[0]);
+        acc[1] = _mm256_fmadd_ps(_mm256_loadu_ps(row + kj + 8), k, acc[1]);
+        acc[2] = _mm256_fmadd_ps(_mm256_loadu_ps(row + kj + 16), k, acc[2]);
+        acc[3] = _mm256_fmadd_ps(_mm256_loadu_ps(row + kj + 24), k, acc[3]);
+    }
+}
+
+// Two output rows by 32 columns. Each input row between them is loaded once and
+// feeds both rows, with the upper row using kernel row r and the lower row r - 1.
+[[gnu::always_inline, gnu::target("avx2,fma")]] static inline void block_2x32(const float *src, size_t w, const float *weights, size_t kh, size_t kw, float *dst, size_t stride)
+{
+    __m256 top[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+    __m256 bottom[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+
+    accumulate_32(src, weights, kw, top);
+    for (size_t r = 1; r < kh; r++)
+    {
+        const float *row = src + r * w;
+        const float *upper = weights + r * kw;
+        const float *lower = weights + (r - 1) * kw;
+        for (size_t kj = 0; kj < kw; kj++)
+        {
+            __m256 ku = _mm256_broadcast_ss(upper + kj);
+            __m256 kl = _mm256_broadcast_ss(lower + kj);
+            for (size_t v = 0; v < 4; v++)
+            {
+                __m256 x = _mm256_loadu_ps(row + kj + v * 8);
+                top[v] = _mm256_fmadd_ps(x, ku, top[v]);
+                bottom[v] = _mm256_fmadd_ps(x, kl, bottom[v]);
+            }
+        }
+    }
+    accumulate_32(src + kh * w, weights + (kh - 1) * kw, kw, bottom);
+
+    for (size_t v = 0; v < 4; v++)
+    {
+        _mm256_storeu_ps(dst + v * 8, top[v]);
+        _mm256_storeu_ps(dst + stride + v * 8, bottom[v]);
+    }
+}
+
+[[gnu::always_inline, gnu::target("avx2,fma")]] static inline void block_1x32(const float *src, size_t w, const float *weights, size_t kh, size_t kw, float *dst)
+{
+    __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+    for (size_t r = 0; r < kh; r++)
+        accumulate_32(src + r * w, weights + r * kw, kw, acc);
+    for (size_t v = 0; v < 4; v++)
+        _mm256_storeu_ps(dst + v * 8, acc[v]);
+}
+
+[[gnu::always_inline, gnu::target("avx2,fma")]] static inline void block_1x8(const float *src, size_t w, const float *weights, size_t kh, size_t kw, float *dst)
+{
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t r = 0; r < kh; r++)
+        for (size_t kj = 0; kj < kw; kj++)
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(src + r * w + kj), _mm256_broadcast_ss(weights + r * kw + kj), acc);
+    _mm256_storeu_ps(dst, acc);
+}
+
+[[gnu::always_inline]] static inline float point(const float *src, size_t w, const float *weights, size_t kh, size_t kw)
+{
+    float sum = 0.0f;
+    for (size_t r = 0; r < kh; r++)
+        for (size_t kj = 0; kj < kw; kj++)
+            sum += src[r * w + kj] * weights[r * kw + kj];
+    return sum;
+}
+
+// Called with constant kh and kw for the specialized sizes so the tap loops unroll.
+[[gnu::always_inline, gnu::target("avx2,fma")]] static inline void tile_direct_avx2(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1, size_t kh, size_t kw)
+{
+    const float *weights = job->plan->weights;
+    size_t w = job->w;
+    size_t stride = job->dst_stride;
+
+    size_t y = y0;
+    for (; y + 2 <= y1; y += 2)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        size_t x = x0;
+        for (; x + 32 <= x1; x += 32)
+            block_2x32(in + x, w, weights, kh, kw, out + x, stride);
+        for (; x + 8 <= x1; x += 8)
+        {
+            block_1x8(in + x, w, weights, kh, kw, out + x);
+            block_1x8(in + w + x, w, weights, kh, kw, out + stride + x);
+        }
+        for (; x < x1; x++)
+        {
+            out[x] = point(in + x, w, weights, kh, kw);
+            out[stride + x] = point(in + w + x, w, weights, kh, kw);
+        }
+    }
+    if (y < y1)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        size_t x = x0;
+        for (; x + 32 <= x1; x += 32)
+            block_1x32(in + x, w, weights, kh, kw, out + x);
+        for (; x + 8 <= x1; x += 8)
+            block_1x8(in + x, w, weights, kh, kw, out + x);
+        for (; x < x1; x++)
+            out[x] = point(in + x, w, weights, kh, kw);
+    }
+}
+
+[[gnu::target("avx2,fma")]] static inline __m256 taps_3(const float *p, __m256 k0, __m256 k1, __m256 k2, __m256 acc)
+{
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(p), k0, acc);
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(p + 1), k1, acc);
+    return _mm256_fmadd_ps(_mm256_loadu_ps(p + 2), k2, acc);
+}
+
+// All nine weights stay in registers; two output rows share the middle input rows.
+[[gnu::target("avx2,fma")]] static void tile_3x3_avx2(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    const float *k = job->plan->weights;
+    size_t w = job->w;
+    size_t stride = job->dst_stride;
+    __m256 k00 = _mm256_broadcast_ss(k + 0), k01 = _mm256_broadcast_ss(k + 1), k02 = _mm256_broadcast_ss(k + 2);
+    __m256 k10 = _mm256_broadcast_ss(k + 3), k11 = _mm256_broadcast_ss(k + 4), k12 = _mm256_broadcast_ss(k + 5);
+    __m256 k20 = _mm256_broadcast_ss(k + 6), k21 = _mm256_broadcast_ss(k + 7), k22 = _mm256_broadcast_ss(k + 8);
+
+    size_t y = y0;
+    for (; y + 2 <= y1; y += 2)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        size_t x = x0;
+        for (; x + 8 <= x1; x += 8)
+        {
+            const float *p = in + x;
+            __m256 top = _mm256_setzero_ps();
+            __m256 bottom = _mm256_setzero_ps();
+            top = taps_3(p, k00, k01, k02, top);
+            top = taps_3(p + w, k10, k11, k12, top);
+            bottom = taps_3(p + w, k00, k01, k02, bottom);
+            top = taps_3(p + 2 * w, k20, k21, k22, top);
+            bottom = taps_3(p + 2 * w, k10, k11, k12, bottom);
+            bottom = taps_3(p + 3 * w, k20, k21, k22, bottom);
+            _mm256_storeu_ps(out + x, top);
+            _mm256_storeu_ps(out + stride + x, bottom);
+        }
+        for (; x < x1; x++)
+        {
+            out[x] = point(in + x, w, k, 3, 3);
+            out[stride + x] = point(in + w + x, w, k, 3, 3);
+        }
+    }
+    if (y < y1)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        size_t x = x0;
+        for (; x + 8 <= x1; x += 8)
+        {
+            const float *p = in + x;
+            __m256 acc = taps_3(p, k00, k01, k02, _mm256_setzero_ps());
+            acc = taps_3(p + w, k10, k11, k12, acc);
+            acc = taps_3(p + 2 * w, k20, k21, k22, acc);
+            _mm256_storeu_ps(out + x, acc);
+        }
+        for (; x < x1; x++)
+            out[x] = point(in + x, w, k, 3, 3);
+    }
+}
+
+[[gnu::target("avx2,fma")]] static void tile_5x5_avx2(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    tile_direct_avx2(job, y0, y1, x0, x1, 5, 5);
+}
+
+[[gnu::target("avx2,fma")]] static void tile_generic_avx2(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    tile_direct_avx2(job, y0, y1, x0, x1, job->plan->rows, job->plan->cols);
+}
+
+[[gnu::always_inline]] static inline void tile_point(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1, size_t kh, size_t kw)
+{
+    for (size_t y = y0; y < y1; y++)
+    {
+        const float *in = job->src + y * job->w;
+        float *out = job->dst + y * job->dst_stride;
+        for (size_t x = x0; x < x1; x++)
+            out[x] = point(in + x, job->w, job->plan->weights, kh, kw);
+    }
+}
+
+static void tile_3x3_scalar(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    tile_point(job, y0, y1, x0, x1, 3, 3);
+}
+
+static void tile_5x5_scalar(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    tile_point(job, y0, y1, x0, x1, 5, 5);
+}
+
+static void tile_generic_scalar(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    tile_point(job, y0, y1, x0, x1, job->plan->rows, job->plan->cols);
+}
+
+// Lanes of the last, partial 16-float block. Masked loads do not fault past the
+// mask, so the AVX-512 kernels have no scalar tails.
+static inline __mmask16 tail_mask(size_t left)
+{
+    return left >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << left) - 1);
+}
+
+[[gnu::always_inline, gnu::target("avx512f")]] static inline void accumulate_64(const float *row, const float *weights, size_t kw, __m512 acc[4])
+{
+    for (size_t kj = 0; kj < kw; kj++)
+    {
+        __m512 k = _mm512_set1_ps(weights[kj]);
+        for (size_t v = 0; v < 4; v++)
+            acc[v] = _mm512_fmadd_ps(_mm512_loadu_ps(row + kj + v * 16), k, acc[v]);
+    }
+}
+
+// block_2x32 at twice the width.
+[[gnu::always_inline, gnu::target("avx512f")]] static inline void block_2x64(const float *src, size_t w, const float *weights, size_t kh, size_t kw, float *dst, size_t stride)
+{
+    __m512 top[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+    __m512 bottom[4] = {_mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps(), _mm512_setzero_ps()};
+
+    accumulate_64(src, weights, kw, top);
+    for (size_t r = 1; r < kh; r++)
+    {
+        const float *row = src + r * w;
+        const float *upper = weights + r * kw;
+        const float *lower = weights + (r - 1) * kw;
+        for (size_t kj = 0; kj < kw; kj++)
+        {
+            __m512 ku = _mm512_set1_ps(upper[kj]);
+            __m512 kl = _mm512_set1_ps(lower[kj]);
+            for (size_t v = 0; v < 4; v++)
+            {
+                __m512 x = _mm512_loadu_ps(row + kj + v * 16);
+                top[v] = _mm512_fmadd_ps(x, ku, top[v]);
+                bottom[v] = _mm512_fmadd_ps(x, kl, bottom[v]);
+            }
+        }
+    }
+    accumulate_64(src + kh * w, weights + (kh - 1) * kw, kw, bottom);
+
+    for (size_t v = 0; v < 4; v++)
+    {
+        _mm512_storeu_ps(dst + v * 16, top[v]);
+        _mm512_storeu_ps(dst + stride + v * 16, bottom[v]);
+    }
+}
+
+[[gnu::always_inline, gnu::target("avx512f")]] static inline void block_1x16(const float *src, size_t w, const float *weights, size_t kh, size_t kw, float *dst, __mmask16 m)
+{
+    __m512 acc = _mm512_setzero_ps();
+    for (size_t r = 0; r < kh; r++)
+        for (size_t kj = 0; kj < kw; kj++)
+            acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, src + r * w + kj), _mm512_set1_ps(weights[r * kw + kj]), acc);
+    _mm512_mask_storeu_ps(dst, m, acc);
+}
+
+[[gnu::always_inline, gnu::target("avx512f")]] static inline void tile_direct_avx512(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1, size_t kh, size_t kw)
+{
+    const float *weights = job->plan->weights;
+    size_t w = job->w;
+    size_t stride = job->dst_stride;
+
+    size_t y = y0;
+    for (; y + 2 <= y1; y += 2)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        size_t x = x0;
+        for (; x + 64 <= x1; x += 64)
+            block_2x64(in + x, w, weights, kh, kw, out + x, stride);
+        for (; x < x1; x += 16)
+        {
+            __mmask16 m = tail_mask(x1 - x);
+            block_1x16(in + x, w, weights, kh, kw, out + x, m);
+            block_1x16(in + w + x, w, weights, kh, kw, out + stride + x, m);
+        }
+    }
+    if (y < y1)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        for (size_t x = x0; x < x1; x += 16)
+            block_1x16(in + x, w, weights, kh, kw, out + x, tail_mask(x1 - x));
+    }
+}
+
+[[gnu::target("avx512f")]] static inline __m512 taps_3_avx512(const float *p, __mmask16 m, __m512 k0, __m512 k1, __m512 k2, __m512 acc)
+{
+    acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, p), k0, acc);
+    acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, p + 1), k1, acc);
+    return _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, p + 2), k2, acc);
+}
+
+[[gnu::target("avx512f")]] static void tile_3x3_avx512(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    const float *k = job->plan->weights;
+    size_t w = job->w;
+    size_t stride = job->dst_stride;
+    __m512 k00 = _mm512_set1_ps(k[0]), k01 = _mm512_set1_ps(k[1]), k02 = _mm512_set1_ps(k[2]);
+    __m512 k10 = _mm512_set1_ps(k[3]), k11 = _mm512_set1_ps(k[4]), k12 = _mm512_set1_ps(k[5]);
+    __m512 k20 = _mm512_set1_ps(k[6]), k21 = _mm512_set1_ps(k[7]), k22 = _mm512_set1_ps(k[8]);
+
+    size_t y = y0;
+    for (; y + 2 <= y1; y += 2)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        for (size_t x = x0; x < x1; x += 16)
+        {
+            __mmask16 m = tail_mask(x1 - x);
+            const float *p = in + x;
+            __m512 top = taps_3_avx512(p, m, k00, k01, k02, _mm512_setzero_ps());
+            top = taps_3_avx512(p + w, m, k10, k11, k12, top);
+            __m512 bottom = taps_3_avx512(p + w, m, k00, k01, k02, _mm512_setzero_ps());
+            top = taps_3_avx512(p + 2 * w, m, k20, k21, k22, top);
+            bottom = taps_3_avx512(p + 2 * w, m, k10, k11, k12, bottom);
+            bottom = taps_3_avx512(p + 3 * w, m, k20, k21, k22, bottom);
+            _mm512_mask_storeu_ps(out + x, m, top);
+            _mm512_mask_storeu_ps(out + stride + x, m, bottom);
+        }
+    }
+    if (y < y1)
+    {
+        const float *in = job->src + y * w;
+        float *out = job->dst + y * stride;
+        for (size_t x = x0; x < x1; x += 16)
+        {
+            __mmask16 m = tail_mask(x1 - x);
+            const float *p = in + x;
+            __m512 acc = taps_3_avx512(p, m, k00, k01, k02, _mm512_setzero_ps());
+            acc = taps_3_avx512(p + w, m, k10, k11, k12, acc);
+            acc = taps_3_avx512(p + 2 * w, m, k20, k21, k22, acc);
+            _mm512_mask_storeu_ps(out + x, m, acc);
+        }
+    }
+}
+
+[[gnu::target("avx512f")]] static void tile_5x5_avx512(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    tile_direct_avx512(job, y0, y1, x0, x1, 5, 5);
+}
+
+[[gnu::target("avx512f")]] static void tile_generic_avx512(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    tile_direct_avx512(job, y0, y1, x0, x1, job->plan->rows, job->plan->cols);
+}
+
+[[gnu::target("avx2,fma")]] static void filter_1d_avx2(const float *in, size_t step, const float *taps, size_t count, float *out, size_t len)
+{
+    size_t x = 0;
+    for (; x + 8 <= len; x += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t t = 0; t < count; t++)
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(in + t * step + x), _mm256_broadcast_ss(taps + t), acc);
+        _mm256_storeu_ps(out + x, acc);
+    }
+    for (; x < len; x++)
+    {
+        float sum = 0.0f;
+        for (size_t t = 0; t < count; t++)
+            sum += in[t * step + x] * taps[t];
+        out[x] = sum;
+    }
+}
+
+static void filter_1d_scalar(const float *in, size_t step, const float *taps, size_t count, float *out, size_t len)
+{
+    for (size_t x = 0; x < len; x++)
+    {
+        float sum = 0.0f;
+        for (size_t t = 0; t < count; t++)
+            sum += in[t * step + x] * taps[t];
+        out[x] = sum;
+    }
+}
+
+[[gnu::target("avx512f")]] static void filter_1d_avx512(const float *in, size_t step, const float *taps, size_t count, float *out, size_t len)
+{
+    for (size_t x = 0; x < len; x += 16)
+    {
+        __mmask16 m = tail_mask(len - x);
+        __m512 acc = _mm512_setzero_ps();
+        for (size_t t = 0; t < count; t++)
+            acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, in + t * step + x), _mm512_set1_ps(taps[t]), acc);
+        _mm512_mask_storeu_ps(out + x, m, acc);
+    }
+}
+
+// Horizontal pass into a tile-sized scratch that stays in L2, then the vertical
+// pass straight into dst, so the intermediate never makes a full-image round trip.
+static void tile_separable(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1, float *scratch)
+{
+    const struct conv_plan *plan = job->plan;
+    size_t width = x1 - x0;
+    size_t rows = y1 - y0 + plan->rows - 1;
+    for (size_t r = 0; r < rows; r++)
+        kernels.filter_1d(job->src + (y0 + r) * job->w + x0, 1, plan->row_weights, plan->cols, scratch + r * width, width);
+    for (size_t y = y0; y < y1; y++)
+        kernels.filter_1d(scratch + (y - y0) * width, width, plan->col_weights, plan->rows, job->dst + y * job->dst_stride + x0, width);
+}
+
+// Radix-2 butterflies run down the columns, so each butterfly touches two whole
+// rows and vectorizes along them; fft_2d transposes between the two passes.
+static void fft_columns(const struct conv_plan *plan, float *re, float *im, bool inverse)
+{
+    size_t n = plan->fft_size;
+    for (size_t i = 1, j = 0; i < n; i++)
+    {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            for (size_t x = 0; x < n; x++)
+            {
+                float t = re[i * n + x];
+                re[i * n + x] = re[j * n + x];
+                re[j * n + x] = t;
+                t = im[i * n + x];
+                im[i * n + x] = im[j * n + x];
+                im[j * n + x] = t;
+            }
+    }
+
+    float sign = inverse ? -1.0f : 1.0f;
+    for (size_t len = 2; len <= n; len *= 2)
+    {
+        size_t half = len / 2;
+        size_t step = n / len;
+        for (size_t start = 0; start < n; start += len)
+            for (size_t k = 0; k < half; k++)
+            {
+                float wr = plan->twiddle_re[k * step];
+                float wi = sign * plan->twiddle_im[k * step];
+                float *ar = re + (start + k) * n;
+                float *ai = im + (start + k) * n;
+                float *br = re + (start + k + half) * n;
+                float *bi = im + (start + k + half) * n;
+                for (size_t x = 0; x < n; x++)
+                {
+                    float tr = br[x] * wr - bi[x] * wi;
+                    float ti = br[x] * wi + bi[x] * wr;
+                    br[x] = ar[x] - tr;
+                    bi[x] = ai[x] - ti;
+                    ar[x] += tr;
+                    ai[x] += ti;
+                }
+            }
+    }
+}
+
+static void transpose_square(float *data, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = i + 1; j < n; j++)
+        {
+            float t = data[i * n + j];
+            data[i * n + j] = data[j * n + i];
+            data[j * n + i] = t;
+        }
+}
+
+// The forward transform leaves the spectrum transposed; the inverse transposes
+// it back, and the pointwise product does not care about the orientation.
+static void fft_2d(const struct conv_plan *plan, float *re, float *im, bool inverse)
+{
+    fft_columns(plan, re, im, inverse);
+    transpose_square(re, plan->fft_size);
+    transpose_square(im, plan->fft_size);
+    fft_columns(plan, re, im, inverse);
+}
+
+static void load_block(const struct conv_job *job, size_t y0, size_t x0, float *block, size_t n)
+{
+    size_t h = job->oh + job->plan->rows - 1;
+    for (size_t r = 0; r < n; r++)
+    {
+        float *row = block + r * n;
+        size_t count = 0;
+        if (y0 + r < h && x0 < job->w)
+        {
+            count = min_size(n, job->w - x0);
+            memcpy(row, job->src + (y0 + r) * job->w + x0, count * sizeof(float));
+        }
+        memset(row + count, 0, (n - count) * sizeof(float));
+    }
+}
+
+// Overlap-save over two side-by-side blocks at once: the real kernel keeps the
+// real and imaginary parts of the product independent, so the left block goes
+// in as the real part and the right block as the imaginary part.
+static void tile_fft(const struct conv_job *job, size_t y0, size_t y1, size_t x0, size_t x1, float *re, float *im)
+{
+    const struct conv_plan *plan = job->plan;
+    size_t n = plan->fft_size;
+    size_t block_cols = n - plan->cols + 1;
+
+    load_block(job, y0, x0, re, n);
+    load_block(job, y0, x0 + block_cols, im, n);
+    fft_2d(plan, re, im, false);
+    for (size_t i = 0; i < n * n; i++)
+    {
+        float zr = re[i];
+        float zi = im[i];
+        re[i] = zr * plan->spectrum_re[i] - zi * plan->spectrum_im[i];
+        im[i] = zr * plan->spectrum_im[i] + zi * plan->spectrum_re[i];
+    }
+    fft_2d(plan, re, im, true);
+
+    float scale = 1.0f / (float)(n * n);
+    for (size_t y = y0; y < y1; y++)
+    {
+        float *out = job->dst + y * job->dst_stride;
+        const float *left = re + (y - y0) * n;
+        const float *right = im + (y - y0) * n;
+        for (size_t x = x0; x < x1; x++)
+            out[x] = x - x0 < block_cols
+                ? left[x - x0] * scale
+                : right[x - x0 - block_cols] * scale;
+    }
+}
+
+static void conv_tiles(void *arg, size_t part, long begin, long end)
+{
+    const struct conv_job *job = arg;
+    const struct conv_plan *plan = job->plan;
+    float *scratch = job->scratch != nullptr ? job->scratch + part * job->scratch_len : nullptr;
+    float *scratch_im = job->scratch_im != nullptr ? job->scratch_im + part * job->scratch_len : nullptr;
+
+    for (long t = begin; t < end; t++)
+    {
+        size_t ty = (size_t)t / job->tiles_x;
+        size_t tx = (size_t)t % job->tiles_x;
+        size_t y0 = ty * job->tile_rows;
+        size_t x0 = tx * job->tile_cols;
+        size_t y1 = min_size(y0 + job->tile_rows, job->oh);
+        size_t x1 = min_size(x0 + job->tile_cols, job->ow);
+        switch (plan->path)
+        {
+        case CONV_PATH_3X3:
+            kernels.tile_3x3(job, y0, y1, x0, x1);
+            break;
+        case CONV_PATH_5X5:
+            kernels.tile_5x5(job, y0, y1, x0, x1);
+            break;
+        case CONV_PATH_SEPARABLE:
+            tile_separable(job, y0, y1, x0, x1, scratch);
+            break;
+        case CONV_PATH_FFT:
+            tile_fft(job, y0, y1, x0, x1, scratch, scratch_im);
+            break;
+        default:
+            kernels.tile_generic(job, y0, y1, x0, x1);
+            break;
+        }
+    }
+}
+
+// Valid convolution into dst with an arbitrary row stride, so the same-size
+// path can write the interior straight into the full-size image.
+static void conv_run(const struct conv_plan *plan,
+                     const float *src,
+                     size_t h,
+                     size_t w,
+                     float *dst,
+                     size_t dst_stride,
+                     struct task_sched *sched)
+{
+    struct conv_job job = {
+        .plan = plan,
+        .src = src,
+        .w = w,
+        .dst = dst,
+        .dst_stride = dst_stride,
+        .oh = h - plan->rows + 1,
+        .ow = w - plan->cols + 1,
+        .tile_rows = CONV_TILE_ROWS,
+        .tile_cols = CONV_TILE_COLS,
+    };
+    if (plan->path == CONV_PATH_FFT)
+    {
+        job.tile_rows = plan->fft_size - plan->rows + 1;
+        job.tile_cols = 2 * (plan->fft_size - plan->cols + 1);
+    }
+    job.tiles_x = (job.ow + job.tile_cols - 1) / job.tile_cols;
+    size_t tiles = job.tiles_x * ((job.oh + job.tile_rows - 1) / job.tile_rows);
+    bool parallel = sched != nullptr && tiles > 1;
+
+    // One scratch per part for the whole call rather than one per range, which
+    // under the dynamic schedule would be one allocation per tile. Lengths are
+    // rounded to 16 floats so the parts do not share cache lines.
+    size_t parts = parallel ? parallel_participants(sched) : 1;
+    if (plan->path == CONV_PATH_SEPARABLE)
+    {
+        job.scratch_len = ((job.tile_rows + plan->rows - 1) * job.tile_cols + 15) / 16 * 16;
+        job.scratch = newarr_aligned(float, parts * job.scratch_len, 64);
+    }
+    else if (plan->path == CONV_PATH_FFT)
+    {
+        job.scratch_len = (plan->fft_size * plan->fft_size + 15) / 16 * 16;
+        job.scratch = newarr_aligned(float, parts * job.scratch_len, 64);
+        job.scratch_im = newarr_aligned(float, parts * job.scratch_len, 64);
+    }
+
+    if (parallel)
+        parallel_for_range_indexed(sched, 0, (long)tiles, conv_tiles, &job, PARALLEL_SCHEDULE_DYNAMIC, 1);
+    else
+        conv_tiles(&job, 0, 0, (long)tiles);
+    free(job.scratch);
+    free(job.scratch_im);
+}
+
+void conv_apply(const struct conv_plan *plan,
+                const float *src,
+                size_t h,
+                size_t w,
+                float *dst,
+                struct task_sched *sched)
+{
+    if (plan->rows == 0 || plan->cols == 0 || h < plan->rows || w < plan->cols)
+        return;
+    conv_run(plan, src, h, w, dst, w - plan->cols + 1, sched);
+}
+
+// Maps a coordinate outside [0, n) back into the image, or to -1 for zero
+// padding. Reflection has period 2(n - 1), so kernels larger than the image work.
+static long border_index(long i, long n, enum conv_border border)
+{
+    if (i >= 0 && i < n)
+        return i;
+    switch (border)
+    {
+    case CONV_BORDER_CLAMP:
+        return i < 0 ? 0 : n - 1;
+    case CONV_BORDER_REFLECT:
+    {
+        if (n == 1)
+            return 0;
+        long period = 2 * (n - 1);
+        i = labs(i) % period;
+        return i < n ? i : period - i;
+    }
+    case CONV_BORDER_WRAP:
+        i %= n;
+        return i < 0 ? i + n : i;
+    default:
+        return -1;
+    }
+}
+
+struct border_job
+{
+    const struct conv_plan *plan;
+    const float *src;
+    size_t h;
+    size_t w;
+    float *dst;
+    enum conv_border border;
+    // Extent of the region conv_run already wrote; oh or ow is zero when the
+    // kernel does not fit and every pixel is an edge pixel.
+    size_t oh;
+    size_t ow;
+    // Per-part row and column maps, rows + cols entries padded to map_stride.
+    long *maps;
+    size_t map_stride;
+};
+
+static float border_point(const struct border_job *job, const long *row_map, long *col_map, size_t x)
+{
+    const struct conv_plan *plan = job->plan;
+    for (size_t j = 0; j < plan->cols; j++)
+        col_map[j] = border_index((long)(x + j) - (long)(plan->cols / 2), (long)job->w, job->border);
+
+    float sum = 0.0f;
+    for (size_t i = 0; i < plan->rows; i++)
+    {
+        if (row_map[i] < 0)
+            continue;
+        const float *row = job->src + (size_t)row_map[i] * job->w;
+        const float *k = plan->weights + i * plan->cols;
+        for (size_t j = 0; j < plan->cols; j++)
+            if (col_map[j] >= 0)
+                sum += row[col_map[j]] * k[j];
+    }
+    return sum;
+}
+
+// Columns whose taps all fall inside the image only need the row map, so a
+// top or bottom strip row runs 8 outputs at a time like the interior. The last
+// block overlaps the previous one instead of dropping to scalar.
+[[gnu::target("avx2,fma")]] static void border_row_avx2(const struct border_job *job, const long *row_map, float *out)
+{
+    const struct conv_plan *plan = job->plan;
+    size_t ax = plan->cols / 2;
+    for (size_t x = 0; x < job->ow; x += 8)
+    {
+        if (x + 8 > job->ow)
+            x = job->ow - 8;
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t i = 0; i < plan->rows; i++)
+        {
+            if (row_map[i] < 0)
+                continue;
+            const float *row = job->src + (size_t)row_map[i] * job->w + x;
+            const float *k = plan->weights + i * plan->cols;
+            for (size_t j = 0; j < plan->cols; j++)
+                acc = _mm256_fmadd_ps(_mm256_loadu_ps(row + j), _mm256_broadcast_ss(k + j), acc);
+        }
+        _mm256_storeu_ps(out + ax + x, acc);
+    }
+}
+
+static void border_row_scalar(const struct border_job *job, const long *row_map, float *out)
+{
+    const struct conv_plan *plan = job->plan;
+    size_t ax = plan->cols / 2;
+    for (size_t x = 0; x < job->ow; x++)
+    {
+        float sum = 0.0f;
+        for (size_t i = 0; i < plan->rows; i++)
+        {
+            if (row_map[i] < 0)
+                continue;
+            const float *row = job->src + (size_t)row_map[i] * job->w + x;
+            const float *k = plan->weights + i * plan->cols;
+            for (size_t j = 0; j < plan->cols; j++)
+                sum += row[j] * k[j];
+        }
+        out[ax + x] = sum;
+    }
+}
+
+[[gnu::target("avx512f")]] static void border_row_avx512(const struct border_job *job, const long *row_map, float *out)
+{
+    const struct conv_plan *plan = job->plan;
+    size_t ax = plan->cols / 2;
+    for (size_t x = 0; x < job->ow; x += 16)
+    {
+        __mmask16 m = tail_mask(job->ow - x);
+        __m512 acc = _mm512_setzero_ps();
+        for (size_t i = 0; i < plan->rows; i++)
+        {
+            if (row_map[i] < 0)
+                continue;
+            const float *row = job->src + (size_t)row_map[i] * job->w + x;
+            const float *k = plan->weights + i * plan->cols;
+            for (size_t j = 0; j < plan->cols; j++)
+                acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, row + j), _mm512_set1_ps(k[j]), acc);
+        }
+        _mm512_mask_storeu_ps(out + ax + x, m, acc);
+    }
+}
+
+[[gnu::constructor]] static void conv_dispatch(void)
+{
+    switch (cpu_level())
+    {
+    case CPU_LEVEL_AVX512:
+        kernels = (struct conv_kernels){tile_3x3_avx512, tile_5x5_avx512, tile_generic_avx512, filter_1d_avx512, border_row_avx512};
+        break;
+    case CPU_LEVEL_AVX2:
+        kernels = (struct conv_kernels){tile_3x3_avx2, tile_5x5_avx2, tile_generic_avx2, filter_1d_avx2, border_row_avx2};
+        break;
+    default:
+        kernels = (struct conv_kernels){tile_3x3_scalar, tile_5x5_scalar, tile_generic_scalar, filter_1d_scalar, border_row_scalar};
+        break;
+    }
+}
+
+static void border_rows(void *arg, size_t part, long begin, long end)
+{
+    const struct border_job *job = arg;
+    const struct conv_plan *plan = job->plan;
+    size_t ay = plan->rows / 2;
+    size_t ax = plan->cols / 2;
+    long *row_map = job->maps + part * job->map_stride;
+    long *col_map = row_map + plan->rows;
+
+    for (size_t y = (size_t)begin; y < (size_t)end; y++)
+    {
+        float *out = job->dst + y * job->w;
+        for (size_t i = 0; i < plan->rows; i++)
+            row_map[i] = border_index((long)(y + i) - (long)ay, (long)job->h, job->border);
+
+        bool interior_row = job->oh > 0 && y >= ay && y < ay + job->oh;
+        size_t x0 = ax;
+        size_t x1 = ax;
+        if (job->ow > 0 && !interior_row)
+        {
+            if (job->ow >= 8)
+                kernels.border_row(job, row_map, out);
+            else
+                for (size_t x = ax; x < ax + job->ow; x++)
+                    out[x] = border_point(job, row_map, col_map, x);
+        }
+        if (job->ow > 0)
+            x1 = ax + job->ow;
+        else
+            x0 = x1 = job->w;
+
+        for (size_t x = 0; x < x0; x++)
+            out[x] = border_point(job, row_map, col_map, x);
+        for (size_t x = x1; x < job->w; x++)
+            out[x] = border_point(job, row_map, col_map, x);
+    }
+}
+
+void conv_apply_same(const struct conv_plan *plan,
+                     const float *src,
+                     size_t h,
+                     size_t w,
+                     float *dst,
+                     enum conv_border border,
+                     struct task_sched *sched)
+{
+    if (plan->rows == 0 || plan->cols == 0 || h == 0 || w == 0)
+        return;
+
+    struct border_job job = {
+        .plan = plan,
+        .src = src,
+        .h = h,
+        .w = w,
+        .dst = dst,
+        .border = border,
+        .oh = h >= plan->rows ? h - plan->rows + 1 : 0,
+        .ow = w >= plan->cols ? w - plan->cols + 1 : 0,
+    };
+    if (job.oh > 0 && job.ow > 0)
+        conv_run(plan, src, h, w, dst + (plan->rows / 2) * w + plan->cols / 2, w, sched);
+
+    size_t parts = sched != nullptr ? parallel_participants(sched) : 1;
+    job.map_stride = (plan->rows + plan->cols + 7) / 8 * 8;
+    job.maps = newarr_aligned(long, parts * job.map_stride, 64);
+    if (sched == nullptr)
+        border_rows(&job, 0, 0, (long)h);
+    else
+        parallel_for_range_indexed(sched, 0, (long)h, border_rows, &job, PARALLEL_SCHEDULE_DYNAMIC, 64);
+    free(job.maps);
+}
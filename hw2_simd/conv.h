@@ -0,0 +1,83 @@
+#ifndef _CONV_H
+#define _CONV_H
+
+#include <stddef.h>
+
+#include "conv_util.h"
+#include "../hw6_parallel_for/tasks.h"
+
+// Output tile sized so its input footprint, (64 + kh - 1) x (256 + kw - 1) floats,
+// stays in L2 while rows of it are reused from L1.
+#define CONV_TILE_ROWS 64
+#define CONV_TILE_COLS 256
+
+// Kernels with at least this many taps and no cheaper path go through the FFT;
+// the direct path still wins up to about 17x17.
+#define CONV_FFT_MIN_TAPS 324
+
+enum conv_path
+{
+    CONV_PATH_GENERIC,
+    CONV_PATH_3X3,
+    CONV_PATH_5X5,
+    CONV_PATH_SEPARABLE,
+    CONV_PATH_FFT
+};
+
+// Pixels outside the image for same-size output. REFLECT mirrors without
+// repeating the edge pixel (dcb|abcd|cba).
+enum conv_border
+{
+    CONV_BORDER_CLAMP,
+    CONV_BORDER_REFLECT,
+    CONV_BORDER_WRAP,
+    CONV_BORDER_ZERO
+};
+
+struct conv_plan
+{
+    size_t rows;
+    size_t cols;
+    enum conv_path path;
+    float *weights;
+    // Rank-1 factors, weights[i][j] == col_weights[i] * row_weights[j].
+    float *row_weights;
+    float *col_weights;
+    // Overlap-save blocks of fft_size x fft_size; the kernel spectrum is
+    // conjugated so the product yields correlation, matching the direct paths.
+    size_t fft_size;
+    float *spectrum_re;
+    float *spectrum_im;
+    float *twiddle_re;
+    float *twiddle_im;
+};
+
+// Picks the fastest path for the kernel: unrolled 3x3/5x5 bodies, two 1D passes
+// for separable kernels, FFT for large ones, tiled direct convolution otherwise.
+void conv_plan_init(struct conv_plan *plan, const struct conv_mat *mat);
+void conv_plan_free(struct conv_plan *plan);
+const char *conv_path_name(enum conv_path path);
+
+// Valid convolution: dst is (h - rows + 1) x (w - cols + 1), row-major and dense.
+// Tiles are spread over sched when it is not nullptr.
+void conv_apply(const struct conv_plan *plan,
+                const float *src,
+                size_t h,
+                size_t w,
+                float *dst,
+                struct task_sched *sched);
+
+// Same-size convolution: dst is h x w with the kernel anchored at (rows / 2,
+// cols / 2). The interior goes through conv_apply's tiles written in place into
+// dst, and only the border strips are computed with remapped coordinates, so no
+// padded copy of src is made. dst must not alias src; chains alternate between
+// two buffers of the same size.
+void conv_apply_same(const struct conv_plan *plan,
+                     const float *src,
+                     size_t h,
+                     size_t w,
+                     float *dst,
+                     enum conv_border border,
+                     struct task_sched *sched);
+
+#endif // _CONV_H
@@ -0,0 +1,324 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "conv_chain.h"
+
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/cpu.h"
+#include "../core/util.h"
+
+// Per-part state: one ring per intermediate stage plus the row pointers handed
+// to the row kernel.
+struct chain_scratch
+{
+    float **rings;
+    size_t *ring_rows;
+    size_t *ring_stride;
+    size_t *next;
+    const float **inputs;
+};
+
+struct conv_chain_job
+{
+    const struct conv_chain *chain;
+    const float *src;
+    size_t w;
+    float *dst;
+    size_t oh;
+    size_t ow;
+    size_t tiles_x;
+    // One per part of the loop, set up once per call.
+    struct chain_scratch *scratch;
+};
+
+// Row kernels for the CPU level, bound at startup by conv_chain_dispatch.
+struct chain_kernels
+{
+    void (*row_3x3)(const float **in, const float *weights, float *out, size_t width);
+    void (*row_5x5)(const float **in, const float *weights, float *out, size_t width);
+    void (*row_generic)(const float **in, const struct conv_chain_stage *stage, float *out, size_t width);
+};
+
+static struct chain_kernels kernels;
+
+static size_t min_size(size_t a, size_t b)
+{
+    return a < b ? a : b;
+}
+
+void conv_chain_init(struct conv_chain *chain, const struct conv_mat *mats, size_t count)
+{
+    chain->count = count;
+    chain->stages = newarr(struct conv_chain_stage, count);
+    chain->shrink_rows = 0;
+    chain->shrink_cols = 0;
+    for (size_t s = 0; s < count; s++)
+    {
+        struct conv_chain_stage *stage = &chain->stages[s];
+        stage->rows = mats[s].rows;
+        stage->cols = mats[s].cols;
+        if (stage->rows == 0 || stage->cols == 0)
+            die("conv_chain_init: empty kernel");
+        stage->weights = newarr_aligned(float, stage->rows * stage->cols, 64);
+        memcpy(stage->weights, mats[s].values, stage->rows * stage->cols * sizeof(float));
+        chain->shrink_rows += stage->rows - 1;
+        chain->shrink_cols += stage->cols - 1;
+    }
+}
+
+void conv_chain_free(struct conv_chain *chain)
+{
+    for (size_t s = 0; s < chain->count; s++)
+        free(chain->stages[s].weights);
+    free(chain->stages);
+    chain->stages = nullptr;
+    chain->count = 0;
+}
+
+// Outputs x0 .. width - 1 of a row, one at a time.
+[[gnu::always_inline]] static inline void chain_row_point(const float **in, const float *weights, size_t kh, size_t kw, float *out, size_t x0, size_t width)
+{
+    for (size_t x = x0; x < width; x++)
+    {
+        float sum = 0.0f;
+        for (size_t r = 0; r < kh; r++)
+            for (size_t kj = 0; kj < kw; kj++)
+                sum += in[r][x + kj] * weights[r * kw + kj];
+        out[x] = sum;
+    }
+}
+
+// One output row from kh input rows that need not be adjacent in memory.
+[[gnu::always_inline, gnu::target("avx2,fma")]] static inline void chain_row_avx2(const float **in, const float *weights, size_t kh, size_t kw, float *out, size_t width)
+{
+    size_t x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+        __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps()};
+        for (size_t r = 0; r < kh; r++)
+            for (size_t kj = 0; kj < kw; kj++)
+            {
+                __m256 k = _mm256_broadcast_ss(weights + r * kw + kj);
+                const float *p = in[r] + x + kj;
+                acc[0] = _mm256_fmadd_ps(_mm256_loadu_ps(p), k, acc[0]);
+                acc[1] = _mm256_fmadd_ps(_mm256_loadu_ps(p + 8), k, acc[1]);
+                acc[2] = _mm256_fmadd_ps(_mm256_loadu_ps(p + 16), k, acc[2]);
+                acc[3] = _mm256_fmadd_ps(_mm256_loadu_ps(p + 24), k, acc[3]);
+            }
+        for (size_t v = 0; v < 4; v++)
+            _mm256_storeu_ps(out + x + v * 8, acc[v]);
+    }
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t r = 0; r < kh; r++)
+            for (size_t kj = 0; kj < kw; kj++)
+                acc = _mm256_fmadd_ps(_mm256_loadu_ps(in[r] + x + kj), _mm256_broadcast_ss(weights + r * kw + kj), acc);
+        _mm256_storeu_ps(out + x, acc);
+    }
+    chain_row_point(in, weights, kh, kw, out, x, width);
+}
+
+[[gnu::target("avx2,fma")]] static inline __m256 taps_3(const float *p, __m256 k0, __m256 k1, __m256 k2, __m256 acc)
+{
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(p), k0, acc);
+    acc = _mm256_fmadd_ps(_mm256_loadu_ps(p + 1), k1, acc);
+    return _mm256_fmadd_ps(_mm256_loadu_ps(p + 2), k2, acc);
+}
+
+// Nine weights and three row pointers in registers, two independent 8-wide sums.
+[[gnu::target("avx2,fma")]] static void chain_row_3x3_avx2(const float **in, const float *k, float *out, size_t width)
+{
+    const float *r0 = in[0], *r1 = in[1], *r2 = in[2];
+    __m256 k00 = _mm256_broadcast_ss(k + 0), k01 = _mm256_broadcast_ss(k + 1), k02 = _mm256_broadcast_ss(k + 2);
+    __m256 k10 = _mm256_broadcast_ss(k + 3), k11 = _mm256_broadcast_ss(k + 4), k12 = _mm256_broadcast_ss(k + 5);
+    __m256 k20 = _mm256_broadcast_ss(k + 6), k21 = _mm256_broadcast_ss(k + 7), k22 = _mm256_broadcast_ss(k + 8);
+
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m256 a = taps_3(r0 + x, k00, k01, k02, _mm256_setzero_ps());
+        __m256 b = taps_3(r0 + x + 8, k00, k01, k02, _mm256_setzero_ps());
+        a = taps_3(r1 + x, k10, k11, k12, a);
+        b = taps_3(r1 + x + 8, k10, k11, k12, b);
+        a = taps_3(r2 + x, k20, k21, k22, a);
+        b = taps_3(r2 + x + 8, k20, k21, k22, b);
+        _mm256_storeu_ps(out + x, a);
+        _mm256_storeu_ps(out + x + 8, b);
+    }
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256 a = taps_3(r0 + x, k00, k01, k02, _mm256_setzero_ps());
+        a = taps_3(r1 + x, k10, k11, k12, a);
+        a = taps_3(r2 + x, k20, k21, k22, a);
+        _mm256_storeu_ps(out + x, a);
+    }
+    chain_row_point(in, k, 3, 3, out, x, width);
+}
+
+[[gnu::target("avx2,fma")]] static void chain_row_5x5_avx2(const float **in, const float *weights, float *out, size_t width)
+{
+    chain_row_avx2(in, weights, 5, 5, out, width);
+}
+
+[[gnu::target("avx2,fma")]] static void chain_row_generic_avx2(const float **in, const struct conv_chain_stage *stage, float *out, size_t width)
+{
+    chain_row_avx2(in, stage->weights, stage->rows, stage->cols, out, width);
+}
+
+// Constant sizes let the compiler unroll and vectorize the taps on its own.
+static void chain_row_3x3_scalar(const float **in, const float *weights, float *out, size_t width)
+{
+    chain_row_point(in, weights, 3, 3, out, 0, width);
+}
+
+static void chain_row_5x5_scalar(const float **in, const float *weights, float *out, size_t width)
+{
+    chain_row_point(in, weights, 5, 5, out, 0, width);
+}
+
+static void chain_row_generic_scalar(const float **in, const struct conv_chain_stage *stage, float *out, size_t width)
+{
+    chain_row_point(in, stage->weights, stage->rows, stage->cols, out, 0, width);
+}
+
+[[gnu::constructor]] static void conv_chain_dispatch(void)
+{
+    if (cpu_level() >= CPU_LEVEL_AVX2)
+        kernels = (struct chain_kernels){chain_row_3x3_avx2, chain_row_5x5_avx2, chain_row_generic_avx2};
+    else
+        kernels = (struct chain_kernels){chain_row_3x3_scalar, chain_row_5x5_scalar, chain_row_generic_scalar};
+}
+
+static void stage_row(const struct conv_chain_stage *stage, const float **in, float *out, size_t width)
+{
+    if (stage->rows == 3 && stage->cols == 3)
+        kernels.row_3x3(in, stage->weights, out, width);
+    else if (stage->rows == 5 && stage->cols == 5)
+        kernels.row_5x5(in, stage->weights, out, width);
+    else
+        kernels.row_generic(in, stage, out, width);
+}
+
+static void chain_scratch_init(struct chain_scratch *scratch, const struct conv_chain *chain)
+{
+    size_t count = chain->count;
+    size_t max_rows = 0;
+    scratch->rings = newarr(float *, count);
+    scratch->ring_rows = newarr(size_t, count);
+    scratch->ring_stride = newarr(size_t, count);
+    scratch->next = newarr(size_t, count);
+
+    // Stage s feeds stage s + 1, so its ring holds that kernel's height; its
+    // rows are as wide as the tile plus what the remaining stages trim off.
+    size_t extra_cols = chain->shrink_cols;
+    for (size_t s = 0; s < count; s++)
+    {
+        const struct conv_chain_stage *stage = &chain->stages[s];
+        if (stage->rows > max_rows)
+            max_rows = stage->rows;
+        extra_cols -= stage->cols - 1;
+        scratch->rings[s] = nullptr;
+        scratch->ring_rows[s] = 0;
+        scratch->ring_stride[s] = 0;
+        if (s + 1 == count)
+            continue;
+        scratch->ring_rows[s] = chain->stages[s + 1].rows;
+        scratch->ring_stride[s] = (CONV_CHAIN_TILE_COLS + extra_cols + 15) / 16 * 16;
+        scratch->rings[s] = newarr_aligned(float, scratch->ring_rows[s] * scratch->ring_stride[s], 64);
+    }
+    scratch->inputs = newarr(const float *, max_rows);
+}
+
+static void chain_scratch_free(struct chain_scratch *scratch, size_t count)
+{
+    for (size_t s = 0; s < count; s++)
+        free(scratch->rings[s]);
+    free(scratch->rings);
+    free(scratch->ring_rows);
+    free(scratch->ring_stride);
+    free(scratch->next);
+    free(scratch->inputs);
+}
+
+// Computes rows of stage s up to row last, first pulling the rows of stage s - 1
+// each one reads. Pulling on demand one row at a time means a ring only ever
+// has to hold the rows under one kernel window of its consumer.
+static void stage_advance(const struct conv_chain_job *job, struct chain_scratch *scratch, size_t s, size_t last, size_t x0, size_t width)
+{
+    const struct conv_chain *chain = job->chain;
+    const struct conv_chain_stage *stage = &chain->stages[s];
+    size_t in_width = width + stage->cols - 1;
+    for (size_t q = scratch->next[s]; q <= last; q++)
+    {
+        if (s > 0)
+            stage_advance(job, scratch, s - 1, q + stage->rows - 1, x0, in_width);
+        for (size_t r = 0; r < stage->rows; r++)
+            scratch->inputs[r] = s == 0
+                ? job->src + (q + r) * job->w + x0
+                : scratch->rings[s - 1] + (q + r) % scratch->ring_rows[s - 1] * scratch->ring_stride[s - 1];
+        float *out = s + 1 == chain->count
+            ? job->dst + q * job->ow + x0
+            : scratch->rings[s] + q % scratch->ring_rows[s] * scratch->ring_stride[s];
+        stage_row(stage, scratch->inputs, out, width);
+        scratch->next[s] = q + 1;
+    }
+}
+
+static void chain_tile(const struct conv_chain_job *job, struct chain_scratch *scratch, size_t y0, size_t y1, size_t x0, size_t x1)
+{
+    for (size_t s = 0; s < job->chain->count; s++)
+        scratch->next[s] = y0;
+    stage_advance(job, scratch, job->chain->count - 1, y1 - 1, x0, x1 - x0);
+}
+
+static void chain_tiles(void *arg, size_t part, long begin, long end)
+{
+    const struct conv_chain_job *job = arg;
+    for (long t = begin; t < end; t++)
+    {
+        size_t y0 = (size_t)t / job->tiles_x * CONV_CHAIN_TILE_ROWS;
+        size_t x0 = (size_t)t % job->tiles_x * CONV_CHAIN_TILE_COLS;
+        chain_tile(job, &job->scratch[part], y0, min_size(y0 + CONV_CHAIN_TILE_ROWS, job->oh),
+                   x0, min_size(x0 + CONV_CHAIN_TILE_COLS, job->ow));
+    }
+}
+
+void conv_chain_apply(const struct conv_chain *chain,
+                      const float *src,
+                      size_t h,
+                      size_t w,
+                      float *dst,
+                      struct task_sched *sched)
+{
+    if (chain->count == 0 || h <= chain->shrink_rows || w <= chain->shrink_cols)
+        return;
+
+    struct conv_chain_job job = {
+        .chain = chain,
+        .src = src,
+        .w = w,
+        .dst = dst,
+        .oh = h - chain->shrink_rows,
+        .ow = w - chain->shrink_cols,
+    };
+    job.tiles_x = (job.ow + CONV_CHAIN_TILE_COLS - 1) / CONV_CHAIN_TILE_COLS;
+    size_t tiles = job.tiles_x * ((job.oh + CONV_CHAIN_TILE_ROWS - 1) / CONV_CHAIN_TILE_ROWS);
+
+    bool parallel = sched != nullptr && tiles > 1;
+
+    size_t parts = parallel ? parallel_participants(sched) : 1;
+    job.scratch = newarr(struct chain_scratch, parts);
+    for (size_t p = 0; p < parts; p++)
+        chain_scratch_init(&job.scratch[p], chain);
+
+    if (parallel)
+        parallel_for_range_indexed(sched, 0, (long)tiles, chain_tiles, &job, PARALLEL_SCHEDULE_DYNAMIC, 1);
+    else
+        chain_tiles(&job, 0, 0, (long)tiles);
+
+    for (size_t p = 0; p < parts; p++)
+        chain_scratch_free(&job.scratch[p], chain->count);
+    free(job.scratch);
+}
@@ -0,0 +1,45 @@
+#ifndef _CONV_CHAIN_H
+#define _CONV_CHAIN_H
+
+#include <stddef.h>
+
+#include "conv_util.h"
+#include "../hw6_parallel_for/tasks.h"
+
+// Final output tile of a fused chain. Taller tiles recompute fewer halo rows of
+// the intermediate stages; the width keeps every stage's row ring in L1/L2.
+#define CONV_CHAIN_TILE_ROWS 128
+#define CONV_CHAIN_TILE_COLS 256
+
+struct conv_chain_stage
+{
+    size_t rows;
+    size_t cols;
+    float *weights;
+};
+
+// A sequence of kernels applied as one pass: each tile streams its source rows
+// through all stages, and a stage keeps only the last rows its successor reads
+// in a circular buffer, so intermediates never leave the cache.
+struct conv_chain
+{
+    size_t count;
+    struct conv_chain_stage *stages;
+    // Total shrink of the valid output, sum(rows - 1) and sum(cols - 1).
+    size_t shrink_rows;
+    size_t shrink_cols;
+};
+
+void conv_chain_init(struct conv_chain *chain, const struct conv_mat *mats, size_t count);
+void conv_chain_free(struct conv_chain *chain);
+
+// Same result as conv_apply with each kernel in turn on valid outputs: dst is
+// (h - shrink_rows) x (w - shrink_cols), row-major and dense.
+void conv_chain_apply(const struct conv_chain *chain,
+                      const float *src,
+                      size_t h,
+                      size_t w,
+                      float *dst,
+                      struct task_sched *sched);
+
+#endif // _CONV_CHAIN_H
@@ -0,0 +1,250 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "conv_stream.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/util.h"
+
+struct band
+{
+    float *pixels;
+    unsigned char *rgb;
+    size_t rows;
+};
+
+// Fixed-capacity FIFO of bands; it never fills because every queue can hold all
+// the bands of its pool. nullptr marks the end of the stream.
+struct band_queue
+{
+    struct band *items[CONV_STREAM_BANDS + 1];
+    size_t head;
+    size_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+struct stream
+{
+    const struct conv_plan *plan;
+    size_t width;
+    size_t height;
+    size_t out_width;
+    size_t out_height;
+    struct jpeg_decompress_struct decoder;
+    struct jpeg_compress_struct encoder;
+    struct band in_bands[CONV_STREAM_BANDS];
+    struct band out_bands[CONV_STREAM_BANDS];
+    struct band_queue free_in;
+    struct band_queue full_in;
+    struct band_queue free_out;
+    struct band_queue full_out;
+};
+
+static void band_queue_init(struct band_queue *queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+    if (pthread_mutex_init(&queue->mutex, nullptr) != 0)
+        die("mutex init failed");
+    if (pthread_cond_init(&queue->cond, nullptr) != 0)
+        die("cond init failed");
+}
+
+static void band_queue_destroy(struct band_queue *queue)
+{
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->cond);
+}
+
+static void band_queue_push(struct band_queue *queue, struct band *band)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->items[(queue->head + queue->count) % (CONV_STREAM_BANDS + 1)] = band;
+    queue->count++;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static struct band *band_queue_pop(struct band_queue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    struct band *band = queue->items[queue->head];
+    queue->head = (queue->head + 1) % (CONV_STREAM_BANDS + 1);
+    queue->count--;
+    pthread_mutex_unlock(&queue->mutex);
+    return band;
+}
+
+// The last kernel rows - 1 rows of each band are copied to the front of the
+// next one, so every band is a self-contained valid-convolution input.
+static void *decode_stage(void *arg)
+{
+    struct stream *stream = arg;
+    size_t context = stream->plan->rows - 1;
+    size_t band_rows = CONV_STREAM_BAND_ROWS + context;
+    size_t width = stream->width;
+    unsigned char *scanline = newarr(unsigned char, 3 * width);
+    float *carry = newarr(float, context * width + 1);
+    size_t carried = 0;
+
+    while (stream->decoder.output_scanline < stream->decoder.output_height)
+    {
+        struct band *band = band_queue_pop(&stream->free_in);
+        memcpy(band->pixels, carry, carried * width * sizeof(float));
+        size_t rows = carried;
+        while (rows < band_rows && stream->decoder.output_scanline < stream->decoder.output_height)
+        {
+            jpeg_read_scanlines(&stream->decoder, &scanline, 1);
+            rgb_to_luma(scanline, width, band->pixels + rows * width);
+            rows++;
+        }
+        carried = rows < context ? rows : context;
+        memcpy(carry, band->pixels + (rows - carried) * width, carried * width * sizeof(float));
+        band->rows = rows;
+        if (rows > context)
+            band_queue_push(&stream->full_in, band);
+        else
+            band_queue_push(&stream->free_in, band);
+    }
+    band_queue_push(&stream->full_in, nullptr);
+
+    free(scanline);
+    free(carry);
+    return nullptr;
+}
+
+static void *encode_stage(void *arg)
+{
+    struct stream *stream = arg;
+    struct band *band;
+    while ((band = band_queue_pop(&stream->full_out)) != nullptr)
+    {
+        for (size_t r = 0; r < band->rows; r++)
+        {
+            unsigned char *row = band->rgb + r * 3 * stream->out_width;
+            jpeg_write_scanlines(&stream->encoder, &row, 1);
+        }
+        band_queue_push(&stream->free_out, band);
+    }
+    return nullptr;
+}
+
+static void convolve_stage(struct stream *stream, struct task_sched *sched)
+{
+    size_t out_width = stream->out_width;
+    float *values = newarr(float, CONV_STREAM_BAND_ROWS * out_width);
+    unsigned char *grey = newarr(unsigned char, CONV_STREAM_BAND_ROWS * out_width);
+    struct band *band;
+    while ((band = band_queue_pop(&stream->full_in)) != nullptr)
+    {
+        struct band *out = band_queue_pop(&stream->free_out);
+        out->rows = band->rows - stream->plan->rows + 1;
+        conv_apply(stream->plan, band->pixels, band->rows, stream->width, values, sched);
+        band_queue_push(&stream->free_in, band);
+
+        luma_to_u8(values, out->rows * out_width, grey);
+        planes_to_rgb(grey, grey, grey, out->rows * out_width, out->rgb);
+        band_queue_push(&stream->full_out, out);
+    }
+    band_queue_push(&stream->full_out, nullptr);
+    free(values);
+    free(grey);
+}
+
+void conv_stream_jpeg(const char *input,
+                      const char *output,
+                      const struct conv_plan *plan,
+                      int quality,
+                      struct task_sched *sched)
+{
+    FILE *in_file = fopen(input, "rb");
+    if (in_file == nullptr)
+    {
+        perror("error opening jpeg file");
+        exit(EXIT_FAILURE);
+    }
+    FILE *out_file = fopen(output, "wb");
+    if (out_file == nullptr)
+    {
+        perror("error opening jpeg file");
+        exit(EXIT_FAILURE);
+    }
+
+    struct stream stream;
+    struct jpeg_error_mgr decode_err;
+    struct jpeg_error_mgr encode_err;
+    stream.plan = plan;
+
+    stream.decoder.err = jpeg_std_error(&decode_err);
+    jpeg_create_decompress(&stream.decoder);
+    jpeg_stdio_src(&stream.decoder, in_file);
+    jpeg_read_header(&stream.decoder, TRUE);
+    stream.decoder.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&stream.decoder);
+
+    stream.width = stream.decoder.output_width;
+    stream.height = stream.decoder.output_height;
+    if (stream.width < plan->cols || stream.height < plan->rows)
+    {
+        fprintf(stderr, "error: image is smaller than the kernel.\n");
+        exit(EXIT_FAILURE);
+    }
+    stream.out_width = stream.width - plan->cols + 1;
+    stream.out_height = stream.height - plan->rows + 1;
+
+    stream.encoder.err = jpeg_std_error(&encode_err);
+    jpeg_create_compress(&stream.encoder);
+    jpeg_stdio_dest(&stream.encoder, out_file);
+    stream.encoder.image_width = (JDIMENSION)stream.out_width;
+    stream.encoder.image_height = (JDIMENSION)stream.out_height;
+    stream.encoder.input_components = 3;
+    stream.encoder.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&stream.encoder);
+    jpeg_set_quality(&stream.encoder, quality, TRUE);
+    jpeg_start_compress(&stream.encoder, TRUE);
+
+    band_queue_init(&stream.free_in);
+    band_queue_init(&stream.full_in);
+    band_queue_init(&stream.free_out);
+    band_queue_init(&stream.full_out);
+    for (size_t i = 0; i < CONV_STREAM_BANDS; i++)
+    {
+        stream.in_bands[i].pixels = newarr(float, (CONV_STREAM_BAND_ROWS + plan->rows - 1) * stream.width);
+        stream.in_bands[i].rgb = nullptr;
+        stream.out_bands[i].pixels = nullptr;
+        stream.out_bands[i].rgb = newarr(unsigned char, CONV_STREAM_BAND_ROWS * 3 * stream.out_width);
+        band_queue_push(&stream.free_in, &stream.in_bands[i]);
+        band_queue_push(&stream.free_out, &stream.out_bands[i]);
+    }
+
+    pthread_t decoder;
+    pthread_t encoder;
+    if (pthread_create(&decoder, nullptr, decode_stage, &stream) != 0)
+        die("pthread_create failed");
+    if (pthread_create(&encoder, nullptr, encode_stage, &stream) != 0)
+        die("pthread_create failed");
+    convolve_stage(&stream, sched);
+    pthread_join(decoder, nullptr);
+    pthread_join(encoder, nullptr);
+
+    jpeg_finish_decompress(&stream.decoder);
+    jpeg_destroy_decompress(&stream.decoder);
+    jpeg_finish_compress(&stream.encoder);
+    jpeg_destroy_compress(&stream.encoder);
+    fclose(in_file);
+    fclose(out_file);
+
+    for (size_t i = 0; i < CONV_STREAM_BANDS; i++)
+    {
+        free(stream.in_bands[i].pixels);
+        free(stream.out_bands[i].rgb);
+    }
+    band_queue_destroy(&stream.free_in);
+    band_queue_destroy(&stream.full_in);
+    band_queue_destroy(&stream.free_out);
+    band_queue_destroy(&stream.full_out);
+}
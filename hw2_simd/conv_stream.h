@@ -0,0 +1,21 @@
+#ifndef _CONV_STREAM_H
+#define _CONV_STREAM_H
+
+#include "conv.h"
+
+// Output rows per band; each input band carries kernel rows - 1 extra rows of context.
+#define CONV_STREAM_BAND_ROWS 64
+// Buffers in flight between two stages, so each stage can run one band ahead.
+#define CONV_STREAM_BANDS 3
+
+// Decodes input, converts it to luminance, convolves it and encodes it as a grey
+// jpeg, band by band. Decoding and encoding run on their own threads; the caller
+// convolves, spreading each band over sched when it is not nullptr. Peak memory is
+// a few bands, independent of the image height.
+void conv_stream_jpeg(const char *input,
+                      const char *output,
+                      const struct conv_plan *plan,
+                      int quality,
+                      struct task_sched *sched);
+
+#endif // _CONV_STREAM_H
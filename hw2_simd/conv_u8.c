@@ -0,0 +1,398 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "conv_u8.h"
+
+#include <immintrin.h>
+#include <math.h>
+#include <stdlib.h>
+#include "../core/cpu.h"
+#include "../core/util.h"
+
+// Rows per parallel_for_range chunk.
+#define CONV_U8_CHUNK_ROWS 16
+
+// Below AVX2 every output goes through point_u8.
+static bool vector_blocks;
+
+struct conv_u8_job
+{
+    const struct conv_plan_u8 *plan;
+    const unsigned char *src;
+    size_t w;
+    unsigned char *dst;
+    size_t ow;
+};
+
+static bool quantize_weights(struct conv_plan_u8 *plan, const float *values, int shift, bool narrow)
+{
+    float scale = ldexpf(1.0f, shift);
+    bool exact = true;
+    long total = 0;
+    for (size_t r = 0; r < plan->rows; r++)
+    {
+        long row_sum = 0;
+        for (size_t c = 0; c < plan->cols; c++)
+        {
+            float scaled = values[r * plan->cols + c] * scale;
+            long q = lrintf(scaled);
+            if (q < -128 || q > 127)
+                return false;
+            row_sum += labs(q);
+            if ((float)q != scaled)
+                exact = false;
+            plan->weights[r * plan->cols + c] = (int8_t)q;
+        }
+        if (255 * row_sum > INT16_MAX)
+            return false;
+        total += row_sum;
+    }
+    // The narrow path also adds the rounding bias before shifting in 16 bits.
+    if (narrow && 255 * total + (shift > 0 ? 1L << (shift - 1) : 0) > INT16_MAX)
+        return false;
+    plan->shift = shift;
+    plan->exact = exact;
+    plan->narrow = narrow;
+    return true;
+}
+
+static bool choose_shift(struct conv_plan_u8 *plan, const float *values, bool narrow)
+{
+    for (int shift = CONV_U8_MAX_SHIFT; shift >= 0; shift--)
+        if (quantize_weights(plan, values, shift, narrow))
+            return true;
+    return false;
+}
+
+// Prefers the narrow path when it still represents the kernel exactly; otherwise
+// the wide path, whose larger shift gives the closer approximation.
+bool conv_plan_u8_init(struct conv_plan_u8 *plan, const struct conv_mat *mat)
+{
+    plan->rows = mat->rows;
+    plan->cols = mat->cols;
+    plan->pairs = (plan->cols + 1) / 2;
+    plan->weights = newarr(int8_t, plan->rows * plan->cols);
+    plan->tap_vectors = newarr_aligned(int16_t, plan->rows * plan->pairs * 16, 32);
+
+    bool ok = choose_shift(plan, mat->values, true) && plan->exact;
+    if (!ok)
+        ok = choose_shift(plan, mat->values, false);
+    if (!ok)
+    {
+        conv_plan_u8_free(plan);
+        return false;
+    }
+
+    for (size_t r = 0; r < plan->rows; r++)
+        for (size_t p = 0; p < plan->pairs; p++)
+        {
+            uint8_t lo = (uint8_t)plan->weights[r * plan->cols + 2 * p];
+            uint8_t hi = 2 * p + 1 < plan->cols ? (uint8_t)plan->weights[r * plan->cols + 2 * p + 1] : 0;
+            int16_t pair = (int16_t)(uint16_t)(lo | hi << 8);
+            for (size_t k = 0; k < 16; k++)
+                plan->tap_vectors[(r * plan->pairs + p) * 16 + k] = pair;
+        }
+    return true;
+}
+
+void conv_plan_u8_free(struct conv_plan_u8 *plan)
+{
+    free(plan->weights);
+    free(plan->tap_vectors);
+    plan->weights = nullptr;
+    plan->tap_vectors = nullptr;
+    plan->rows = 0;
+    plan->cols = 0;
+}
+
+// Arithmetic shift with round-half-to-even, matching lrintf on the exact quotient.
+static inline int32_t round_shift(int32_t sum, int shift)
+{
+    if (shift == 0)
+        return sum;
+    int32_t odd = (sum >> shift) & 1;
+    return (sum + (1 << (shift - 1)) - 1 + odd) >> shift;
+}
+
+[[gnu::target("avx2")]] static inline __m256i round_shift_8(__m256i sum, int shift)
+{
+    if (shift == 0)
+        return sum;
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m256i odd = _mm256_and_si256(_mm256_sra_epi32(sum, count), _mm256_set1_epi32(1));
+    __m256i bias = _mm256_add_epi32(_mm256_set1_epi32((1 << (shift - 1)) - 1), odd);
+    return _mm256_sra_epi32(_mm256_add_epi32(sum, bias), count);
+}
+
+[[gnu::target("avx2")]] static inline __m256i round_shift_16(__m256i sum, int shift)
+{
+    if (shift == 0)
+        return sum;
+    __m128i count = _mm_cvtsi32_si128(shift);
+    __m256i odd = _mm256_and_si256(_mm256_sra_epi16(sum, count), _mm256_set1_epi16(1));
+    __m256i bias = _mm256_add_epi16(_mm256_set1_epi16((int16_t)((1 << (shift - 1)) - 1)), odd);
+    return _mm256_sra_epi16(_mm256_add_epi16(sum, bias), count);
+}
+
+[[gnu::target("avx2")]] static inline __m256i taps_at(const struct conv_plan_u8 *plan, size_t r, size_t p)
+{
+    return _mm256_load_si256((const __m256i *)(plan->tap_vectors + (r * plan->pairs + p) * 16));
+}
+
+static unsigned char point_u8(const struct conv_plan_u8 *plan, const unsigned char *src, size_t w)
+{
+    int32_t sum = 0;
+    for (size_t r = 0; r < plan->rows; r++)
+        for (size_t c = 0; c < plan->cols; c++)
+            sum += src[r * w + c] * plan->weights[r * plan->cols + c];
+    int32_t v = round_shift(sum, plan->shift);
+    return (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+// One kernel row over 32 outputs in 16 bits. Unpacking the loads at x + 2p and
+// x + 2p + 1 pairs each pixel with its right neighbour, so one maddubs applies
+// two taps to 16 outputs; lo holds outputs 0-7 | 16-23, hi 8-15 | 24-31.
+[[gnu::target("avx2")]] static inline void row_32(const struct conv_plan_u8 *plan, const unsigned char *src, size_t r, __m256i *lo, __m256i *hi)
+{
+    __m256i sum_lo = _mm256_setzero_si256();
+    __m256i sum_hi = _mm256_setzero_si256();
+    for (size_t p = 0; p < plan->pairs; p++)
+    {
+        __m256i taps = taps_at(plan, r, p);
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + 2 * p));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + 2 * p + 1));
+        sum_lo = _mm256_add_epi16(sum_lo, _mm256_maddubs_epi16(_mm256_unpacklo_epi8(a, b), taps));
+        sum_hi = _mm256_add_epi16(sum_hi, _mm256_maddubs_epi16(_mm256_unpackhi_epi8(a, b), taps));
+    }
+    *lo = sum_lo;
+    *hi = sum_hi;
+}
+
+[[gnu::target("avx2")]] static void narrow_1x32(const struct conv_plan_u8 *plan, const unsigned char *src, size_t w, unsigned char *dst)
+{
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+    for (size_t r = 0; r < plan->rows; r++)
+    {
+        __m256i row_lo, row_hi;
+        row_32(plan, src + r * w, r, &row_lo, &row_hi);
+        lo = _mm256_add_epi16(lo, row_lo);
+        hi = _mm256_add_epi16(hi, row_hi);
+    }
+    lo = round_shift_16(lo, plan->shift);
+    hi = round_shift_16(hi, plan->shift);
+    _mm256_storeu_si256((__m256i *)dst, _mm256_packus_epi16(lo, hi));
+}
+
+[[gnu::always_inline, gnu::target("avx2")]] static inline void unpack_pair(const unsigned char *row, size_t p, __m256i *lo, __m256i *hi)
+{
+    __m256i a = _mm256_loadu_si256((const __m256i *)(row + 2 * p));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(row + 2 * p + 1));
+    *lo = _mm256_unpacklo_epi8(a, b);
+    *hi = _mm256_unpackhi_epi8(a, b);
+}
+
+[[gnu::always_inline, gnu::target("avx2")]] static inline void madd_taps(__m256i lo, __m256i hi, __m256i taps, __m256i *sum_lo, __m256i *sum_hi)
+{
+    *sum_lo = _mm256_add_epi16(*sum_lo, _mm256_maddubs_epi16(lo, taps));
+    *sum_hi = _mm256_add_epi16(*sum_hi, _mm256_maddubs_epi16(hi, taps));
+}
+
+// Two output rows: each unpacked input row feeds the upper row with kernel row r
+// and the lower row with kernel row r - 1, so loads and unpacks are shared.
+// Called with constant rows and pairs for 3x3 and 5x5 so the loops unroll.
+[[gnu::always_inline, gnu::target("avx2")]] static inline void narrow_2x32(const struct conv_plan_u8 *plan,
+                                                                           const unsigned char *src,
+                                                                           size_t w,
+                                                                           unsigned char *dst,
+                                                                           size_t ow,
+                                                                           size_t rows,
+                                                                           size_t pairs)
+{
+    __m256i top_lo = _mm256_setzero_si256(), top_hi = _mm256_setzero_si256();
+    __m256i bottom_lo = _mm256_setzero_si256(), bottom_hi = _mm256_setzero_si256();
+    __m256i lo, hi;
+
+    for (size_t p = 0; p < pairs; p++)
+    {
+        unpack_pair(src, p, &lo, &hi);
+        madd_taps(lo, hi, taps_at(plan, 0, p), &top_lo, &top_hi);
+    }
+    for (size_t r = 1; r < rows; r++)
+        for (size_t p = 0; p < pairs; p++)
+        {
+            unpack_pair(src + r * w, p, &lo, &hi);
+            madd_taps(lo, hi, taps_at(plan, r, p), &top_lo, &top_hi);
+            madd_taps(lo, hi, taps_at(plan, r - 1, p), &bottom_lo, &bottom_hi);
+        }
+    for (size_t p = 0; p < pairs; p++)
+    {
+        unpack_pair(src + rows * w, p, &lo, &hi);
+        madd_taps(lo, hi, taps_at(plan, rows - 1, p), &bottom_lo, &bottom_hi);
+    }
+
+    top_lo = round_shift_16(top_lo, plan->shift);
+    top_hi = round_shift_16(top_hi, plan->shift);
+    bottom_lo = round_shift_16(bottom_lo, plan->shift);
+    bottom_hi = round_shift_16(bottom_hi, plan->shift);
+    _mm256_storeu_si256((__m256i *)dst, _mm256_packus_epi16(top_lo, top_hi));
+    _mm256_storeu_si256((__m256i *)(dst + ow), _mm256_packus_epi16(bottom_lo, bottom_hi));
+}
+
+[[gnu::target("avx2")]] static void block_32(const struct conv_plan_u8 *plan, const unsigned char *src, size_t w, unsigned char *dst)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+
+    // Two kernel rows at a time: interleaving their 16-bit sums and madd with ones
+    // adds them into 32-bit lanes, in output order 0-3, 4-7, 8-11, 12-15 per lane.
+    for (size_t r = 0; r < plan->rows; r += 2)
+    {
+        __m256i lo0, hi0;
+        __m256i lo1 = _mm256_setzero_si256();
+        __m256i hi1 = _mm256_setzero_si256();
+        row_32(plan, src + r * w, r, &lo0, &hi0);
+        if (r + 1 < plan->rows)
+            row_32(plan, src + (r + 1) * w, r + 1, &lo1, &hi1);
+        acc[0] = _mm256_add_epi32(acc[0], _mm256_madd_epi16(_mm256_unpacklo_epi16(lo0, lo1), ones));
+        acc[1] = _mm256_add_epi32(acc[1], _mm256_madd_epi16(_mm256_unpackhi_epi16(lo0, lo1), ones));
+        acc[2] = _mm256_add_epi32(acc[2], _mm256_madd_epi16(_mm256_unpacklo_epi16(hi0, hi1), ones));
+        acc[3] = _mm256_add_epi32(acc[3], _mm256_madd_epi16(_mm256_unpackhi_epi16(hi0, hi1), ones));
+    }
+
+    for (size_t v = 0; v < 4; v++)
+        acc[v] = round_shift_8(acc[v], plan->shift);
+    // The in-lane packs put lane 0 back as outputs 0-15 and lane 1 as 16-31.
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(acc[0], acc[1]), _mm256_packs_epi32(acc[2], acc[3]));
+    _mm256_storeu_si256((__m256i *)dst, packed);
+}
+
+[[gnu::target("avx2")]] static void narrow_rows(const struct conv_plan_u8 *plan,
+                        const unsigned char *in,
+                        size_t w,
+                        unsigned char *out,
+                        size_t ow,
+                        size_t last)
+{
+    if (plan->rows == 3 && plan->pairs == 2)
+    {
+        for (size_t x = 0; x < last; x += 32)
+            narrow_2x32(plan, in + x, w, out + x, ow, 3, 2);
+        narrow_2x32(plan, in + last, w, out + last, ow, 3, 2);
+    }
+    else if (plan->rows == 5 && plan->pairs == 3)
+    {
+        for (size_t x = 0; x < last; x += 32)
+            narrow_2x32(plan, in + x, w, out + x, ow, 5, 3);
+        narrow_2x32(plan, in + last, w, out + last, ow, 5, 3);
+    }
+    else
+    {
+        for (size_t x = 0; x < last; x += 32)
+            narrow_2x32(plan, in + x, w, out + x, ow, plan->rows, plan->pairs);
+        narrow_2x32(plan, in + last, w, out + last, ow, plan->rows, plan->pairs);
+    }
+}
+
+[[gnu::target("avx2")]] static void block_1x32(const struct conv_plan_u8 *plan, const unsigned char *src, size_t w, unsigned char *dst)
+{
+    if (plan->narrow)
+        narrow_1x32(plan, src, w, dst);
+    else
+        block_32(plan, src, w, dst);
+}
+
+[[gnu::constructor]] static void conv_u8_dispatch(void)
+{
+    vector_blocks = cpu_level() >= CPU_LEVEL_AVX2;
+}
+
+// Vector blocks read bytes x .. x + 2 * pairs + 30 of a row. The last block of a
+// row is moved left to overlap the previous one instead of leaving the remainder
+// to the scalar loop; it only rewrites outputs of its own row with equal values.
+static void conv_u8_rows(void *arg, long begin, long end)
+{
+    const struct conv_u8_job *job = arg;
+    const struct conv_plan_u8 *plan = job->plan;
+    size_t w = job->w;
+    size_t ow = job->ow;
+    size_t reach = 2 * plan->pairs + 31;
+    bool vector = vector_blocks && ow >= 32 && w >= reach;
+    size_t last = 0;
+    size_t tail = 0;
+    if (vector)
+    {
+        last = ow - 32 < w - reach ? ow - 32 : w - reach;
+        tail = last + 32;
+    }
+
+    size_t y = (size_t)begin;
+    if (plan->narrow)
+        for (; y + 2 <= (size_t)end; y += 2)
+        {
+            const unsigned char *in = job->src + y * w;
+            unsigned char *out = job->dst + y * ow;
+            if (vector)
+                narrow_rows(plan, in, w, out, ow, last);
+            for (size_t x = tail; x < ow; x++)
+            {
+                out[x] = point_u8(plan, in + x, w);
+                out[ow + x] = point_u8(plan, in + w + x, w);
+            }
+        }
+    for (; y < (size_t)end; y++)
+    {
+        const unsigned char *in = job->src + y * w;
+        unsigned char *out = job->dst + y * ow;
+        if (vector)
+        {
+            for (size_t x = 0; x < last; x += 32)
+                block_1x32(plan, in + x, w, out + x);
+            block_1x32(plan, in + last, w, out + last);
+        }
+        for (size_t x = tail; x < ow; x++)
+            out[x] = point_u8(plan, in + x, w);
+    }
+}
+
+void conv_apply_u8(const struct conv_plan_u8 *plan,
+                   const unsigned char *src,
+                   size_t h,
+                   size_t w,
+                   unsigned char *dst,
+                   struct task_sched *sched)
+{
+    if (plan->rows == 0 || plan->cols == 0 || h < plan->rows || w < plan->cols)
+        return;
+
+    struct conv_u8_job job = {
+        .plan = plan,
+        .src = src,
+        .w = w,
+        .dst = dst,
+        .ow = w - plan->cols + 1,
+    };
+    long oh = (long)(h - plan->rows + 1);
+
+    if (sched == nullptr || oh <= CONV_U8_CHUNK_ROWS)
+        conv_u8_rows(&job, 0, oh);
+    else
+        parallel_for_range(sched, 0, oh, conv_u8_rows, &job, PARALLEL_SCHEDULE_DYNAMIC, CONV_U8_CHUNK_ROWS);
+}
+
+void conv_image_apply_u8(const struct conv_plan_u8 *plan,
+                         const struct conv_image *input,
+                         struct conv_image *output,
+                         struct task_sched *sched)
+{
+    if (plan->rows == 0 || plan->cols == 0 || input->height < plan->rows || input->width < plan->cols)
+    {
+        output->width = 0;
+        output->height = 0;
+        return;
+    }
+    output->width = input->width - (unsigned int)plan->cols + 1;
+    output->height = input->height - (unsigned int)plan->rows + 1;
+    conv_apply_u8(plan, input->r, input->height, input->width, output->r, sched);
+    conv_apply_u8(plan, input->g, input->height, input->width, output->g, sched);
+    conv_apply_u8(plan, input->b, input->height, input->width, output->b, sched);
+}
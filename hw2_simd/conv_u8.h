@@ -0,0 +1,53 @@
+#ifndef _CONV_U8_H
+#define _CONV_U8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "conv_util.h"
+#include "../hw6_parallel_for/tasks.h"
+
+// Largest fixed-point shift tried for the weights.
+#define CONV_U8_MAX_SHIFT 14
+
+// 8-bit convolution with weights quantized to round(k * 2^shift) as signed bytes.
+// Narrow plans keep the whole sum in 16 bits, which needs 255 * sum(|w|) <= 32767
+// over the kernel; otherwise each row is summed in 16 bits and pairs of rows are
+// widened to 32 bits, which only needs the bound per row and so allows a larger
+// shift. exact is set when every weight is represented without rounding, in which
+// case the output equals the float convolution of the raw bytes, clamped and
+// rounded like lrintf.
+struct conv_plan_u8
+{
+    size_t rows;
+    size_t cols;
+    size_t pairs;
+    int shift;
+    bool exact;
+    bool narrow;
+    int8_t *weights;
+    // Adjacent taps as little-endian byte pairs for maddubs, rows x pairs, each
+    // pre-broadcast to 16 words.
+    int16_t *tap_vectors;
+};
+
+bool conv_plan_u8_init(struct conv_plan_u8 *plan, const struct conv_mat *mat);
+void conv_plan_u8_free(struct conv_plan_u8 *plan);
+
+// Valid convolution of one plane into (h - rows + 1) x (w - cols + 1) bytes.
+void conv_apply_u8(const struct conv_plan_u8 *plan,
+                   const unsigned char *src,
+                   size_t h,
+                   size_t w,
+                   unsigned char *dst,
+                   struct task_sched *sched);
+
+// Applies the kernel to all three planes; output must hold the valid-size planes.
+// An image smaller than the kernel gets a 0 x 0 output.
+void conv_image_apply_u8(const struct conv_plan_u8 *plan,
+                         const struct conv_image *input,
+                         struct conv_image *output,
+                         struct task_sched *sched);
+
+#endif // _CONV_U8_H
@@ -2,13 +2,264 @@
 
 #include "conv_util.h"
 
+#include <immintrin.h>
+#include <math.h>
+#include <setjmp.h>
 #include <stdlib.h>
+#include <string.h>
+#include "../core/cpu.h"
 #include "../core/util.h"
 
+// Conversions for the CPU level, bound at startup by convert_dispatch. The
+// scalar ones also finish the vector loops.
+struct convert_kernels
+{
+    void (*rgb_to_planes)(const unsigned char *rgb, size_t count, unsigned char *r, unsigned char *g, unsigned char *b);
+    void (*planes_to_rgb)(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, unsigned char *rgb);
+    void (*planes_to_luma)(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, float *luma);
+    void (*rgb_to_luma)(const unsigned char *rgb, size_t count, float *luma);
+    void (*luma_to_u8)(const float *values, size_t count, unsigned char *out);
+};
+
+static struct convert_kernels convert;
+
+static void rgb_to_planes_scalar(const unsigned char *rgb, size_t count, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        r[i] = rgb[3 * i];
+        g[i] = rgb[3 * i + 1];
+        b[i] = rgb[3 * i + 2];
+    }
+}
+
+static void planes_to_rgb_scalar(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, unsigned char *rgb)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        rgb[3 * i] = r[i];
+        rgb[3 * i + 1] = g[i];
+        rgb[3 * i + 2] = b[i];
+    }
+}
+
+static void planes_to_luma_scalar(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, float *luma)
+{
+    for (size_t i = 0; i < count; i++)
+        luma[i] = (r[i] + g[i] + b[i]) / (3.0f * 255.0f);
+}
+
+static void rgb_to_luma_scalar(const unsigned char *rgb, size_t count, float *luma)
+{
+    for (size_t i = 0; i < count; i++)
+        luma[i] = (rgb[3 * i] + rgb[3 * i + 1] + rgb[3 * i + 2]) / (3.0f * 255.0f);
+}
+
+static void luma_to_u8_scalar(const float *values, size_t count, unsigned char *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float v = values[i] < 0.0f ? 0.0f : values[i] > 1.0f ? 1.0f : values[i];
+        out[i] = (unsigned char)lrintf(v * 255.0f);
+    }
+}
+
+#define LANE_MASK(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+#define Z -1
+
+// 32 pixels of packed rgb are 96 bytes; the low lane of each vector takes bytes
+// from the first 48 and the high lane from the second 48, so one set of
+// in-lane pshufb masks serves both halves.
+[[gnu::target("avx2")]] static inline __m256i load_lanes(const unsigned char *lo, const unsigned char *hi)
+{
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)lo)),
+                                   _mm_loadu_si128((const __m128i *)hi), 1);
+}
+
+[[gnu::target("avx2")]] static inline void store_lanes(unsigned char *lo, unsigned char *hi, __m256i v)
+{
+    _mm_storeu_si128((__m128i *)lo, _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i *)hi, _mm256_extracti128_si256(v, 1));
+}
+
+[[gnu::target("avx2")]] static inline __m256i gather_3(__m256i c0, __m256i m0, __m256i c1, __m256i m1, __m256i c2, __m256i m2)
+{
+    return _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(c0, m0), _mm256_shuffle_epi8(c1, m1)),
+                           _mm256_shuffle_epi8(c2, m2));
+}
+
+[[gnu::target("avx2")]] static inline void deinterleave_32(const unsigned char *rgb, __m256i *r, __m256i *g, __m256i *b)
+{
+    __m256i c0 = load_lanes(rgb, rgb + 48);
+    __m256i c1 = load_lanes(rgb + 16, rgb + 64);
+    __m256i c2 = load_lanes(rgb + 32, rgb + 80);
+    *r = gather_3(c0, LANE_MASK(0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z),
+                  c1, LANE_MASK(Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14, Z, Z, Z, Z, Z),
+                  c2, LANE_MASK(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 1, 4, 7, 10, 13));
+    *g = gather_3(c0, LANE_MASK(1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z),
+                  c1, LANE_MASK(Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15, Z, Z, Z, Z, Z),
+                  c2, LANE_MASK(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 2, 5, 8, 11, 14));
+    *b = gather_3(c0, LANE_MASK(2, 5, 8, 11, 14, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z),
+                  c1, LANE_MASK(Z, Z, Z, Z, Z, 1, 4, 7, 10, 13, Z, Z, Z, Z, Z, Z),
+                  c2, LANE_MASK(Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 0, 3, 6, 9, 12, 15));
+}
+
+[[gnu::target("avx2")]] static inline void interleave_32(__m256i r, __m256i g, __m256i b, unsigned char *rgb)
+{
+    __m256i c0 = gather_3(r, LANE_MASK(0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z, Z, 5),
+                          g, LANE_MASK(Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z, Z),
+                          b, LANE_MASK(Z, Z, 0, Z, Z, 1, Z, Z, 2, Z, Z, 3, Z, Z, 4, Z));
+    __m256i c1 = gather_3(r, LANE_MASK(Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z, 10, Z),
+                          g, LANE_MASK(5, Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z, 10),
+                          b, LANE_MASK(Z, 5, Z, Z, 6, Z, Z, 7, Z, Z, 8, Z, Z, 9, Z, Z));
+    __m256i c2 = gather_3(r, LANE_MASK(Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15, Z, Z),
+                          g, LANE_MASK(Z, Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15, Z),
+                          b, LANE_MASK(10, Z, Z, 11, Z, Z, 12, Z, Z, 13, Z, Z, 14, Z, Z, 15));
+    store_lanes(rgb, rgb + 48, c0);
+    store_lanes(rgb + 16, rgb + 64, c1);
+    store_lanes(rgb + 32, rgb + 80, c2);
+}
+
+#undef Z
+
+[[gnu::target("avx2")]] static void rgb_to_planes_avx2(const unsigned char *rgb, size_t count, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i vr, vg, vb;
+        deinterleave_32(rgb + 3 * i, &vr, &vg, &vb);
+        _mm256_storeu_si256((__m256i *)(r + i), vr);
+        _mm256_storeu_si256((__m256i *)(g + i), vg);
+        _mm256_storeu_si256((__m256i *)(b + i), vb);
+    }
+    rgb_to_planes_scalar(rgb + 3 * i, count - i, r + i, g + i, b + i);
+}
+
+[[gnu::target("avx2")]] static void planes_to_rgb_avx2(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, unsigned char *rgb)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+        interleave_32(_mm256_loadu_si256((const __m256i *)(r + i)),
+                      _mm256_loadu_si256((const __m256i *)(g + i)),
+                      _mm256_loadu_si256((const __m256i *)(b + i)),
+                      rgb + 3 * i);
+    planes_to_rgb_scalar(r + i, g + i, b + i, count - i, rgb + 3 * i);
+}
+
+// Divides rather than multiplying by the reciprocal so the result is bit-for-bit
+// the scalar (r + g + b) / (3.0f * 255.0f).
+[[gnu::target("avx2")]] static inline void luma_8(__m128i r, __m128i g, __m128i b, float *luma)
+{
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_cvtepu8_epi32(r), _mm256_cvtepu8_epi32(g)),
+                                   _mm256_cvtepu8_epi32(b));
+    _mm256_storeu_ps(luma, _mm256_div_ps(_mm256_cvtepi32_ps(sum), _mm256_set1_ps(3.0f * 255.0f)));
+}
+
+[[gnu::target("avx2")]] static void planes_to_luma_avx2(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, float *luma)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        luma_8(_mm_loadl_epi64((const __m128i *)(r + i)),
+               _mm_loadl_epi64((const __m128i *)(g + i)),
+               _mm_loadl_epi64((const __m128i *)(b + i)),
+               luma + i);
+    planes_to_luma_scalar(r + i, g + i, b + i, count - i, luma + i);
+}
+
+[[gnu::target("avx2")]] static void rgb_to_luma_avx2(const unsigned char *rgb, size_t count, float *luma)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i vr, vg, vb;
+        deinterleave_32(rgb + 3 * i, &vr, &vg, &vb);
+        __m128i lo_r = _mm256_castsi256_si128(vr), hi_r = _mm256_extracti128_si256(vr, 1);
+        __m128i lo_g = _mm256_castsi256_si128(vg), hi_g = _mm256_extracti128_si256(vg, 1);
+        __m128i lo_b = _mm256_castsi256_si128(vb), hi_b = _mm256_extracti128_si256(vb, 1);
+        luma_8(lo_r, lo_g, lo_b, luma + i);
+        luma_8(_mm_srli_si128(lo_r, 8), _mm_srli_si128(lo_g, 8), _mm_srli_si128(lo_b, 8), luma + i + 8);
+        luma_8(hi_r, hi_g, hi_b, luma + i + 16);
+        luma_8(_mm_srli_si128(hi_r, 8), _mm_srli_si128(hi_g, 8), _mm_srli_si128(hi_b, 8), luma + i + 24);
+    }
+    rgb_to_luma_scalar(rgb + 3 * i, count - i, luma + i);
+}
+
+// Clamps to [0, 1], scales to [0, 255] and rounds to nearest even like lrintf;
+// the two saturating packs interleave 4-element groups, the permute undoes that.
+[[gnu::target("avx2")]] static void luma_to_u8_avx2(const float *values, size_t count, unsigned char *out)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i q[4];
+        for (size_t v = 0; v < 4; v++)
+        {
+            __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(values + i + 8 * v), zero), one);
+            q[v] = _mm256_cvtps_epi32(_mm256_mul_ps(x, scale));
+        }
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    luma_to_u8_scalar(values + i, count - i, out + i);
+}
+
+[[gnu::constructor]] static void convert_dispatch(void)
+{
+    if (cpu_level() >= CPU_LEVEL_AVX2)
+        convert = (struct convert_kernels){rgb_to_planes_avx2, planes_to_rgb_avx2, planes_to_luma_avx2, rgb_to_luma_avx2, luma_to_u8_avx2};
+    else
+        convert = (struct convert_kernels){rgb_to_planes_scalar, planes_to_rgb_scalar, planes_to_luma_scalar, rgb_to_luma_scalar, luma_to_u8_scalar};
+}
+
+void rgb_to_planes(const unsigned char *rgb, size_t count, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+    convert.rgb_to_planes(rgb, count, r, g, b);
+}
+
+void planes_to_rgb(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, unsigned char *rgb)
+{
+    convert.planes_to_rgb(r, g, b, count, rgb);
+}
+
+void planes_to_luma(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, float *luma)
+{
+    convert.planes_to_luma(r, g, b, count, luma);
+}
+
+void rgb_to_luma(const unsigned char *rgb, size_t count, float *luma)
+{
+    convert.rgb_to_luma(rgb, count, luma);
+}
+
+void luma_to_u8(const float *values, size_t count, unsigned char *out)
+{
+    convert.luma_to_u8(values, count, out);
+}
+
+void conv_image_to_luma(const struct conv_image *conv_image, float *luma)
+{
+    planes_to_luma(conv_image->r, conv_image->g, conv_image->b,
+                   (size_t)conv_image->width * conv_image->height, luma);
+}
+
+void luma_to_conv_image(const float *values, struct conv_image *conv_image)
+{
+    size_t count = (size_t)conv_image->width * conv_image->height;
+    luma_to_u8(values, count, conv_image->r);
+    memcpy(conv_image->g, conv_image->r, count);
+    memcpy(conv_image->b, conv_image->r, count);
+}
+
 void conv_image_init(struct conv_image *conv_image)
 {
     conv_image->width = 0;
     conv_image->height = 0;
+    conv_image->capacity = 0;
     conv_image->r = nullptr;
     conv_image->g = nullptr;
     conv_image->b = nullptr;
@@ -18,11 +269,99 @@ void conv_image_free(struct conv_image *conv_image)
 {
     conv_image->width = 0;
     conv_image->height = 0;
+    conv_image->capacity = 0;
     free(conv_image->r);
     free(conv_image->g);
     free(conv_image->b);
 }
 
+// Replaces libjpeg's error_exit, which calls exit(), with a jump back to the
+// caller so one bad file does not end the process.
+struct jpeg_error
+{
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(((struct jpeg_error *)cinfo->err)->jump, 1);
+}
+
+// Grayscale and YCbCr files are converted to rgb by libjpeg; anything it cannot
+// convert fails through error_exit.
+static bool decompress(struct jpeg_decompress_struct *cinfo, struct conv_image *conv_image)
+{
+    jpeg_read_header(cinfo, TRUE);
+    cinfo->out_color_space = JCS_RGB;
+    jpeg_start_decompress(cinfo);
+
+    conv_image->width = cinfo->output_width;
+    conv_image->height = cinfo->output_height;
+    int channels = cinfo->output_components;
+
+    if (channels != 3)
+    {
+        fprintf(stderr, "error: jpeg file is not in rgb format.\n");
+        jpeg_abort_decompress(cinfo);
+        return false;
+    }
+
+    size_t image_size = conv_image->width * conv_image->height;
+    if (conv_image->capacity < image_size)
+    {
+        conv_image->r = resize(conv_image->r, unsigned char, image_size);
+        conv_image->g = resize(conv_image->g, unsigned char, image_size);
+        conv_image->b = resize(conv_image->b, unsigned char, image_size);
+        conv_image->capacity = image_size;
+    }
+
+    // From libjpeg's pool, so a jump out of jpeg_read_scanlines cannot leak it.
+    JSAMPARRAY row = (*cinfo->mem->alloc_sarray)((j_common_ptr)cinfo, JPOOL_IMAGE,
+                                                 (JDIMENSION)(channels * conv_image->width), 1);
+
+    while (cinfo->output_scanline < cinfo->output_height)
+    {
+        size_t offset = (size_t)cinfo->output_scanline * conv_image->width;
+        jpeg_read_scanlines(cinfo, row, 1);
+        rgb_to_planes(row[0], conv_image->width,
+                      conv_image->r + offset, conv_image->g + offset, conv_image->b + offset);
+    }
+
+    jpeg_finish_decompress(cinfo);
+    return true;
+}
+
+static void compress(struct jpeg_compress_struct *cinfo, struct conv_image *conv_image, int quality)
+{
+    const int channels = 3;
+
+    cinfo->image_width = conv_image->width;
+    cinfo->image_height = conv_image->height;
+    cinfo->input_components = channels;
+    cinfo->in_color_space = JCS_RGB;
+
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, quality, TRUE);
+
+    jpeg_start_compress(cinfo, TRUE);
+
+    unsigned char *row = newarr(unsigned char, channels * conv_image->width);
+
+    while (cinfo->next_scanline < cinfo->image_height)
+    {
+        size_t offset = (size_t)cinfo->next_scanline * conv_image->width;
+        planes_to_rgb(conv_image->r + offset, conv_image->g + offset, conv_image->b + offset,
+                      conv_image->width, row);
+
+        jpeg_write_scanlines(cinfo, &row, 1);
+    }
+
+    free(row);
+    jpeg_finish_compress(cinfo);
+}
+
 void read_jpeg(const char *filename, struct conv_image *conv_image)
 {
     FILE *file = fopen(filename, "rb");
@@ -39,42 +378,32 @@ void read_jpeg(const char *filename, struct conv_image *conv_image)
     jpeg_create_decompress(&cinfo);
 
     jpeg_stdio_src(&cinfo, file);
-    jpeg_read_header(&cinfo, TRUE);
-    jpeg_start_decompress(&cinfo);
-
-    conv_image->width = cinfo.output_width;
-    conv_image->height = cinfo.output_height;
-    int channels = cinfo.output_components;
-
-    if (channels != 3)
-    {
-        fprintf(stderr, "error: jpeg file is not in rgb format.\n");
+    if (!decompress(&cinfo, conv_image))
         exit(EXIT_FAILURE);
-    }
 
-    size_t image_size = conv_image->width * conv_image->height;
-    conv_image->r = newarr(unsigned char, image_size);
-    conv_image->g = newarr(unsigned char, image_size);
-    conv_image->b = newarr(unsigned char, image_size);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+}
 
-    unsigned char *row = newarr(unsigned char, channels * conv_image->width);
+bool decode_jpeg(const unsigned char *data, size_t size, struct conv_image *conv_image)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error error;
 
-    while (cinfo.output_scanline < cinfo.output_height)
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(error.jump))
     {
-        jpeg_read_scanlines(&cinfo, &row, 1);
-
-        for (int x = 0; x < conv_image->width; x++)
-        {
-            conv_image->r[(cinfo.output_scanline - 1) * conv_image->width + x] = row[x * channels];
-            conv_image->g[(cinfo.output_scanline - 1) * conv_image->width + x] = row[x * channels + 1];
-            conv_image->b[(cinfo.output_scanline - 1) * conv_image->width + x] = row[x * channels + 2];
-        }
+        jpeg_destroy_decompress(&cinfo);
+        return false;
     }
+    jpeg_create_decompress(&cinfo);
+
+    jpeg_mem_src(&cinfo, data, (unsigned long)size);
+    bool ok = decompress(&cinfo, conv_image);
 
-    free(row);
-    jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
-    fclose(file);
+    return ok;
 }
 
 void save_jpeg(const char *filename, struct conv_image *conv_image, int quality)
@@ -93,37 +422,35 @@ void save_jpeg(const char *filename, struct conv_image *conv_image, int quality)
     jpeg_create_compress(&cinfo);
 
     jpeg_stdio_dest(&cinfo, file);
+    compress(&cinfo, conv_image, quality);
 
-    const int channels = 3;
-
-    cinfo.image_width = conv_image->width;
-    cinfo.image_height = conv_image->height;
-    cinfo.input_components = channels;
-    cinfo.in_color_space = JCS_RGB;
+    jpeg_destroy_compress(&cinfo);
+    fclose(file);
+}
 
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
+size_t encode_jpeg(struct conv_image *conv_image, int quality, unsigned char **buffer, size_t *capacity)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
 
-    jpeg_start_compress(&cinfo, TRUE);
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
 
-    unsigned char *row = newarr(unsigned char, channels * conv_image->width);
+    // libjpeg writes into the caller's buffer and only mallocs a larger one when
+    // it runs out; in that case the new buffer replaces the old one.
+    unsigned char *out = *buffer;
+    unsigned long size = (unsigned long)*capacity;
+    jpeg_mem_dest(&cinfo, &out, &size);
+    compress(&cinfo, conv_image, quality);
+    jpeg_destroy_compress(&cinfo);
 
-    while (cinfo.next_scanline < cinfo.image_height)
+    if (out != *buffer)
     {
-        for (int x = 0; x < conv_image->width; x++)
-        {
-            row[x * channels] = conv_image->r[cinfo.next_scanline * conv_image->width + x];
-            row[x * channels + 1] = conv_image->g[cinfo.next_scanline * conv_image->width + x];
-            row[x * channels + 2] = conv_image->b[cinfo.next_scanline * conv_image->width + x];
-        }
-
-        jpeg_write_scanlines(&cinfo, &row, 1);
+        free(*buffer);
+        *buffer = out;
+        *capacity = size;
     }
-
-    free(row);
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-    fclose(file);
+    return size;
 }
 
 void conv_mat_init(struct conv_mat *conv_mat)
@@ -1,6 +1,7 @@
 #ifndef _CONV_UTIL_H
 #define _CONV_UTIL_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <jpeglib.h>
 
@@ -8,6 +9,7 @@ struct conv_image
 {
     unsigned int width;
     unsigned int height;
+    size_t capacity;
     unsigned char *r;
     unsigned char *g;
     unsigned char *b;
@@ -19,6 +21,23 @@ void conv_image_free(struct conv_image *conv_image);
 void read_jpeg(const char *filename, struct conv_image *conv_image);
 void save_jpeg(const char *filename, struct conv_image *conv_image, int quality);
 
+// In-memory variants. decode_jpeg reuses the planes when they are large enough
+// and, unlike read_jpeg, returns false on a corrupt or unsupported file instead
+// of exiting; encode_jpeg writes into *buffer, growing it and *capacity as
+// needed, and returns the encoded size.
+bool decode_jpeg(const unsigned char *data, size_t size, struct conv_image *conv_image);
+size_t encode_jpeg(struct conv_image *conv_image, int quality, unsigned char **buffer, size_t *capacity);
+
+// Pixel format conversions. Luminance is (r + g + b) / (3 * 255); luma_to_u8
+// clamps to [0, 1] and rounds like lrintf. The grey output fills all three planes.
+void rgb_to_planes(const unsigned char *rgb, size_t count, unsigned char *r, unsigned char *g, unsigned char *b);
+void planes_to_rgb(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, unsigned char *rgb);
+void planes_to_luma(const unsigned char *r, const unsigned char *g, const unsigned char *b, size_t count, float *luma);
+void rgb_to_luma(const unsigned char *rgb, size_t count, float *luma);
+void luma_to_u8(const float *values, size_t count, unsigned char *out);
+void conv_image_to_luma(const struct conv_image *conv_image, float *luma);
+void luma_to_conv_image(const float *values, struct conv_image *conv_image);
+
 struct conv_mat
 {
     unsigned int rows;
@@ -1,15 +1,19 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
-#include <immintrin.h>
 #include <jpeglib.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "conv.h"
+#include "conv_chain.h"
+#include "conv_stream.h"
+#include "conv_u8.h"
 #include "conv_util.h"
 #include "../core/bench.h"
+#include "../core/cpu.h"
 
 static void fill(float *data, size_t count, unsigned int seed)
 {
@@ -33,79 +37,555 @@ static void conv_scalar(const float *src, size_t h, size_t w, const float *kerne
         }
 }
 
-static inline __m256 fmadd(__m256 a, __m256 b, __m256 acc)
+static int similar(const float *a, const float *b, size_t count)
 {
-    return _mm256_add_ps(_mm256_mul_ps(a, b), acc);
+    for (size_t i = 0; i < count; i++)
+        if (fabsf(a[i] - b[i]) > 1e-3f)
+            return 0;
+    return 1;
 }
 
-static void conv_avx(const float *src, size_t h, size_t w, const float *kernel, size_t kh, size_t kw, float *dst)
+static void conv_scalar_run(const float *src, size_t h, size_t w, const float *kernel, size_t kh, size_t kw, float *dst)
 {
-    size_t oh = h - kh + 1;
-    size_t ow = w - kw + 1;
-    for (size_t i = 0; i < oh; i++)
+    conv_scalar(src, h, w, kernel, kh, kw, dst);
+}
+
+// Threads a run on sched occupies, for bench_threads.
+static size_t sched_threads(const struct task_sched *sched)
+{
+    return sched != nullptr ? sched->worker_count : 1;
+}
+
+static void conv_engine_run(const struct conv_plan *plan, const float *src, size_t h, size_t w, float *dst, struct task_sched *sched)
+{
+    conv_apply(plan, src, h, w, dst, sched);
+}
+
+static float clip(float v)
+{
+    if (v < 0.0f)
+        return 0.0f;
+    if (v > 1.0f)
+        return 1.0f;
+    return v;
+}
+
+static void luma_scalar(const struct conv_image *image, float *luma)
+{
+    size_t total = (size_t)image->width * image->height;
+    for (size_t idx = 0; idx < total; idx++)
+        luma[idx] = (image->r[idx] + image->g[idx] + image->b[idx]) / (3.0f * 255.0f);
+}
+
+static void quantize_scalar(const float *values, struct conv_image *image)
+{
+    size_t total = (size_t)image->width * image->height;
+    for (size_t idx = 0; idx < total; idx++)
+    {
+        unsigned char v = (unsigned char)lrintf(clip(values[idx]) * 255.0f);
+        image->r[idx] = v;
+        image->g[idx] = v;
+        image->b[idx] = v;
+    }
+}
+
+static void interleave_scalar(const struct conv_image *image, unsigned char *rgb)
+{
+    size_t total = (size_t)image->width * image->height;
+    for (size_t idx = 0; idx < total; idx++)
+    {
+        rgb[3 * idx] = image->r[idx];
+        rgb[3 * idx + 1] = image->g[idx];
+        rgb[3 * idx + 2] = image->b[idx];
+    }
+}
+
+static void deinterleave_scalar(const unsigned char *rgb, struct conv_image *image)
+{
+    size_t total = (size_t)image->width * image->height;
+    for (size_t idx = 0; idx < total; idx++)
+    {
+        image->r[idx] = rgb[3 * idx];
+        image->g[idx] = rgb[3 * idx + 1];
+        image->b[idx] = rgb[3 * idx + 2];
+    }
+}
+
+// Times the per-pixel format conversions around the convolution on a side x side
+// image; each line is "convert <stage> side scalar_ms vector_ms".
+static void bench_conversions(size_t side)
+{
+    size_t total = side * side;
+    struct conv_image image = {(unsigned int)side, (unsigned int)side, total,
+                               malloc(total), malloc(total), malloc(total)};
+    struct conv_image copy = {(unsigned int)side, (unsigned int)side, total,
+                              malloc(total), malloc(total), malloc(total)};
+    unsigned char *rgb = malloc(3 * total);
+    unsigned char *rgb_v = malloc(3 * total);
+    float *luma_s = malloc(total * sizeof(float));
+    float *luma_v = malloc(total * sizeof(float));
+    srand((unsigned int)side);
+    for (size_t i = 0; i < 3 * total; i++)
+        rgb[i] = (unsigned char)rand();
+
+    bench_tag("convert deinterleave");
+    bench_work(0.0, 6.0 * (double)total);
+    BENCH(side, deinterleave_scalar(rgb, &image),
+          rgb_to_planes(rgb, total, copy.r, copy.g, copy.b));
+    if (memcmp(image.r, copy.r, total) != 0 || memcmp(image.g, copy.g, total) != 0 || memcmp(image.b, copy.b, total) != 0)
+        fprintf(stderr, "deinterleave mismatch %zu\n", side);
+
+    bench_tag("convert interleave");
+    bench_work(0.0, 6.0 * (double)total);
+    BENCH(side, interleave_scalar(&image, rgb),
+          planes_to_rgb(image.r, image.g, image.b, total, rgb_v));
+    if (memcmp(rgb, rgb_v, 3 * total) != 0)
+        fprintf(stderr, "interleave mismatch %zu\n", side);
+
+    bench_tag("convert luma");
+    bench_work(0.0, (double)total * (3 + sizeof(float)));
+    BENCH(side, luma_scalar(&image, luma_s), conv_image_to_luma(&image, luma_v));
+    if (memcmp(luma_s, luma_v, total * sizeof(float)) != 0)
+        fprintf(stderr, "luma mismatch %zu\n", side);
+
+    for (size_t i = 0; i < total; i++)
+        luma_s[i] = luma_s[i] * 1.5f - 0.25f;
+    bench_tag("convert quantize");
+    bench_work(0.0, (double)total * (3 + sizeof(float)));
+    BENCH(side, quantize_scalar(luma_s, &image), luma_to_conv_image(luma_s, &copy));
+    if (memcmp(image.r, copy.r, total) != 0 || memcmp(image.b, copy.b, total) != 0)
+        fprintf(stderr, "quantize mismatch %zu\n", side);
+
+    conv_image_free(&image);
+    conv_image_free(&copy);
+    free(rgb);
+    free(rgb_v);
+    free(luma_s);
+    free(luma_v);
+}
+
+static void float_plane_run(const struct conv_plan *plan, const unsigned char *plane, size_t side,
+                            float *luma, float *values, unsigned char *out, struct task_sched *sched)
+{
+    size_t out_side = side - plan->rows + 1;
+    planes_to_luma(plane, plane, plane, side * side, luma);
+    conv_apply(plan, luma, side, side, values, sched);
+    luma_to_u8(values, out_side * out_side, out);
+}
+
+// Float path (promote, convolve, quantize) against the native 8-bit path on one
+// plane; lines are "u8 side float_ms u8_ms". Exact kernels must match the float
+// convolution of the raw bytes everywhere.
+static void bench_u8(const struct conv_mat *mat, size_t side, struct task_sched *sched)
+{
+    struct conv_plan plan;
+    struct conv_plan_u8 plan_u8;
+    conv_plan_init(&plan, mat);
+    if (!conv_plan_u8_init(&plan_u8, mat))
+    {
+        fprintf(stderr, "kernel does not fit the 8-bit path\n");
+        conv_plan_free(&plan);
+        return;
+    }
+
+    size_t total = side * side;
+    size_t out_side = side - mat->rows + 1;
+    size_t out_total = out_side * out_side;
+    unsigned char *plane = malloc(total);
+    unsigned char *out_f = malloc(out_total);
+    unsigned char *out_u8 = malloc(out_total);
+    float *luma = malloc(total * sizeof(float));
+    float *values = malloc(out_total * sizeof(float));
+    srand((unsigned int)side);
+    for (size_t i = 0; i < total; i++)
+        plane[i] = (unsigned char)rand();
+
+    // Counted as the 8-bit path moves it; the float path moves more bytes for
+    // the same result.
+    bench_tag("u8");
+    bench_work(2.0 * (double)(mat->rows * mat->cols) * (double)out_total, (double)(total + out_total));
+    bench_threads(sched_threads(sched), sched_threads(sched));
+    BENCH(side, float_plane_run(&plan, plane, side, luma, values, out_f, sched),
+          conv_apply_u8(&plan_u8, plane, side, side, out_u8, sched));
+
+    for (size_t i = 0; i < total; i++)
+        luma[i] = plane[i];
+    conv_apply(&plan, luma, side, side, values, sched);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < out_total; i++)
     {
-        size_t j = 0;
-        for (; j + 8 <= ow; j += 8)
+        float v = values[i] < 0.0f ? 0.0f : values[i] > 255.0f ? 255.0f : values[i];
+        if ((unsigned char)lrintf(v) != out_u8[i])
+            mismatches++;
+    }
+    if (plan_u8.exact && mismatches != 0)
+        fprintf(stderr, "u8 mismatch %zu: %zu pixels\n", side, mismatches);
+
+    conv_plan_free(&plan);
+    conv_plan_u8_free(&plan_u8);
+    free(plane);
+    free(out_f);
+    free(out_u8);
+    free(luma);
+    free(values);
+}
+
+// Largest difference from the rounded float result that weight quantization
+// allows: 255 per unit of total weight error, plus one for the two roundings.
+static int u8_tolerance(const struct conv_plan_u8 *plan, const float *values)
+{
+    if (plan->exact)
+        return 0;
+    double error = 0.0;
+    for (size_t i = 0; i < plan->rows * plan->cols; i++)
+        error += fabs((double)values[i] - ldexp(plan->weights[i], -plan->shift));
+    return (int)(255.0 * error) + 1;
+}
+
+static void gaussian(float *values, size_t rows, size_t cols, float sigma)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < rows; i++)
+        for (size_t j = 0; j < cols; j++)
         {
-            __m256 acc = _mm256_setzero_ps();
-            for (size_t ki = 0; ki < kh; ki++)
+            float y = (float)i - (float)(rows / 2);
+            float x = (float)j - (float)(cols / 2);
+            values[i * cols + j] = expf(-(x * x + y * y) / (2.0f * sigma * sigma));
+            sum += values[i * cols + j];
+        }
+    for (size_t i = 0; i < rows * cols; i++)
+        values[i] /= sum;
+}
+
+// The 8-bit path against the direct float convolution of the raw bytes on widths
+// that are not multiples of the vector blocks: exact kernels (3x3 Laplacian on
+// the narrow path, 5x5 binomial) must match bit for bit, Gaussians that only fit
+// the wide path within the quantization error of their weights. conv_apply is no
+// reference here: its separable path divides by the pivot weight, which is not
+// exact in float and moves ties by one.
+static void check_u8(struct task_sched *sched)
+{
+    static const char *names[] = {"laplacian 3x3", "binomial 5x5", "gaussian 5x5", "gaussian 3x7"};
+    size_t shapes[][2] = {{9, 7}, {21, 33}, {40, 45}, {17, 63}, {33, 97}, {64, 130}};
+    size_t kernels[][2] = {{3, 3}, {5, 5}, {5, 5}, {3, 7}};
+    static const float binomial[] = {1.0f, 4.0f, 6.0f, 4.0f, 1.0f};
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        size_t kh = kernels[k][0], kw = kernels[k][1];
+        float values[5 * 7];
+        if (k == 0)
+            for (size_t i = 0; i < 9; i++)
+                values[i] = i == 4 ? 8.0f : -1.0f;
+        else if (k == 1)
+            for (size_t i = 0; i < 5; i++)
+                for (size_t j = 0; j < 5; j++)
+                    values[i * 5 + j] = binomial[i] * binomial[j] / 256.0f;
+        else
+            gaussian(values, kh, kw, 1.0f);
+        struct conv_mat mat = {(unsigned int)kh, (unsigned int)kw, values};
+        struct conv_plan_u8 plan_u8;
+        if (!conv_plan_u8_init(&plan_u8, &mat))
+        {
+            fprintf(stderr, "u8 %s: kernel does not fit the 8-bit path\n", names[k]);
+            continue;
+        }
+        if (k < 2 ? !plan_u8.exact : plan_u8.narrow)
+            fprintf(stderr, "u8 %s: unexpected %s plan\n", names[k], plan_u8.narrow ? "narrow" : "wide");
+        int tolerance = u8_tolerance(&plan_u8, values);
+
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+        {
+            size_t h = shapes[s][0], w = shapes[s][1];
+            size_t out_total = (h - kh + 1) * (w - kw + 1);
+            unsigned char *plane = malloc(h * w);
+            unsigned char *out = malloc(out_total);
+            float *luma = malloc(h * w * sizeof(float));
+            float *ref = malloc(out_total * sizeof(float));
+            srand((unsigned int)(h * w + k));
+            for (size_t i = 0; i < h * w; i++)
             {
-                size_t base = (i + ki) * w + j;
-                for (size_t kj = 0; kj < kw; kj++)
-                {
-                    __m256 pixels = _mm256_loadu_ps(src + base + kj);
-                    __m256 kval = _mm256_set1_ps(kernel[ki * kw + kj]);
-                    acc = fmadd(pixels, kval, acc);
-                }
+                plane[i] = (unsigned char)rand();
+                luma[i] = plane[i];
             }
-            _mm256_storeu_ps(dst + i * ow + j, acc);
+            conv_scalar(luma, h, w, values, kh, kw, ref);
+            conv_apply_u8(&plan_u8, plane, h, w, out, sched);
+            int worst = 0;
+            for (size_t i = 0; i < out_total; i++)
+            {
+                float v = ref[i] < 0.0f ? 0.0f : ref[i] > 255.0f ? 255.0f : ref[i];
+                int diff = abs((int)lrintf(v) - out[i]);
+                if (diff > worst)
+                    worst = diff;
+            }
+            if (worst > tolerance)
+                fprintf(stderr, "u8 mismatch %s %zux%zu: off by %d, allowed %d\n", names[k], h, w, worst, tolerance);
+            free(plane);
+            free(out);
+            free(luma);
+            free(ref);
+        }
+        conv_plan_u8_free(&plan_u8);
+    }
+}
+
+static size_t border_ref(long i, long n, enum conv_border border, int *inside)
+{
+    *inside = 1;
+    while (i < 0 || i >= n)
+    {
+        if (border == CONV_BORDER_ZERO)
+        {
+            *inside = 0;
+            return 0;
         }
-        for (; j < ow; j++)
+        if (border == CONV_BORDER_CLAMP)
+            i = i < 0 ? 0 : n - 1;
+        else if (border == CONV_BORDER_WRAP)
+            i = i < 0 ? i + n : i - n;
+        else if (n == 1)
+            i = 0;
+        else
+            i = i < 0 ? -i : 2 * (n - 1) - i;
+    }
+    return (size_t)i;
+}
+
+static void conv_same_scalar(const float *src, size_t h, size_t w, const float *kernel, size_t kh, size_t kw,
+                             enum conv_border border, float *dst)
+{
+    for (size_t i = 0; i < h; i++)
+        for (size_t j = 0; j < w; j++)
         {
             float sum = 0.0f;
             for (size_t ki = 0; ki < kh; ki++)
                 for (size_t kj = 0; kj < kw; kj++)
-                    sum += src[(i + ki) * w + (j + kj)] * kernel[ki * kw + kj];
-            dst[i * ow + j] = sum;
+                {
+                    int row_inside, col_inside;
+                    size_t r = border_ref((long)(i + ki) - (long)(kh / 2), (long)h, border, &row_inside);
+                    size_t c = border_ref((long)(j + kj) - (long)(kw / 2), (long)w, border, &col_inside);
+                    if (row_inside && col_inside)
+                        sum += src[r * w + c] * kernel[ki * kw + kj];
+                }
+            dst[i * w + j] = sum;
         }
-    }
 }
 
-static int similar(const float *a, const float *b, size_t count)
+// Same-size output for every border mode against the scalar reference, including
+// images smaller than the kernel, then valid against same-size on full frames.
+static void check_borders(struct task_sched *sched)
 {
-    for (size_t i = 0; i < count; i++)
-        if (fabsf(a[i] - b[i]) > 1e-3f)
-            return 0;
-    return 1;
+    static const char *names[] = {"clamp", "reflect", "wrap", "zero"};
+    size_t shapes[][2] = {{1, 1}, {3, 7}, {9, 40}, {67, 45}, {130, 301}};
+    size_t kernels[][2] = {{3, 3}, {5, 5}, {4, 2}, {7, 7}, {19, 19}};
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            size_t h = shapes[s][0], w = shapes[s][1];
+            size_t kh = kernels[k][0], kw = kernels[k][1];
+            float *src = malloc(h * w * sizeof(float));
+            float *ref = malloc(h * w * sizeof(float));
+            float *out = malloc(h * w * sizeof(float));
+            float *values = malloc(kh * kw * sizeof(float));
+            fill(src, h * w, (unsigned int)(h + w));
+            fill(values, kh * kw, (unsigned int)(kh * kw));
+            if (kh == 7)
+                for (size_t i = 0; i < kh; i++)
+                    for (size_t j = 0; j < kw; j++)
+                        values[i * kw + j] = values[i] * values[j];
+            struct conv_mat mat = {(unsigned int)kh, (unsigned int)kw, values};
+            struct conv_plan kernel_plan;
+            conv_plan_init(&kernel_plan, &mat);
+            for (enum conv_border border = CONV_BORDER_CLAMP; border <= CONV_BORDER_ZERO; border++)
+            {
+                conv_same_scalar(src, h, w, values, kh, kw, border, ref);
+                conv_apply_same(&kernel_plan, src, h, w, out, border, sched);
+                if (!similar(ref, out, h * w))
+                    fprintf(stderr, "mismatch %s %zux%zu %zux%zu %s\n", names[border], h, w, kh, kw,
+                            conv_path_name(kernel_plan.path));
+            }
+            conv_plan_free(&kernel_plan);
+            free(src);
+            free(ref);
+            free(out);
+            free(values);
+        }
 }
 
-static void conv_scalar_run(const float *src, size_t h, size_t w, const float *kernel, size_t kh, size_t kw, float *dst)
+static void bench_same(const struct conv_plan *plan, size_t side, struct task_sched *sched)
 {
-    conv_scalar(src, h, w, kernel, kh, kw, dst);
+    float *src = malloc(side * side * sizeof(float));
+    float *dst = malloc(side * side * sizeof(float));
+    fill(src, side * side, (unsigned int)side);
+    bench_tag("same");
+    bench_work(2.0 * (double)(plan->rows * plan->cols) * (double)(side * side), 2.0 * (double)(side * side) * sizeof(float));
+    bench_threads(sched_threads(sched), sched_threads(sched));
+    BENCH(side, conv_apply(plan, src, side, side, dst, sched),
+          conv_apply_same(plan, src, side, side, dst, CONV_BORDER_REFLECT, sched));
+    free(src);
+    free(dst);
 }
 
-static void conv_avx_run(const float *src, size_t h, size_t w, const float *kernel, size_t kh, size_t kw, float *dst)
+static void chain_sequential(const struct conv_plan *plans, size_t count, const float *src, size_t h, size_t w,
+                             float *tmp_a, float *tmp_b, float *dst, struct task_sched *sched)
 {
-    conv_avx(src, h, w, kernel, kh, kw, dst);
+    const float *in = src;
+    for (size_t s = 0; s < count; s++)
+    {
+        float *out = s + 1 == count ? dst : s % 2 == 0 ? tmp_a : tmp_b;
+        conv_apply(&plans[s], in, h, w, out, sched);
+        h -= plans[s].rows - 1;
+        w -= plans[s].cols - 1;
+        in = out;
+    }
 }
 
-static float clip(float v)
+// Applies the chain one conv_apply at a time against the fused pass; lines are
+// "chain <name> <side> <sequential_ms> <fused_ms>".
+static void bench_chain(const char *name, const struct conv_mat *mats, size_t count, size_t side,
+                        struct task_sched *sched)
 {
-    if (v < 0.0f)
-        return 0.0f;
-    if (v > 1.0f)
-        return 1.0f;
-    return v;
+    struct conv_plan *plans = malloc(count * sizeof(struct conv_plan));
+    for (size_t s = 0; s < count; s++)
+        conv_plan_init(&plans[s], &mats[s]);
+    struct conv_chain chain;
+    conv_chain_init(&chain, mats, count);
+
+    size_t out_total = (side - chain.shrink_rows) * (side - chain.shrink_cols);
+    float *src = malloc(side * side * sizeof(float));
+    float *tmp_a = malloc(side * side * sizeof(float));
+    float *tmp_b = malloc(side * side * sizeof(float));
+    float *ref = malloc(out_total * sizeof(float));
+    float *fused = malloc(out_total * sizeof(float));
+    fill(src, side * side, (unsigned int)side);
+
+    // Flops of every stage on its own output size, and only the traffic of the
+    // fused pass: the input read once and the final output written once.
+    double flops = 0.0;
+    size_t h = side, w = side;
+    for (size_t s = 0; s < count; s++)
+    {
+        h -= mats[s].rows - 1;
+        w -= mats[s].cols - 1;
+        flops += 2.0 * (double)(mats[s].rows * mats[s].cols) * (double)(h * w);
+    }
+    bench_tag("chain %s", name);
+    bench_work(flops, (double)(side * side + out_total) * sizeof(float));
+    bench_threads(sched_threads(sched), sched_threads(sched));
+    BENCH(side, chain_sequential(plans, count, src, side, side, tmp_a, tmp_b, ref, sched),
+          conv_chain_apply(&chain, src, side, side, fused, sched));
+    if (!similar(ref, fused, out_total))
+        fprintf(stderr, "chain mismatch %s %zu\n", name, side);
+
+    for (size_t s = 0; s < count; s++)
+        conv_plan_free(&plans[s]);
+    free(plans);
+    conv_chain_free(&chain);
+    free(src);
+    free(tmp_a);
+    free(tmp_b);
+    free(ref);
+    free(fused);
 }
 
-int main(void)
+// Random weights scaled to a unit absolute sum, so deep chains stay within the
+// tolerance of similar.
+static float *unit_kernel(size_t kh, size_t kw, unsigned int seed)
+{
+    float *values = malloc(kh * kw * sizeof(float));
+    fill(values, kh * kw, seed);
+    float norm = 0.0f;
+    for (size_t i = 0; i < kh * kw; i++)
+        norm += fabsf(values[i]);
+    for (size_t i = 0; i < kh * kw; i++)
+        values[i] /= norm;
+    return values;
+}
+
+// Fused chains of mixed odd kernel sizes against conv_apply_same one stage at
+// a time: with odd kernels the valid chain output is the same-size result
+// cropped by the summed anchors, whatever the border.
+static void check_chains(struct task_sched *sched)
+{
+    static const size_t chains[][4][2] = {
+        {{5, 5}, {3, 7}, {7, 7}, {0, 0}},
+        {{3, 3}, {5, 5}, {0, 0}, {0, 0}},
+        {{7, 3}, {3, 3}, {1, 9}, {5, 5}},
+        {{9, 9}, {0, 0}, {0, 0}, {0, 0}},
+    };
+    size_t shapes[][2] = {{21, 25}, {67, 45}, {130, 301}, {300, 517}};
+    for (size_t c = 0; c < sizeof(chains) / sizeof(chains[0]); c++)
+    {
+        struct conv_mat mats[4];
+        struct conv_plan plans[4];
+        size_t count = 0;
+        size_t anchor_y = 0, anchor_x = 0;
+        for (; count < 4 && chains[c][count][0] != 0; count++)
+        {
+            size_t kh = chains[c][count][0], kw = chains[c][count][1];
+            float *values = unit_kernel(kh, kw, (unsigned int)(c * 16 + count));
+            mats[count] = (struct conv_mat){(unsigned int)kh, (unsigned int)kw, values};
+            conv_plan_init(&plans[count], &mats[count]);
+            anchor_y += kh / 2;
+            anchor_x += kw / 2;
+        }
+        struct conv_chain chain;
+        conv_chain_init(&chain, mats, count);
+
+        for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+        {
+            size_t h = shapes[s][0], w = shapes[s][1];
+            size_t oh = h - chain.shrink_rows, ow = w - chain.shrink_cols;
+            float *stage_a = malloc(h * w * sizeof(float));
+            float *stage_b = malloc(h * w * sizeof(float));
+            float *fused = malloc(oh * ow * sizeof(float));
+            fill(stage_a, h * w, (unsigned int)(h + w));
+            conv_chain_apply(&chain, stage_a, h, w, fused, sched);
+            for (size_t k = 0; k < count; k++)
+            {
+                conv_apply_same(&plans[k], stage_a, h, w, stage_b, CONV_BORDER_REFLECT, sched);
+                float *swap = stage_a;
+                stage_a = stage_b;
+                stage_b = swap;
+            }
+            for (size_t y = 0; y < oh; y++)
+                if (!similar(stage_a + (y + anchor_y) * w + anchor_x, fused + y * ow, ow))
+                {
+                    fprintf(stderr, "chain mismatch %zu stages %zux%zu, row %zu\n", count, h, w, y);
+                    break;
+                }
+            free(stage_a);
+            free(stage_b);
+            free(fused);
+        }
+
+        for (size_t k = 0; k < count; k++)
+        {
+            conv_plan_free(&plans[k]);
+            free(mats[k].values);
+        }
+        conv_chain_free(&chain);
+    }
+}
+
+int main(int argc, char **argv)
 {
     size_t sizes[] = {256, 512, 768, 1024, 1280, 1536, 1792, 2048};
-    size_t repeats = 5;
     float kernel[] = {
         -1.0f, -1.0f, -1.0f,
         -1.0f, 8.0f, -1.0f,
         -1.0f, -1.0f, -1.0f};
+    struct conv_mat laplacian = {3, 3, kernel};
+    struct conv_plan plan;
+    conv_plan_init(&plan, &laplacian);
+    struct task_sched *pool = task_sched_create(0, 0, TASK_SCHED_WORK_STEALING);
+    fprintf(stderr, "conv: %s\n", cpu_level_name(cpu_level()));
+    if (argc == 4 && strcmp(argv[1], "--stream") == 0)
+    {
+        conv_stream_jpeg(argv[2], argv[3], &plan, 90, pool);
+        conv_plan_free(&plan);
+        task_sched_destroy(pool);
+        return 0;
+    }
     for (size_t n = 0; n < sizeof(sizes) / sizeof(sizes[0]); n++)
     {
         size_t side = sizes[n];
@@ -116,14 +596,80 @@ int main(void)
         float *dst_s = malloc(out_total * sizeof(float));
         float *dst_v = malloc(out_total * sizeof(float));
         fill(src, total, (unsigned int)(side + 1));
-        BENCH(side, repeats, conv_scalar_run(src, side, side, kernel, 3, 3, dst_s),
-              conv_avx_run(src, side, side, kernel, 3, 3, dst_v));
+        bench_work(2.0 * 9.0 * (double)out_total, (double)(total + out_total) * sizeof(float));
+        bench_threads(1, sched_threads(pool));
+        BENCH(side, conv_scalar_run(src, side, side, kernel, 3, 3, dst_s),
+              conv_engine_run(&plan, src, side, side, dst_v, pool));
         if (!similar(dst_s, dst_v, out_total))
             fprintf(stderr, "mismatch %zu\n", side);
         free(src);
         free(dst_s);
         free(dst_v);
     }
+    size_t kernel_sides[] = {3, 5, 7, 9, 21};
+    size_t side = 1024;
+    float *src = malloc(side * side * sizeof(float));
+    float *ref_out = malloc(side * side * sizeof(float));
+    float *engine_out = malloc(side * side * sizeof(float));
+    fill(src, side * side, 7);
+    for (size_t n = 0; n < sizeof(kernel_sides) / sizeof(kernel_sides[0]); n++)
+    {
+        for (int separable = 0; separable < 2; separable++)
+        {
+            size_t k = kernel_sides[n];
+            float *values = malloc(k * k * sizeof(float));
+            fill(values, k * k, (unsigned int)(k + separable));
+            if (separable)
+                for (size_t i = 0; i < k; i++)
+                    for (size_t j = 0; j < k; j++)
+                        values[i * k + j] = values[i] * values[j];
+            struct conv_mat mat = {(unsigned int)k, (unsigned int)k, values};
+            struct conv_plan kernel_plan;
+            conv_plan_init(&kernel_plan, &mat);
+            size_t out_total = (side - k + 1) * (side - k + 1);
+            // A separable 3x3 still takes the 3x3 path; keep its rows apart
+            // from the plain 3x3 ones.
+            bool sep_tag = separable && kernel_plan.path != CONV_PATH_SEPARABLE;
+            bench_tag("kernel %s%s", sep_tag ? "sep " : "", conv_path_name(kernel_plan.path));
+            bench_work(2.0 * (double)(k * k) * (double)out_total, (double)(side * side + out_total) * sizeof(float));
+            bench_threads(1, sched_threads(pool));
+            BENCH(k, conv_scalar_run(src, side, side, values, k, k, ref_out),
+                  conv_engine_run(&kernel_plan, src, side, side, engine_out, pool));
+            if (!similar(ref_out, engine_out, out_total))
+                fprintf(stderr, "mismatch %zux%zu %s%s\n", k, k, sep_tag ? "sep " : "", conv_path_name(kernel_plan.path));
+            conv_plan_free(&kernel_plan);
+            free(values);
+        }
+    }
+    free(src);
+    free(ref_out);
+    free(engine_out);
+    check_borders(pool);
+    for (size_t side = 1024; side <= 4096; side *= 2)
+        bench_same(&plan, side, pool);
+    check_chains(pool);
+    float blur[] = {
+        1.0f / 16, 2.0f / 16, 1.0f / 16,
+        2.0f / 16, 4.0f / 16, 2.0f / 16,
+        1.0f / 16, 2.0f / 16, 1.0f / 16};
+    float sharpen[] = {
+        0.0f, -1.0f, 0.0f,
+        -1.0f, 5.0f, -1.0f,
+        0.0f, -1.0f, 0.0f};
+    // Blur, sharpen and edge detection.
+    struct conv_mat filters[] = {{3, 3, blur}, {3, 3, sharpen}, {3, 3, kernel}};
+    for (size_t side = 1024; side <= 4096; side *= 2)
+        bench_chain("3x3", filters, 3, side, pool);
+    // One stage for each row kernel: 5x5, generic 3x7 and generic 7x7.
+    struct conv_mat mixed[] = {{5, 5, unit_kernel(5, 5, 1)}, {3, 7, unit_kernel(3, 7, 2)}, {7, 7, unit_kernel(7, 7, 3)}};
+    for (size_t side = 1024; side <= 4096; side *= 2)
+        bench_chain("mixed", mixed, 3, side, pool);
+    for (size_t s = 0; s < 3; s++)
+        free(mixed[s].values);
+    bench_conversions(2048);
+    check_u8(pool);
+    for (size_t side = 1024; side <= 4096; side *= 2)
+        bench_u8(&laplacian, side, pool);
     struct conv_image input;
     conv_image_init(&input);
     read_jpeg("input.jpg", &input);
@@ -131,14 +677,15 @@ int main(void)
     size_t iw = input.width;
     size_t total = ih * iw;
     float *image = malloc(total * sizeof(float));
-    for (size_t idx = 0; idx < total; idx++)
-        image[idx] = (input.r[idx] + input.g[idx] + input.b[idx]) / (3.0f * 255.0f);
+    conv_image_to_luma(&input, image);
     size_t oh = ih - 2;
     size_t ow = iw - 2;
     float *dst_s = malloc(oh * ow * sizeof(float));
     float *dst_v = malloc(oh * ow * sizeof(float));
     conv_scalar(image, ih, iw, kernel, 3, 3, dst_s);
-    conv_avx(image, ih, iw, kernel, 3, 3, dst_v);
+    conv_apply(&plan, image, ih, iw, dst_v, pool);
+    if (!similar(dst_s, dst_v, oh * ow))
+        fprintf(stderr, "mismatch on input.jpg\n");
     struct conv_image output;
     conv_image_init(&output);
     output.width = (unsigned int)ow;
@@ -147,18 +694,14 @@ int main(void)
     output.r = malloc(out_total);
     output.g = malloc(out_total);
     output.b = malloc(out_total);
-    for (size_t idx = 0; idx < out_total; idx++)
-    {
-        unsigned char v = (unsigned char)lrintf(clip(dst_v[idx]) * 255.0f);
-        output.r[idx] = v;
-        output.g[idx] = v;
-        output.b[idx] = v;
-    }
+    luma_to_conv_image(dst_v, &output);
     save_jpeg("output.jpg", &output, 90);
     conv_image_free(&input);
     conv_image_free(&output);
     free(image);
     free(dst_s);
     free(dst_v);
+    conv_plan_free(&plan);
+    task_sched_destroy(pool);
     return 0;
 }
@@ -8,8 +8,12 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "multi_search.h"
+#include "parallel_search.h"
+#include "search.h"
 #include "../core/util.h"
 #include "../core/bench.h"
+#include "../core/cpu.h"
 
 static void fill_text(char *data, size_t len, unsigned int seed)
 {
@@ -37,7 +41,7 @@ static long search_scalar(const char *haystack, size_t hay_len, const char *need
     return -1;
 }
 
-static long search_avx2(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+[[gnu::target("avx2")]] static long search_first_avx2(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
 {
     if (needle_len == 0)
         return 0;
@@ -68,24 +72,447 @@ static long search_avx2(const char *haystack, size_t hay_len, const char *needle
     return -1;
 }
 
-static volatile long search_sink = 0;
+// First-byte filter for the CPU level; below AVX2 the plain scalar loop.
+static long (*search_first)(const char *, size_t, const char *, size_t) = search_scalar;
+
+[[gnu::constructor]] static void main_dispatch(void)
+{
+    if (cpu_level() >= CPU_LEVEL_AVX2)
+        search_first = search_first_avx2;
+}
+
+static void search_pair_run(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+{
+    long found = search_pair(haystack, hay_len, needle, needle_len);
+    bench_do_not_optimize(&found);
+}
 
 static void search_scalar_run(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
 {
-    search_sink = search_scalar(haystack, hay_len, needle, needle_len);
+    long found = search_scalar(haystack, hay_len, needle, needle_len);
+    bench_do_not_optimize(&found);
+}
+
+static void search_first_run(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+{
+    long found = search_first(haystack, hay_len, needle, needle_len);
+    bench_do_not_optimize(&found);
+}
+
+// Patterns are substrings of the haystack, 4 to 16 bytes long, so each has at
+// least one occurrence. With starts set, each begins at the next byte from
+// starts after its random offset.
+static void sample_patterns(const char *haystack, size_t hay_len, size_t count, unsigned int seed,
+                            const char *starts, const char **patterns, size_t *lengths)
+{
+    srand(seed);
+    for (size_t p = 0; p < count; p++)
+    {
+        lengths[p] = 4 + (size_t)rand() % 13;
+        size_t limit = hay_len - lengths[p] + 1;
+        size_t pos = (size_t)rand() % limit;
+        if (starts != nullptr)
+        {
+            size_t tries = 0;
+            while (strchr(starts, haystack[pos]) == nullptr && tries++ < limit)
+                pos = (pos + 1) % limit;
+        }
+        patterns[p] = haystack + pos;
+    }
+}
+
+struct match_summary
+{
+    size_t count;
+    size_t checksum;
+};
+
+// The single-needle baseline: search_first restarted after every hit, once per pattern.
+static struct match_summary search_each_first(const char *haystack, size_t hay_len, const char *const *patterns,
+                                             const size_t *lengths, size_t count)
+{
+    struct match_summary summary = {0, 0};
+    for (size_t p = 0; p < count; p++)
+    {
+        size_t start = 0;
+        long pos;
+        while (start < hay_len && (pos = search_first(haystack + start, hay_len - start, patterns[p], lengths[p])) >= 0)
+        {
+            size_t offset = start + (size_t)pos;
+            summary.count++;
+            summary.checksum += offset * 31 + p;
+            start = offset + 1;
+        }
+    }
+    return summary;
+}
+
+// Every pattern compared at every offset, the reference for all engines.
+static struct match_summary search_naive(const char *haystack, size_t hay_len, const char *const *patterns,
+                                         const size_t *lengths, size_t count)
+{
+    struct match_summary summary = {0, 0};
+    for (size_t p = 0; p < count; p++)
+        for (size_t i = 0; i + lengths[p] <= hay_len; i++)
+            if (haystack[i] == patterns[p][0] && memcmp(haystack + i, patterns[p], lengths[p]) == 0)
+            {
+                summary.count++;
+                summary.checksum += i * 31 + p;
+            }
+    return summary;
+}
+
+static struct match_summary summarize(const struct search_matches *matches)
+{
+    struct match_summary summary = {matches->count, 0};
+    for (size_t i = 0; i < matches->count; i++)
+        summary.checksum += matches->items[i].offset * 31 + matches->items[i].pattern;
+    return summary;
+}
+
+static void search_each_run(const char *haystack, size_t hay_len, const char *const *patterns, const size_t *lengths,
+                            size_t count)
+{
+    struct match_summary summary = search_each_first(haystack, hay_len, patterns, lengths, count);
+    bench_do_not_optimize(&summary);
+}
+
+static void multi_search_run(const struct multi_search *ms, const char *haystack, size_t hay_len, struct search_matches *matches)
+{
+    multi_search_all(ms, haystack, hay_len, matches);
+    bench_do_not_optimize(matches);
+}
+
+static const char *engine_name(const struct multi_search *ms)
+{
+    if (ms->engine == MULTI_SEARCH_TEDDY)
+        return "teddy";
+    return ms->prefilter ? "aho-corasick-prefilter" : "aho-corasick";
+}
+
+// Every byte value as a one-byte pattern plus longer patterns sampled from
+// random binary text, so no byte is left for the automaton's unused class.
+static int check_multi_bytes(void)
+{
+    size_t hay_len = 8192;
+    size_t count = 256 + 64;
+    char *haystack = newarr(char, hay_len);
+    char *bytes = newarr(char, 256);
+    const char **patterns = newarr(const char *, count);
+    size_t *lengths = newarr(size_t, count);
+    srand(21);
+    for (size_t i = 0; i < hay_len; i++)
+        haystack[i] = (char)(rand() % 256);
+    memcpy(haystack, "ab\xff\xff" "c\xff", 6);
+    for (size_t c = 0; c < 256; c++)
+    {
+        bytes[c] = (char)c;
+        patterns[c] = bytes + c;
+        lengths[c] = 1;
+    }
+    sample_patterns(haystack, hay_len, count - 256, 22, nullptr, patterns + 256, lengths + 256);
+
+    struct multi_search ms;
+    multi_search_init(&ms, patterns, lengths, count);
+    struct search_matches matches;
+    search_matches_init(&matches);
+    multi_search_all(&ms, haystack, hay_len, &matches);
+    struct match_summary expected = search_naive(haystack, hay_len, patterns, lengths, count);
+    struct match_summary found = summarize(&matches);
+    int status = EXIT_SUCCESS;
+    if (expected.count != found.count || expected.checksum != found.checksum)
+    {
+        fprintf(stderr, "multi mismatch: all bytes, %s, %zu of %zu matches\n", engine_name(&ms), found.count,
+                expected.count);
+        status = EXIT_FAILURE;
+    }
+
+    search_matches_free(&matches);
+    multi_search_free(&ms);
+    free(haystack);
+    free(bytes);
+    free(patterns);
+    free(lengths);
+    return status;
+}
+
+// "any" samples patterns anywhere in the text; in "few-starts" they all begin
+// with 'q' or 'z', so large sets go to the automaton with the start byte scan.
+// Lines are "multi <set> <engine> <patterns> <size> <per_pattern_ms> <engine_ms>".
+static int bench_multi(void)
+{
+    size_t counts[] = {1, 8, 32, 128, 512};
+    size_t sizes[] = {65536, 1 << 20, 4 << 20};
+    const char *sets[] = {"any", "few-starts"};
+    const char *starts[] = {nullptr, "qz"};
+    size_t max_count = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    const char **patterns = newarr(const char *, max_count);
+    size_t *lengths = newarr(size_t, max_count);
+    struct search_matches matches;
+    search_matches_init(&matches);
+    int status = EXIT_SUCCESS;
+
+    for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]) && status == EXIT_SUCCESS; si++)
+    {
+        size_t hay_len = sizes[si];
+        char *haystack = newarr(char, hay_len);
+        fill_text(haystack, hay_len, (unsigned int)(hay_len + 5));
+        for (size_t set = 0; set < sizeof(sets) / sizeof(sets[0]) && status == EXIT_SUCCESS; set++)
+            for (size_t ci = 0; ci < sizeof(counts) / sizeof(counts[0]); ci++)
+            {
+                size_t count = counts[ci];
+                sample_patterns(haystack, hay_len, count, (unsigned int)(count + hay_len), starts[set], patterns,
+                                lengths);
+                struct multi_search ms;
+                multi_search_init(&ms, patterns, lengths, count);
+
+                struct match_summary expected = search_naive(haystack, hay_len, patterns, lengths, count);
+                struct match_summary each = search_each_first(haystack, hay_len, patterns, lengths, count);
+                multi_search_all(&ms, haystack, hay_len, &matches);
+                struct match_summary found = summarize(&matches);
+                if (expected.count != found.count || expected.checksum != found.checksum ||
+                    expected.count != each.count || expected.checksum != each.checksum)
+                {
+                    fprintf(stderr, "multi mismatch: %s, %s, %zu patterns, size %zu\n", sets[set], engine_name(&ms),
+                            count, hay_len);
+                    multi_search_free(&ms);
+                    status = EXIT_FAILURE;
+                    break;
+                }
+
+                bench_tag("multi %s %s %zu", sets[set], engine_name(&ms), count);
+                bench_work(0.0, (double)hay_len);
+                BENCH(hay_len, search_each_run(haystack, hay_len, patterns, lengths, count),
+                      multi_search_run(&ms, haystack, hay_len, &matches));
+                multi_search_free(&ms);
+            }
+        free(haystack);
+    }
+
+    search_matches_free(&matches);
+    free(patterns);
+    free(lengths);
+    return status;
+}
+
+// Text over the first alphabet letters only, so small alphabets give many
+// partial matches.
+static void fill_alphabet(char *data, size_t len, size_t alphabet)
+{
+    for (size_t i = 0; i < len; i++)
+        data[i] = (char)('a' + (size_t)rand() % alphabet);
+}
+
+// Every search variant the CPU runs against search_scalar on random cases:
+// alphabets of 2 to 26 letters, needles of 1 to 3 bytes, periodic needles, long
+// needles past the verification blocks, and needles planted at the start or
+// at the very end of the haystack, which itself starts at any alignment.
+static int check_pair(void)
+{
+    struct
+    {
+        const char *name;
+        long (*search)(const char *, size_t, const char *, size_t);
+        enum cpu_level level;
+    } variants[] = {
+        {"two-way", search_two_way, CPU_LEVEL_SCALAR},
+        {"pair", search_pair, CPU_LEVEL_SCALAR},
+        {"first", search_first, CPU_LEVEL_SCALAR},
+        {"pair sse4.2", search_pair_sse42, CPU_LEVEL_SSE42},
+        {"pair avx2", search_pair_avx2, CPU_LEVEL_AVX2},
+        {"pair avx512", search_pair_avx512, CPU_LEVEL_AVX512},
+    };
+    size_t alphabets[] = {2, 3, 4, 26};
+    size_t max_hay = 16384 + 64;
+    size_t max_needle = 300;
+    char *buffer = newarr(char, max_hay);
+    char *needle = newarr(char, max_needle);
+    int status = EXIT_SUCCESS;
+    srand(20);
+
+    for (size_t c = 0; c < 20000 && status == EXIT_SUCCESS; c++)
+    {
+        size_t alphabet = alphabets[(size_t)rand() % (sizeof(alphabets) / sizeof(alphabets[0]))];
+        size_t needle_len;
+        switch (rand() % 4)
+        {
+        case 0:
+            needle_len = 1 + (size_t)rand() % 3;
+            break;
+        case 1:
+            needle_len = 4 + (size_t)rand() % 61;
+            break;
+        case 2:
+            needle_len = 65 + (size_t)rand() % (max_needle - 64);
+            break;
+        default:
+            needle_len = 1 + (size_t)rand() % 16;
+            break;
+        }
+        // Mostly short haystacks, every tenth long enough for the Two-Way
+        // hand-off after SEARCH_PAIR_SLACK bytes of verification.
+        size_t hay_len = c % 10 == 0 ? (size_t)rand() % 16384 : (size_t)rand() % 700;
+        char *haystack = buffer + (size_t)rand() % 64;
+        fill_alphabet(haystack, hay_len, alphabet);
+
+        fill_alphabet(needle, needle_len, alphabet);
+        if (rand() % 3 == 0)
+        {
+            size_t period = 1 + (size_t)rand() % 4;
+            for (size_t i = period; i < needle_len; i++)
+                needle[i] = needle[i - period];
+            if (rand() % 2 == 0)
+                needle[needle_len - 1] = (char)('a' + (size_t)rand() % alphabet);
+        }
+        if (needle_len <= hay_len)
+        {
+            int place = rand() % 3;
+            if (place == 0)
+                memcpy(haystack + hay_len - needle_len, needle, needle_len);
+            else if (place == 1)
+                memcpy(haystack, needle, needle_len);
+        }
+
+        long expected = search_scalar(haystack, hay_len, needle, needle_len);
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++)
+        {
+            if (cpu_level() < variants[v].level)
+                continue;
+            long found = variants[v].search(haystack, hay_len, needle, needle_len);
+            if (found != expected)
+            {
+                fprintf(stderr, "%s mismatch: alphabet %zu, needle %zu, size %zu: %ld instead of %ld\n",
+                        variants[v].name, alphabet, needle_len, hay_len, found, expected);
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+    }
+
+    free(buffer);
+    free(needle);
+    return status;
+}
+
+// One needle placed at the end of the haystack so the whole text is scanned.
+// "random" is fill_text with a 32-byte needle, "long" the same with 1024
+// bytes, and "adversarial" is a run of 'a' against a needle of 'a' with one
+// space in the middle. A space ranks more common than 'a', so both filter bytes
+// are 'a' and hit at every position, and after SEARCH_PAIR_SLACK bytes of
+// failed verification the scan is handed to Two-Way. Lines are
+// "pair <input> <size> <first_ms> <pair_ms>"; the pair filter is the dispatched
+// one, so SIMD_LEVEL picks which variant is measured.
+static int bench_pair(void)
+{
+    fprintf(stderr, "search_pair: %s\n", cpu_level_name(cpu_level()));
+    size_t sizes[] = {4096, 32768, 262144, 524288, 4 << 20};
+    const char *inputs[] = {"random", "long", "adversarial"};
+    for (size_t kind = 0; kind < sizeof(inputs) / sizeof(inputs[0]); kind++)
+        for (size_t idx = 0; idx < sizeof(sizes) / sizeof(sizes[0]); idx++)
+        {
+            size_t hay_len = sizes[idx];
+            size_t needle_len = kind == 1 ? 1024 : 32;
+            char *haystack = newarr(char, hay_len);
+            char *needle = newarr(char, needle_len);
+            if (kind == 2)
+            {
+                memset(haystack, 'a', hay_len);
+                memset(needle, 'a', needle_len);
+                needle[needle_len / 2] = ' ';
+            }
+            else
+            {
+                fill_text(haystack, hay_len, (unsigned int)(hay_len + 7));
+                fill_text(needle, needle_len, (unsigned int)(hay_len + 9));
+            }
+            memcpy(haystack + hay_len - needle_len, needle, needle_len);
+
+            long expected = search_two_way(haystack, hay_len, needle, needle_len);
+            if (expected != (long)(hay_len - needle_len) || search_pair(haystack, hay_len, needle, needle_len) != expected ||
+                search_first(haystack, hay_len, needle, needle_len) != expected)
+            {
+                fprintf(stderr, "pair mismatch: %s, size %zu\n", inputs[kind], hay_len);
+                return EXIT_FAILURE;
+            }
+
+            bench_tag("pair %s", inputs[kind]);
+            bench_work(0.0, (double)hay_len);
+            BENCH(hay_len, search_first_run(haystack, hay_len, needle, needle_len),
+                  search_pair_run(haystack, hay_len, needle, needle_len));
+            free(haystack);
+            free(needle);
+        }
+    return EXIT_SUCCESS;
 }
 
-static void search_avx2_run(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+static bool same_offsets(const struct search_offsets *a, const struct search_offsets *b)
 {
-    search_sink = search_avx2(haystack, hay_len, needle, needle_len);
+    return a->count == b->count && (a->count == 0 || memcmp(a->items, b->items, a->count * sizeof(size_t)) == 0);
 }
 
-int main(void)
+// Searches a mapped file on 1, 2, 4 and 8 workers, checked against a run on
+// the calling thread, which also pulls the file into the page cache. Lines are
+// "file first <workers> <caller_ms> <pool_ms>" and the same for "file all",
+// with the calling thread alone against the pool.
+static int bench_file(const char *path, const char *needle)
 {
+    size_t needle_len = strlen(needle);
+    struct mapped_file file;
+    mapped_file_open(&file, path);
+    struct search_offsets expected, found;
+    search_offsets_init(&expected);
+    search_offsets_init(&found);
+    parallel_search_all(file.data, file.size, needle, needle_len, nullptr, &expected);
+    long expected_first = expected.count != 0 ? (long)expected.items[0] : -1;
+    printf("# %s: %zu bytes, %zu matches, first at %ld\n", path, file.size, expected.count, expected_first);
+
+    size_t workers[] = {1, 2, 4, 8};
+    int status = EXIT_SUCCESS;
+    for (size_t wi = 0; wi < sizeof(workers) / sizeof(workers[0]); wi++)
+    {
+        struct task_sched *sched = task_sched_create(workers[wi], 0, TASK_SCHED_WORK_STEALING);
+        long first = parallel_search_first(file.data, file.size, needle, needle_len, sched);
+        parallel_search_all(file.data, file.size, needle, needle_len, sched, &found);
+        if (first != expected_first || !same_offsets(&found, &expected))
+        {
+            fprintf(stderr, "file mismatch on %zu workers\n", workers[wi]);
+            task_sched_destroy(sched);
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        // The first-match search only has to read up to the match.
+        bench_tag("file first");
+        bench_work(0.0, expected_first >= 0 ? (double)((size_t)expected_first + needle_len) : (double)file.size);
+        bench_threads(1, workers[wi]);
+        BENCH(workers[wi], parallel_search_first(file.data, file.size, needle, needle_len, nullptr),
+              parallel_search_first(file.data, file.size, needle, needle_len, sched));
+        bench_tag("file all");
+        bench_work(0.0, (double)file.size);
+        bench_threads(1, workers[wi]);
+        BENCH(workers[wi], parallel_search_all(file.data, file.size, needle, needle_len, nullptr, &found),
+              parallel_search_all(file.data, file.size, needle, needle_len, sched, &found));
+        task_sched_destroy(sched);
+    }
+
+    search_offsets_free(&expected);
+    search_offsets_free(&found);
+    mapped_file_close(&file);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && strcmp(argv[1], "--file") == 0)
+        return bench_file(argv[2], argv[3]);
+    if (argc != 1)
+    {
+        fprintf(stderr, "usage: %s [--file <path> <needle>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
     size_t sizes[] = {4096, 8192, 16384, 32768, 65536, 131072, 262144, 524288};
     size_t needle_len = 32;
-    size_t repeats = 10;
-    size_t inner = 100;
     for (size_t idx = 0; idx < sizeof(sizes) / sizeof(sizes[0]); idx++)
     {
         size_t hay_len = sizes[idx];
@@ -98,7 +525,7 @@ int main(void)
             insert_pos = hay_len - needle_len;
         memcpy(haystack + insert_pos, needle, needle_len);
         long s = search_scalar(haystack, hay_len, needle, needle_len);
-        long v = search_avx2(haystack, hay_len, needle, needle_len);
+        long v = search_first(haystack, hay_len, needle, needle_len);
         if (s != v || s < 0)
         {
             fprintf(stderr, "mismatch at size %zu\n", hay_len);
@@ -106,11 +533,15 @@ int main(void)
             free(needle);
             return EXIT_FAILURE;
         }
-        size_t total_iters = repeats * inner;
-        BENCH(hay_len, total_iters, search_scalar_run(haystack, hay_len, needle, needle_len),
-              search_avx2_run(haystack, hay_len, needle, needle_len));
+        bench_work(0.0, (double)(insert_pos + needle_len));
+        BENCH(hay_len, search_scalar_run(haystack, hay_len, needle, needle_len),
+              search_first_run(haystack, hay_len, needle, needle_len));
         free(haystack);
         free(needle);
     }
-    return EXIT_SUCCESS;
+    if (check_pair() != EXIT_SUCCESS || bench_pair() != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (check_multi_bytes() != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    return bench_multi();
 }
@@ -0,0 +1,468 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "multi_search.h"
+
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/cpu.h"
+#include "../core/util.h"
+
+// Teddy and the start-byte scan need AVX2; without it every pattern set goes
+// to the automaton, which then runs without the scan.
+static bool vector_filters;
+
+struct prefix_key
+{
+    uint32_t key;
+    size_t pattern;
+};
+
+static const char *pattern_bytes(const struct multi_search *ms, size_t p)
+{
+    return ms->bytes + ms->offsets[p];
+}
+
+static int compare_prefix_keys(const void *a, const void *b)
+{
+    const struct prefix_key *x = a;
+    const struct prefix_key *y = b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->pattern < y->pattern ? -1 : x->pattern > y->pattern;
+}
+
+static int compare_matches(const void *a, const void *b)
+{
+    const struct search_match *x = a;
+    const struct search_match *y = b;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return x->pattern < y->pattern ? -1 : x->pattern > y->pattern;
+}
+
+static uint64_t load_word(const char *data, size_t available)
+{
+    uint64_t word = 0;
+    memcpy(&word, data, available < 8 ? available : 8);
+    return word;
+}
+
+// Patterns are sorted by their filtered prefix and cut into contiguous buckets,
+// so patterns that share leading bytes also share mask bits.
+static void teddy_init(struct multi_search *ms)
+{
+    size_t count = ms->count;
+    ms->prefix_len = ms->min_len < MULTI_SEARCH_TEDDY_PREFIX ? ms->min_len : MULTI_SEARCH_TEDDY_PREFIX;
+    struct prefix_key *keys = newarr(struct prefix_key, count);
+    for (size_t p = 0; p < count; p++)
+    {
+        const unsigned char *bytes = (const unsigned char *)pattern_bytes(ms, p);
+        uint32_t key = 0;
+        for (size_t k = 0; k < ms->prefix_len; k++)
+            key = key << 8 | bytes[k];
+        keys[p].key = key;
+        keys[p].pattern = p;
+    }
+    qsort(keys, count, sizeof(keys[0]), compare_prefix_keys);
+
+    memset(ms->lo_masks, 0, sizeof(ms->lo_masks));
+    memset(ms->hi_masks, 0, sizeof(ms->hi_masks));
+    ms->bucket_patterns = newarr(size_t, count);
+    for (size_t b = 0; b <= MULTI_SEARCH_TEDDY_BUCKETS; b++)
+        ms->bucket_start[b] = count * b / MULTI_SEARCH_TEDDY_BUCKETS;
+    for (size_t b = 0; b < MULTI_SEARCH_TEDDY_BUCKETS; b++)
+        for (size_t i = ms->bucket_start[b]; i < ms->bucket_start[b + 1]; i++)
+        {
+            size_t p = keys[i].pattern;
+            const unsigned char *bytes = (const unsigned char *)pattern_bytes(ms, p);
+            ms->bucket_patterns[i] = p;
+            for (size_t k = 0; k < ms->prefix_len; k++)
+            {
+                ms->lo_masks[k][bytes[k] & 15] |= (uint8_t)(1u << b);
+                ms->hi_masks[k][bytes[k] >> 4] |= (uint8_t)(1u << b);
+            }
+        }
+    for (size_t k = 0; k < ms->prefix_len; k++)
+    {
+        memcpy(ms->lo_masks[k] + 16, ms->lo_masks[k], 16);
+        memcpy(ms->hi_masks[k] + 16, ms->hi_masks[k], 16);
+    }
+    free(keys);
+
+    ms->prefix_words = newarr(uint64_t, count);
+    ms->prefix_masks = newarr(uint64_t, count);
+    for (size_t p = 0; p < count; p++)
+    {
+        size_t bytes = ms->lengths[p] < 8 ? ms->lengths[p] : 8;
+        ms->prefix_masks[p] = bytes == 8 ? UINT64_MAX : (UINT64_C(1) << (bytes * 8)) - 1;
+        ms->prefix_words[p] = load_word(pattern_bytes(ms, p), bytes);
+    }
+}
+
+// Builds the trie over byte classes, then fills missing transitions and output
+// links in BFS order, so every state's failure target is finished before it.
+static void aho_corasick_init(struct multi_search *ms)
+{
+    bool used[256] = {false};
+    for (size_t p = 0; p < ms->count; p++)
+        for (size_t i = 0; i < ms->lengths[p]; i++)
+            used[(unsigned char)pattern_bytes(ms, p)[i]] = true;
+    // Class 0 is shared by the bytes no pattern uses, if there are any.
+    size_t used_count = 0;
+    for (size_t c = 0; c < 256; c++)
+        used_count += used[c];
+    ms->class_count = used_count < 256 ? 1 : 0;
+    for (size_t c = 0; c < 256; c++)
+        ms->classes[c] = used[c] ? (uint8_t)ms->class_count++ : 0;
+
+    size_t max_states = 1;
+    for (size_t p = 0; p < ms->count; p++)
+        max_states += ms->lengths[p];
+    size_t classes = ms->class_count;
+    uint32_t *delta = newarr(uint32_t, max_states * classes);
+    long *node_match = newarr(long, max_states);
+    memset(delta, 0, classes * sizeof(uint32_t));
+    node_match[0] = -1;
+    ms->pattern_next = newarr(long, ms->count);
+
+    size_t states = 1;
+    for (size_t p = ms->count; p-- > 0;)
+    {
+        const unsigned char *bytes = (const unsigned char *)pattern_bytes(ms, p);
+        uint32_t s = 0;
+        for (size_t i = 0; i < ms->lengths[p]; i++)
+        {
+            uint32_t *next = &delta[s * classes + ms->classes[bytes[i]]];
+            if (*next == 0)
+            {
+                memset(delta + states * classes, 0, classes * sizeof(uint32_t));
+                node_match[states] = -1;
+                *next = (uint32_t)states++;
+            }
+            s = *next;
+        }
+        ms->pattern_next[p] = node_match[s];
+        node_match[s] = (long)p;
+    }
+
+    uint32_t *fail = newarr(uint32_t, states);
+    uint32_t *queue = newarr(uint32_t, states);
+    long *out_link = newarr(long, states);
+    size_t head = 0, tail = 0;
+    out_link[0] = -1;
+    for (size_t c = 0; c < classes; c++)
+    {
+        uint32_t child = delta[c];
+        if (child != 0)
+        {
+            fail[child] = 0;
+            out_link[child] = -1;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail)
+    {
+        uint32_t s = queue[head++];
+        for (size_t c = 0; c < classes; c++)
+        {
+            uint32_t *next = &delta[s * classes + c];
+            uint32_t target = delta[fail[s] * classes + c];
+            if (*next == 0)
+            {
+                *next = target;
+                continue;
+            }
+            fail[*next] = target;
+            out_link[*next] = node_match[target] >= 0 ? (long)target : out_link[target];
+            queue[tail++] = *next;
+        }
+    }
+    free(fail);
+    free(queue);
+
+    // Transitions hold the target row offset rather than the state number, and
+    // the top bit flags targets with output, so the scan loop does one load per
+    // byte and no multiply.
+    if (states * classes > MULTI_SEARCH_OUTPUT_FLAG)
+        die("multi_search_init: automaton too large");
+    for (size_t i = 0; i < states * classes; i++)
+    {
+        uint32_t target = delta[i];
+        bool output = node_match[target] >= 0 || out_link[target] >= 0;
+        delta[i] = (uint32_t)(target * classes) | (output ? MULTI_SEARCH_OUTPUT_FLAG : 0);
+    }
+
+    ms->state_count = states;
+    ms->delta = resize(delta, uint32_t, states * classes);
+    ms->node_match = resize(node_match, long, states);
+    ms->out_link = out_link;
+
+    size_t starts = 0;
+    memset(ms->start_lo, 0, sizeof(ms->start_lo));
+    memset(ms->start_hi, 0, sizeof(ms->start_hi));
+    for (size_t c = 0; c < 256; c++)
+    {
+        if (ms->delta[ms->classes[c]] == 0)
+            continue;
+        starts++;
+        uint8_t *table = c < 128 ? ms->start_lo : ms->start_hi;
+        table[c & 15] |= (uint8_t)(1u << ((c >> 4) & 7));
+    }
+    memcpy(ms->start_lo + 16, ms->start_lo, 16);
+    memcpy(ms->start_hi + 16, ms->start_hi, 16);
+    ms->prefilter = vector_filters && starts <= MULTI_SEARCH_PREFILTER_BYTES;
+}
+
+[[gnu::constructor]] static void multi_search_dispatch(void)
+{
+    vector_filters = cpu_level() >= CPU_LEVEL_AVX2;
+}
+
+void multi_search_init(struct multi_search *ms, const char *const *patterns, const size_t *lengths, size_t count)
+{
+    size_t total = 0;
+    ms->count = count;
+    ms->min_len = SIZE_MAX;
+    ms->offsets = newarr(size_t, count);
+    ms->lengths = newarr(size_t, count);
+    for (size_t p = 0; p < count; p++)
+    {
+        if (lengths[p] == 0)
+            die("multi_search_init: empty pattern");
+        ms->offsets[p] = total;
+        ms->lengths[p] = lengths[p];
+        total += lengths[p];
+        if (lengths[p] < ms->min_len)
+            ms->min_len = lengths[p];
+    }
+    ms->bytes = newarr(char, total + 1);
+    for (size_t p = 0; p < count; p++)
+        memcpy(ms->bytes + ms->offsets[p], patterns[p], lengths[p]);
+
+    ms->bucket_patterns = nullptr;
+    ms->prefix_words = nullptr;
+    ms->prefix_masks = nullptr;
+    ms->delta = nullptr;
+    ms->node_match = nullptr;
+    ms->pattern_next = nullptr;
+    ms->out_link = nullptr;
+    ms->engine = vector_filters && count <= MULTI_SEARCH_TEDDY_MAX ? MULTI_SEARCH_TEDDY : MULTI_SEARCH_AHO_CORASICK;
+    if (count == 0)
+        return;
+    if (ms->engine == MULTI_SEARCH_TEDDY)
+        teddy_init(ms);
+    else
+        aho_corasick_init(ms);
+}
+
+void multi_search_free(struct multi_search *ms)
+{
+    free(ms->bytes);
+    free(ms->offsets);
+    free(ms->lengths);
+    free(ms->bucket_patterns);
+    free(ms->prefix_words);
+    free(ms->prefix_masks);
+    free(ms->delta);
+    free(ms->node_match);
+    free(ms->pattern_next);
+    free(ms->out_link);
+    ms->bytes = nullptr;
+    ms->offsets = nullptr;
+    ms->lengths = nullptr;
+    ms->bucket_patterns = nullptr;
+    ms->prefix_words = nullptr;
+    ms->prefix_masks = nullptr;
+    ms->delta = nullptr;
+    ms->node_match = nullptr;
+    ms->pattern_next = nullptr;
+    ms->out_link = nullptr;
+    ms->count = 0;
+}
+
+void search_matches_init(struct search_matches *matches)
+{
+    matches->items = nullptr;
+    matches->count = 0;
+    matches->capacity = 0;
+}
+
+void search_matches_free(struct search_matches *matches)
+{
+    free(matches->items);
+    search_matches_init(matches);
+}
+
+static void push_match(struct search_matches *matches, size_t offset, size_t pattern)
+{
+    if (matches->count == matches->capacity)
+    {
+        matches->capacity = matches->capacity ? matches->capacity * 2 : 64;
+        matches->items = resize(matches->items, struct search_match, matches->capacity);
+    }
+    matches->items[matches->count].offset = offset;
+    matches->items[matches->count].pattern = pattern;
+    matches->count++;
+}
+
+static void teddy_verify(const struct multi_search *ms, const char *haystack, size_t len, size_t pos, unsigned buckets,
+                         struct search_matches *matches)
+{
+    uint64_t word = load_word(haystack + pos, len - pos);
+    for (; buckets; buckets &= buckets - 1)
+    {
+        unsigned b = (unsigned)__builtin_ctz(buckets);
+        for (size_t i = ms->bucket_start[b]; i < ms->bucket_start[b + 1]; i++)
+        {
+            size_t p = ms->bucket_patterns[i];
+            size_t plen = ms->lengths[p];
+            if (plen > len - pos || (word & ms->prefix_masks[p]) != ms->prefix_words[p])
+                continue;
+            if (plen <= 8 || memcmp(haystack + pos + 8, pattern_bytes(ms, p) + 8, plen - 8) == 0)
+                push_match(matches, pos, p);
+        }
+    }
+}
+
+// Bucket bits of the 32 positions starting at data: for each filtered prefix
+// byte k, the byte at position + k is looked up by its two nibbles.
+[[gnu::always_inline, gnu::target("avx2")]] static inline __m256i teddy_block(const struct multi_search *ms, const char *data)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i result = _mm256_set1_epi8((char)0xff);
+    for (size_t k = 0; k < ms->prefix_len; k++)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(data + k));
+        __m256i lo = _mm256_shuffle_epi8(_mm256_load_si256((const __m256i *)ms->lo_masks[k]), _mm256_and_si256(in, nibble));
+        __m256i hi = _mm256_shuffle_epi8(_mm256_load_si256((const __m256i *)ms->hi_masks[k]),
+                                         _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+        result = _mm256_and_si256(result, _mm256_and_si256(lo, hi));
+    }
+    return result;
+}
+
+[[gnu::target("avx2")]] static void teddy_candidates(const struct multi_search *ms, const char *haystack, size_t len, size_t base, __m256i buckets,
+                                                     struct search_matches *matches)
+{
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(buckets, _mm256_setzero_si256()));
+    if (mask == 0)
+        return;
+    alignas(32) uint8_t lanes[32];
+    _mm256_store_si256((__m256i *)lanes, buckets);
+    for (; mask; mask &= mask - 1)
+    {
+        unsigned lane = (unsigned)__builtin_ctz(mask);
+        size_t pos = base + lane;
+        if (pos + ms->min_len > len)
+            break;
+        teddy_verify(ms, haystack, len, pos, lanes[lane], matches);
+    }
+}
+
+[[gnu::target("avx2")]] static void teddy_search(const struct multi_search *ms, const char *haystack, size_t len, struct search_matches *matches)
+{
+    size_t reach = ms->prefix_len - 1 + 32;
+    size_t i = 0;
+    for (; i + reach <= len; i += 32)
+        teddy_candidates(ms, haystack, len, i, teddy_block(ms, haystack + i), matches);
+
+    // The tail is copied into a zero-padded block; positions past the end of
+    // the haystack are cut off by the length checks during verification.
+    if (i < len)
+    {
+        char tail[32 + MULTI_SEARCH_TEDDY_PREFIX] = {0};
+        memcpy(tail, haystack + i, len - i);
+        teddy_candidates(ms, haystack, len, i, teddy_block(ms, tail), matches);
+    }
+}
+
+// Offset of the first byte at or after pos that starts some pattern, or len.
+[[gnu::target("avx2")]] static size_t next_start(const struct multi_search *ms, const unsigned char *data, size_t pos, size_t len)
+{
+    const __m256i lo_table = _mm256_load_si256((const __m256i *)ms->start_lo);
+    const __m256i hi_table = _mm256_load_si256((const __m256i *)ms->start_hi);
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128,
+                                          1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i top = _mm256_set1_epi8((char)0x80);
+    for (; pos + 32 <= len; pos += 32)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(data + pos));
+        // pshufb yields zero for indices with the top bit set, which keeps the
+        // two tables apart without a blend.
+        __m256i row = _mm256_or_si256(_mm256_shuffle_epi8(lo_table, in),
+                                      _mm256_shuffle_epi8(hi_table, _mm256_xor_si256(in, top)));
+        __m256i bit = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+        __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), _mm256_setzero_si256());
+        uint32_t hits = ~(uint32_t)_mm256_movemask_epi8(miss);
+        if (hits)
+            return pos + (size_t)__builtin_ctz(hits);
+    }
+    for (; pos < len; pos++)
+        if (ms->delta[ms->classes[data[pos]]] != 0)
+            return pos;
+    return len;
+}
+
+static void aho_corasick_search(const struct multi_search *ms, const char *haystack, size_t len, struct search_matches *matches)
+{
+    const unsigned char *data = (const unsigned char *)haystack;
+    const uint32_t *delta = ms->delta;
+    const uint8_t *byte_class = ms->classes;
+    size_t classes = ms->class_count;
+    uint32_t row = 0;
+    size_t resume = ms->prefilter ? 0 : SIZE_MAX;
+    size_t scans = 0;
+    size_t skipped = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        // Tested first: being at the root is a coin flip on dense text and
+        // must not cost a mispredicted branch per byte while the scan is off.
+        if (i >= resume && row == 0)
+        {
+            size_t next = next_start(ms, data, i, len);
+            if (next == len)
+                break;
+            skipped += next - i;
+            i = next;
+            // Text dense in start bytes leaves the root after a byte or two,
+            // where the plain automaton is faster; pause the scan for a while.
+            if (++scans == MULTI_SEARCH_PREFILTER_WINDOW)
+            {
+                if (skipped < MULTI_SEARCH_PREFILTER_WINDOW * MULTI_SEARCH_PREFILTER_SKIP)
+                    resume = i + MULTI_SEARCH_PREFILTER_BACKOFF;
+                scans = 0;
+                skipped = 0;
+            }
+        }
+        uint32_t next = delta[row + byte_class[data[i]]];
+        row = next & ~MULTI_SEARCH_OUTPUT_FLAG;
+        if (!(next & MULTI_SEARCH_OUTPUT_FLAG))
+            continue;
+        long s = (long)(row / classes);
+        for (long t = ms->node_match[s] >= 0 ? s : ms->out_link[s]; t >= 0; t = ms->out_link[t])
+            for (long p = ms->node_match[t]; p >= 0; p = ms->pattern_next[p])
+                push_match(matches, i + 1 - ms->lengths[p], (size_t)p);
+    }
+}
+
+void multi_search_all(const struct multi_search *ms, const char *haystack, size_t len, struct search_matches *matches)
+{
+    matches->count = 0;
+    if (ms->count == 0 || len < ms->min_len)
+        return;
+    if (ms->engine == MULTI_SEARCH_TEDDY)
+        teddy_search(ms, haystack, len, matches);
+    else
+        aho_corasick_search(ms, haystack, len, matches);
+
+    // Teddy emits in offset order already, and the automaton mostly does for
+    // patterns of similar length, so the sort is usually skipped.
+    for (size_t i = 1; i < matches->count; i++)
+        if (compare_matches(&matches->items[i - 1], &matches->items[i]) > 0)
+        {
+            qsort(matches->items, matches->count, sizeof(matches->items[0]), compare_matches);
+            break;
+        }
+}
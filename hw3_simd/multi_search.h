@@ -0,0 +1,94 @@
+#ifndef MULTI_SEARCH_H
+#define MULTI_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Teddy handles small pattern sets; beyond this the eight buckets get so
+// crowded that nearly every position is a candidate and Aho-Corasick wins.
+#define MULTI_SEARCH_TEDDY_MAX 48
+#define MULTI_SEARCH_TEDDY_BUCKETS 8
+// Teddy filters on up to this many leading bytes of every pattern.
+#define MULTI_SEARCH_TEDDY_PREFIX 3
+// The automaton skips runs at its root with a SIMD byte-set scan only when
+// patterns start with at most this many distinct bytes. If a window of scans
+// skips fewer than PREFILTER_SKIP bytes on average, the scan pauses for the
+// next PREFILTER_BACKOFF bytes.
+#define MULTI_SEARCH_PREFILTER_BYTES 16
+#define MULTI_SEARCH_PREFILTER_WINDOW 32
+#define MULTI_SEARCH_PREFILTER_SKIP 8
+#define MULTI_SEARCH_PREFILTER_BACKOFF 4096
+// Set in a transition whose target state reports matches.
+#define MULTI_SEARCH_OUTPUT_FLAG 0x80000000u
+
+enum multi_search_engine
+{
+    MULTI_SEARCH_TEDDY,
+    MULTI_SEARCH_AHO_CORASICK
+};
+
+struct search_match
+{
+    size_t offset;
+    size_t pattern;
+};
+
+struct search_matches
+{
+    struct search_match *items;
+    size_t count;
+    size_t capacity;
+};
+
+struct multi_search
+{
+    enum multi_search_engine engine;
+    size_t count;
+    size_t min_len;
+    char *bytes;
+    size_t *offsets;
+    size_t *lengths;
+
+    // Teddy: for prefix byte k, lo_masks[k][c & 15] & hi_masks[k][c >> 4] has
+    // bit b set when some pattern of bucket b can have c at position k. Tables
+    // are repeated in both 128-bit lanes for pshufb.
+    size_t prefix_len;
+    alignas(32) uint8_t lo_masks[MULTI_SEARCH_TEDDY_PREFIX][32];
+    alignas(32) uint8_t hi_masks[MULTI_SEARCH_TEDDY_PREFIX][32];
+    size_t bucket_start[MULTI_SEARCH_TEDDY_BUCKETS + 1];
+    size_t *bucket_patterns;
+    // First min(len, 8) bytes as a little-endian word, checked before memcmp.
+    uint64_t *prefix_words;
+    uint64_t *prefix_masks;
+
+    // Aho-Corasick: dense transitions over byte classes, with failure links
+    // already folded in; each entry is the target's row offset plus the output
+    // flag. Every state lists the patterns ending there through
+    // node_match/pattern_next and the next matching suffix state in out_link.
+    size_t state_count;
+    size_t class_count;
+    uint8_t classes[256];
+    uint32_t *delta;
+    long *node_match;
+    long *pattern_next;
+    long *out_link;
+    // Exact membership of the first pattern bytes: bit (c >> 4) & 7 of
+    // start_lo[c & 15] for c < 128, of start_hi[c & 15] otherwise.
+    bool prefilter;
+    alignas(32) uint8_t start_lo[32];
+    alignas(32) uint8_t start_hi[32];
+};
+
+// Patterns are copied; an empty pattern is an error.
+void multi_search_init(struct multi_search *ms, const char *const *patterns, const size_t *lengths, size_t count);
+void multi_search_free(struct multi_search *ms);
+
+void search_matches_init(struct search_matches *matches);
+void search_matches_free(struct search_matches *matches);
+
+// Replaces the contents of matches with every occurrence of every pattern,
+// overlapping ones included, ordered by offset and then pattern index.
+void multi_search_all(const struct multi_search *ms, const char *haystack, size_t len, struct search_matches *matches);
+
+#endif // MULTI_SEARCH_H
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+
+#include "parallel_search.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "search.h"
+#include "../core/util.h"
+
+struct first_job
+{
+    const char *haystack;
+    const char *needle;
+    size_t needle_len;
+    size_t starts;
+    atomic_size_t best;
+};
+
+struct all_job
+{
+    const char *haystack;
+    const char *needle;
+    size_t needle_len;
+    size_t starts;
+    struct search_offsets *parts;
+};
+
+void mapped_file_open(struct mapped_file *file, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        die("mapped_file_open: cannot open file");
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        die("mapped_file_open: cannot stat file");
+
+    file->data = nullptr;
+    file->size = (size_t)st.st_size;
+    if (file->size == 0)
+    {
+        close(fd);
+        return;
+    }
+    void *mapping = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        die("mapped_file_open: mmap failed");
+
+    // Hints only: kernels without file-backed huge pages reject the second one.
+    madvise(mapping, file->size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(mapping, file->size, MADV_HUGEPAGE);
+#endif
+    file->data = mapping;
+}
+
+void mapped_file_close(struct mapped_file *file)
+{
+    if (file->data != nullptr)
+        munmap((void *)file->data, file->size);
+    file->data = nullptr;
+    file->size = 0;
+}
+
+void search_offsets_init(struct search_offsets *offsets)
+{
+    offsets->items = nullptr;
+    offsets->count = 0;
+    offsets->capacity = 0;
+}
+
+void search_offsets_free(struct search_offsets *offsets)
+{
+    free(offsets->items);
+    search_offsets_init(offsets);
+}
+
+static void push_offset(struct search_offsets *offsets, size_t offset)
+{
+    if (offsets->count == offsets->capacity)
+    {
+        offsets->capacity = offsets->capacity ? offsets->capacity * 2 : 64;
+        offsets->items = resize(offsets->items, size_t, offsets->capacity);
+    }
+    offsets->items[offsets->count++] = offset;
+}
+
+static size_t chunk_count(size_t starts)
+{
+    return (starts + PARALLEL_SEARCH_CHUNK - 1) / PARALLEL_SEARCH_CHUNK;
+}
+
+static size_t chunk_end(size_t chunk, size_t starts)
+{
+    size_t end = (chunk + 1) * (size_t)PARALLEL_SEARCH_CHUNK;
+    return end < starts ? end : starts;
+}
+
+static void first_chunks(void *arg, long begin, long end)
+{
+    struct first_job *job = arg;
+    for (long c = begin; c < end; c++)
+    {
+        size_t lo = (size_t)c * PARALLEL_SEARCH_CHUNK;
+        if (atomic_load_explicit(&job->best, memory_order_relaxed) < lo)
+            return;
+        size_t hi = chunk_end((size_t)c, job->starts);
+        long found = search_pair(job->haystack + lo, hi - lo + job->needle_len - 1, job->needle, job->needle_len);
+        if (found < 0)
+            continue;
+
+        size_t pos = lo + (size_t)found;
+        size_t best = atomic_load_explicit(&job->best, memory_order_relaxed);
+        while (pos < best &&
+               !atomic_compare_exchange_weak_explicit(&job->best, &best, pos, memory_order_relaxed, memory_order_relaxed))
+            ;
+        return;
+    }
+}
+
+long parallel_search_first(const char *haystack, size_t len, const char *needle, size_t needle_len,
+                           struct task_sched *sched)
+{
+    if (needle_len == 0)
+        return 0;
+    if (needle_len > len)
+        return -1;
+
+    struct first_job job = {
+        .haystack = haystack,
+        .needle = needle,
+        .needle_len = needle_len,
+        .starts = len - needle_len + 1,
+    };
+    atomic_init(&job.best, SIZE_MAX);
+    size_t chunks = chunk_count(job.starts);
+
+    if (sched == nullptr || chunks == 1)
+        first_chunks(&job, 0, (long)chunks);
+    else
+        parallel_for_range(sched, 0, (long)chunks, first_chunks, &job, PARALLEL_SCHEDULE_DYNAMIC, 1);
+
+    size_t best = atomic_load(&job.best);
+    return best == SIZE_MAX ? -1 : (long)best;
+}
+
+static void all_chunks(void *arg, long begin, long end)
+{
+    struct all_job *job = arg;
+    for (long c = begin; c < end; c++)
+    {
+        struct search_offsets *part = &job->parts[c];
+        size_t hi = chunk_end((size_t)c, job->starts);
+        for (size_t start = (size_t)c * PARALLEL_SEARCH_CHUNK; start < hi;)
+        {
+            long found = search_pair(job->haystack + start, hi - start + job->needle_len - 1, job->needle,
+                                     job->needle_len);
+            if (found < 0)
+                break;
+            push_offset(part, start + (size_t)found);
+            start += (size_t)found + 1;
+        }
+    }
+}
+
+void parallel_search_all(const char *haystack, size_t len, const char *needle, size_t needle_len,
+                         struct task_sched *sched, struct search_offsets *offsets)
+{
+    offsets->count = 0;
+    if (needle_len > len)
+        return;
+
+    struct all_job job = {
+        .haystack = haystack,
+        .needle = needle,
+        .needle_len = needle_len,
+        .starts = len - needle_len + 1,
+    };
+    size_t chunks = chunk_count(job.starts);
+    job.parts = newarr(struct search_offsets, chunks);
+    for (size_t c = 0; c < chunks; c++)
+        search_offsets_init(&job.parts[c]);
+
+    if (sched == nullptr || chunks == 1)
+        all_chunks(&job, 0, (long)chunks);
+    else
+        parallel_for_range(sched, 0, (long)chunks, all_chunks, &job, PARALLEL_SCHEDULE_DYNAMIC, 1);
+
+    size_t total = 0;
+    for (size_t c = 0; c < chunks; c++)
+        total += job.parts[c].count;
+    if (total > offsets->capacity)
+    {
+        offsets->capacity = total;
+        offsets->items = resize(offsets->items, size_t, total);
+    }
+    for (size_t c = 0; c < chunks; c++)
+    {
+        if (job.parts[c].count != 0)
+            memcpy(offsets->items + offsets->count, job.parts[c].items, job.parts[c].count * sizeof(size_t));
+        offsets->count += job.parts[c].count;
+        search_offsets_free(&job.parts[c]);
+    }
+    free(job.parts);
+}
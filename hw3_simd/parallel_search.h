@@ -0,0 +1,44 @@
+#ifndef PARALLEL_SEARCH_H
+#define PARALLEL_SEARCH_H
+
+#include <stddef.h>
+
+#include "../hw6_parallel_for/tasks.h"
+
+// Match starts per task. Chunks are claimed in file order, so once a match is
+// known every chunk after it is skipped without being read.
+#define PARALLEL_SEARCH_CHUNK (1 << 20)
+
+struct mapped_file
+{
+    const char *data;
+    size_t size;
+};
+
+struct search_offsets
+{
+    size_t *items;
+    size_t count;
+    size_t capacity;
+};
+
+// Maps path read-only and hints sequential access (and huge pages where the
+// kernel has them); dies if the file cannot be opened or mapped.
+void mapped_file_open(struct mapped_file *file, const char *path);
+void mapped_file_close(struct mapped_file *file);
+
+void search_offsets_init(struct search_offsets *offsets);
+void search_offsets_free(struct search_offsets *offsets);
+
+// Chunks overlap by needle_len - 1 bytes so a match across a chunk boundary
+// belongs to the chunk it starts in. Runs on the calling thread when sched is
+// nullptr.
+long parallel_search_first(const char *haystack, size_t len, const char *needle, size_t needle_len,
+                           struct task_sched *sched);
+
+// Replaces the contents of offsets with the start of every occurrence,
+// overlapping ones included, in increasing order.
+void parallel_search_all(const char *haystack, size_t len, const char *needle, size_t needle_len,
+                         struct task_sched *sched, struct search_offsets *offsets);
+
+#endif // PARALLEL_SEARCH_H
@@ -0,0 +1,411 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "search.h"
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../core/cpu.h"
+
+// Lower is rarer in ordinary text: control and non-ASCII bytes 0, punctuation
+// and tab/newline 1, capitals and digits 2, jkqxz 3, other letters 4, etaoinsh
+// 5, space 6.
+static const unsigned char byte_rank[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    6, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1,
+    1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1,
+    1, 5, 4, 4, 4, 5, 4, 4, 5, 5, 3, 3, 4, 4, 5, 5,
+    4, 3, 4, 5, 5, 4, 4, 4, 3, 4, 3, 1, 1, 1, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// Rarest byte scanning forward and rarest of the rest scanning backward, so a
+// needle of uniformly ranked bytes gets its first and last byte.
+static void pick_pair(const unsigned char *needle, size_t needle_len, size_t *first, size_t *second)
+{
+    size_t a = 0;
+    for (size_t i = 1; i < needle_len; i++)
+        if (byte_rank[needle[i]] < byte_rank[needle[a]])
+            a = i;
+    size_t b = a == needle_len - 1 ? 0 : needle_len - 1;
+    for (size_t i = needle_len - 1; i-- > 0;)
+        if (i != a && byte_rank[needle[i]] < byte_rank[needle[b]])
+            b = i;
+    *first = a;
+    *second = b;
+}
+
+// Rest of the haystack from start, for the pair filters once verification has
+// done too much work.
+static long pair_two_way(const char *haystack, size_t hay_len, size_t start, const char *needle, size_t needle_len)
+{
+    long found = search_two_way(haystack + start, hay_len - start, needle, needle_len);
+    return found < 0 ? -1 : (long)start + found;
+}
+
+static long pair_tail(const char *haystack, size_t hay_len, size_t start, const char *needle, size_t needle_len,
+                      size_t i1, size_t i2)
+{
+    for (size_t i = start; i + needle_len <= hay_len; i++)
+        if (haystack[i + i1] == needle[i1] && haystack[i + i2] == needle[i2] &&
+            memcmp(haystack + i, needle, needle_len) == 0)
+            return (long)i;
+    return -1;
+}
+
+// equal_avx2 at 16 bytes.
+[[gnu::target("sse4.2")]] static bool equal_sse42(const char *hay, const char *needle, const char *padded, size_t needle_len, size_t *work)
+{
+    if (needle_len < 16)
+    {
+        __m128i h = _mm_loadu_si128((const __m128i *)hay);
+        __m128i n = _mm_loadu_si128((const __m128i *)padded);
+        uint32_t eq = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(h, n));
+        uint32_t want = (UINT32_C(1) << needle_len) - 1;
+        *work += 16;
+        return (eq & want) == want;
+    }
+    size_t k = 0;
+    for (; k + 16 < needle_len; k += 16)
+    {
+        __m128i h = _mm_loadu_si128((const __m128i *)(hay + k));
+        __m128i n = _mm_loadu_si128((const __m128i *)(needle + k));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(h, n)) != 0xffff)
+        {
+            *work += k + 16;
+            return false;
+        }
+    }
+    *work += needle_len;
+    k = needle_len - 16;
+    __m128i h = _mm_loadu_si128((const __m128i *)(hay + k));
+    __m128i n = _mm_loadu_si128((const __m128i *)(needle + k));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(h, n)) == 0xffff;
+}
+
+[[gnu::target("sse4.2")]] long search_pair_sse42(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+        return 0;
+    if (needle_len > hay_len)
+        return -1;
+    if (needle_len == 1)
+    {
+        const char *hit = memchr(haystack, needle[0], hay_len);
+        return hit == nullptr ? -1 : hit - haystack;
+    }
+
+    size_t i1, i2;
+    pick_pair((const unsigned char *)needle, needle_len, &i1, &i2);
+    size_t reach = (i1 > i2 ? i1 : i2) + 16;
+    char padded[16] = {0};
+    memcpy(padded, needle, needle_len < 16 ? needle_len : 16);
+    __m128i first = _mm_set1_epi8(needle[i1]);
+    __m128i second = _mm_set1_epi8(needle[i2]);
+    size_t last = hay_len - needle_len;
+    size_t verify_len = needle_len < 16 ? 16 : needle_len;
+    size_t work = 0;
+
+    size_t i = 0;
+    for (; i + reach <= hay_len; i += 16)
+    {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(haystack + i + i1)), first);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(haystack + i + i2)), second);
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(a, b));
+        for (; mask; mask &= mask - 1)
+        {
+            size_t pos = i + (size_t)__builtin_ctz(mask);
+            if (pos > last)
+                return -1;
+            bool equal = pos + verify_len <= hay_len
+                ? equal_sse42(haystack + pos, needle, padded, needle_len, &work)
+                : memcmp(haystack + pos, needle, needle_len) == 0;
+            if (equal)
+                return (long)pos;
+        }
+        if (work > SEARCH_PAIR_WORK_RATIO * i + SEARCH_PAIR_SLACK)
+            return pair_two_way(haystack, hay_len, i + 16, needle, needle_len);
+    }
+    return pair_tail(haystack, hay_len, i, needle, needle_len, i1, i2);
+}
+
+// Compares 32 bytes at a time with the last chunk overlapping the previous
+// one; needles shorter than 32 bytes come from a zero-padded copy and only
+// their low bits of the mask count. Reads 32 bytes of the haystack either way
+// and adds the bytes it compared to work.
+[[gnu::target("avx2")]] static bool equal_avx2(const char *hay, const char *needle, const char *padded, size_t needle_len, size_t *work)
+{
+    if (needle_len < 32)
+    {
+        __m256i h = _mm256_loadu_si256((const __m256i *)hay);
+        __m256i n = _mm256_loadu_si256((const __m256i *)padded);
+        uint32_t eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(h, n));
+        uint32_t want = (uint32_t)((UINT64_C(1) << needle_len) - 1);
+        *work += 32;
+        return (eq & want) == want;
+    }
+    size_t k = 0;
+    for (; k + 32 < needle_len; k += 32)
+    {
+        __m256i h = _mm256_loadu_si256((const __m256i *)(hay + k));
+        __m256i n = _mm256_loadu_si256((const __m256i *)(needle + k));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(h, n)) != UINT32_MAX)
+        {
+            *work += k + 32;
+            return false;
+        }
+    }
+    *work += needle_len;
+    k = needle_len - 32;
+    __m256i h = _mm256_loadu_si256((const __m256i *)(hay + k));
+    __m256i n = _mm256_loadu_si256((const __m256i *)(needle + k));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(h, n)) == UINT32_MAX;
+}
+
+[[gnu::target("avx2")]] long search_pair_avx2(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+        return 0;
+    if (needle_len > hay_len)
+        return -1;
+    if (needle_len == 1)
+    {
+        const char *hit = memchr(haystack, needle[0], hay_len);
+        return hit == nullptr ? -1 : hit - haystack;
+    }
+
+    size_t i1, i2;
+    pick_pair((const unsigned char *)needle, needle_len, &i1, &i2);
+    size_t reach = (i1 > i2 ? i1 : i2) + 32;
+    char padded[32] = {0};
+    memcpy(padded, needle, needle_len < 32 ? needle_len : 32);
+    __m256i first = _mm256_set1_epi8(needle[i1]);
+    __m256i second = _mm256_set1_epi8(needle[i2]);
+    size_t last = hay_len - needle_len;
+    size_t verify_len = needle_len < 32 ? 32 : needle_len;
+    size_t work = 0;
+
+    size_t i = 0;
+    for (; i + reach <= hay_len; i += 32)
+    {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(haystack + i + i1)), first);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(haystack + i + i2)), second);
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(a, b));
+        for (; mask; mask &= mask - 1)
+        {
+            size_t pos = i + (size_t)__builtin_ctz(mask);
+            if (pos > last)
+                return -1;
+            bool equal = pos + verify_len <= hay_len
+                ? equal_avx2(haystack + pos, needle, padded, needle_len, &work)
+                : memcmp(haystack + pos, needle, needle_len) == 0;
+            if (equal)
+                return (long)pos;
+        }
+        if (work > SEARCH_PAIR_WORK_RATIO * i + SEARCH_PAIR_SLACK)
+            return pair_two_way(haystack, hay_len, i + 32, needle, needle_len);
+    }
+    return pair_tail(haystack, hay_len, i, needle, needle_len, i1, i2);
+}
+
+// Masked loads never touch bytes past the needle, so there is no padded copy
+// and no haystack bound to check.
+[[gnu::target("avx512f,avx512bw")]] static bool equal_avx512(const char *hay, const char *needle, size_t needle_len, size_t *work)
+{
+    for (size_t k = 0; k < needle_len; k += 64)
+    {
+        size_t left = needle_len - k;
+        __mmask64 m = left >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << left) - 1;
+        __m512i h = _mm512_maskz_loadu_epi8(m, hay + k);
+        __m512i n = _mm512_maskz_loadu_epi8(m, needle + k);
+        if (_mm512_cmpneq_epi8_mask(h, n) != 0)
+        {
+            *work += k + 64;
+            return false;
+        }
+    }
+    *work += needle_len;
+    return true;
+}
+
+// 64 positions per step; the last step masks off positions past the end
+// instead of falling back to a scalar tail.
+[[gnu::target("avx512f,avx512bw")]] long search_pair_avx512(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+        return 0;
+    if (needle_len > hay_len)
+        return -1;
+    if (needle_len == 1)
+    {
+        const char *hit = memchr(haystack, needle[0], hay_len);
+        return hit == nullptr ? -1 : hit - haystack;
+    }
+
+    size_t i1, i2;
+    pick_pair((const unsigned char *)needle, needle_len, &i1, &i2);
+    __m512i first = _mm512_set1_epi8(needle[i1]);
+    __m512i second = _mm512_set1_epi8(needle[i2]);
+    size_t last = hay_len - needle_len;
+    size_t work = 0;
+
+    for (size_t i = 0; i <= last; i += 64)
+    {
+        size_t left = last - i + 1;
+        __mmask64 m = left >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << left) - 1;
+        __mmask64 a = _mm512_mask_cmpeq_epi8_mask(m, _mm512_maskz_loadu_epi8(m, haystack + i + i1), first);
+        uint64_t mask = _mm512_mask_cmpeq_epi8_mask(a, _mm512_maskz_loadu_epi8(m, haystack + i + i2), second);
+        for (; mask; mask &= mask - 1)
+        {
+            size_t pos = i + (size_t)__builtin_ctzll(mask);
+            if (equal_avx512(haystack + pos, needle, needle_len, &work))
+                return (long)pos;
+        }
+        if (work > SEARCH_PAIR_WORK_RATIO * i + SEARCH_PAIR_SLACK && i + 64 <= last)
+            return pair_two_way(haystack, hay_len, i + 64, needle, needle_len);
+    }
+    return -1;
+}
+
+static long (*pair_variant)(const char *, size_t, const char *, size_t) = search_two_way;
+
+[[gnu::constructor]] static void search_dispatch(void)
+{
+    switch (cpu_level())
+    {
+    case CPU_LEVEL_AVX512:
+        pair_variant = search_pair_avx512;
+        break;
+    case CPU_LEVEL_AVX2:
+        pair_variant = search_pair_avx2;
+        break;
+    case CPU_LEVEL_SSE42:
+        pair_variant = search_pair_sse42;
+        break;
+    default:
+        pair_variant = search_two_way;
+        break;
+    }
+}
+
+long search_pair(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+{
+    return pair_variant(haystack, hay_len, needle, needle_len);
+}
+
+// Start of the maximal suffix of needle under the byte order (reversed when
+// greater is false) and the period of that suffix.
+static size_t maximal_suffix(const unsigned char *needle, size_t needle_len, bool greater, size_t *period)
+{
+    size_t start = 0;
+    size_t j = 1;
+    size_t k = 0;
+    size_t p = 1;
+    while (j + k < needle_len)
+    {
+        unsigned char a = needle[start + k];
+        unsigned char b = needle[j + k];
+        if (a == b)
+        {
+            if (++k == p)
+            {
+                j += p;
+                k = 0;
+            }
+        }
+        else if ((b < a) == greater)
+        {
+            j += k + 1;
+            k = 0;
+            p = j - start;
+        }
+        else
+        {
+            start = j++;
+            k = 0;
+            p = 1;
+        }
+    }
+    *period = p;
+    return start;
+}
+
+long search_two_way(const char *haystack, size_t hay_len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+        return 0;
+    if (needle_len > hay_len)
+        return -1;
+
+    const unsigned char *h = (const unsigned char *)haystack;
+    const unsigned char *n = (const unsigned char *)needle;
+    size_t shift[256];
+    for (size_t c = 0; c < 256; c++)
+        shift[c] = needle_len;
+    for (size_t i = 0; i < needle_len; i++)
+        shift[n[i]] = needle_len - 1 - i;
+
+    // Critical factorization: the later of the two maximal suffixes.
+    size_t p1, p2;
+    size_t s1 = maximal_suffix(n, needle_len, true, &p1);
+    size_t s2 = maximal_suffix(n, needle_len, false, &p2);
+    size_t split = s1 > s2 ? s1 : s2;
+    size_t period = s1 > s2 ? p1 : p2;
+
+    // A periodic needle remembers how much of its prefix already matched after
+    // a shift by the period; otherwise the shift can skip past either half.
+    size_t memory_after_shift;
+    if (memcmp(n, n + period, split) == 0)
+    {
+        memory_after_shift = needle_len - period;
+    }
+    else
+    {
+        memory_after_shift = 0;
+        period = (split > needle_len - split ? split : needle_len - split) + 1;
+    }
+
+    size_t memory = 0;
+    size_t pos = 0;
+    while (pos + needle_len <= hay_len)
+    {
+        size_t skip = shift[h[pos + needle_len - 1]];
+        if (skip != 0)
+        {
+            pos += skip < memory ? memory : skip;
+            memory = 0;
+            continue;
+        }
+
+        size_t k = split > memory ? split : memory;
+        while (k < needle_len - 1 && n[k] == h[pos + k])
+            k++;
+        if (k < needle_len - 1)
+        {
+            pos += k - split + 1;
+            memory = 0;
+            continue;
+        }
+
+        k = split;
+        while (k > memory && n[k - 1] == h[pos + k - 1])
+            k--;
+        if (k <= memory)
+            return (long)pos;
+        pos += period;
+        memory = memory_after_shift;
+    }
+    return -1;
+}
@@ -0,0 +1,32 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+// The pair filter hands the rest of the haystack to Two-Way once verification
+// has compared more than SEARCH_PAIR_WORK_RATIO bytes per scanned byte, plus
+// SEARCH_PAIR_SLACK bytes of grace. Verification cost is what grows with the
+// needle length, so this is also the long-needle fallback, and it bounds
+// adversarial inputs to linear time.
+#define SEARCH_PAIR_WORK_RATIO 2
+#define SEARCH_PAIR_SLACK 4096
+
+// First occurrence of needle, or -1. Candidates must match two needle bytes at
+// once, the two rarest by a static text frequency ranking (first and last when
+// they tie), and are verified with 32-byte compares.
+long search_pair_avx2(const char *haystack, size_t hay_len, const char *needle, size_t needle_len);
+
+// The same filter 16 and 64 positions at a time. The AVX-512 one needs the BW
+// subset and verifies with masked compares.
+long search_pair_sse42(const char *haystack, size_t hay_len, const char *needle, size_t needle_len);
+long search_pair_avx512(const char *haystack, size_t hay_len, const char *needle, size_t needle_len);
+
+// The widest pair filter the CPU runs, bound at startup; plain Two-Way below
+// SSE4.2.
+long search_pair(const char *haystack, size_t hay_len, const char *needle, size_t needle_len);
+
+// Crochemore-Perrin Two-Way with a last-byte shift table: linear time in the
+// worst case, constant extra space.
+long search_two_way(const char *haystack, size_t hay_len, const char *needle, size_t needle_len);
+
+#endif // SEARCH_H
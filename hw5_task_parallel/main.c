@@ -7,28 +7,50 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
 #include <unistd.h>
 
+#include "prime_index.h"
+#include "sieve.h"
+#include "telemetry.h"
 #include "../core/util.h"
 
+#define TASK_CHUNK_COST 16.0
+
 struct job {
     size_t id;
     unsigned long long limit;
     size_t pending;
     size_t result;
     pthread_mutex_t mutex;
+    struct prime_index *index;
+    size_t first_interval;
+    size_t interval_count;
+    unsigned long long *interval_counts;
+    struct task_node *task_head;
+    struct task_node *task_tail;
+    struct job *next;
+    size_t task_count;
+    uint64_t queued_ns;
+    uint64_t wait_ns;
+    uint64_t compute_ns;
 };
 
 struct task_node {
     struct job *job;
+    const struct base_primes *base;
     unsigned long long start;
     unsigned long long end;
+    unsigned long long *interval_counts;
     struct task_node *next;
 };
 
+// Round-robin ring of jobs that still have queued tasks. Each pop takes one task
+// from the front job and moves that job to the back, so a small job submitted
+// behind a large one waits for at most one task per active job.
 struct queue {
-    struct task_node *head;
-    struct task_node *tail;
+    struct job *head;
+    struct job *tail;
     bool shutdown;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
@@ -51,53 +73,73 @@ static void queue_destroy(struct queue *queue)
     pthread_cond_destroy(&queue->cond);
 }
 
-static void queue_push(struct queue *queue, struct task_node *node)
+static void job_push_task(struct job *job, struct task_node *node)
 {
     node->next = NULL;
+    if (job->task_tail == NULL) {
+        job->task_head = node;
+        job->task_tail = node;
+    } else {
+        job->task_tail->next = node;
+        job->task_tail = node;
+    }
+}
+
+static void queue_push_job(struct queue *queue, struct job *job)
+{
+    job->next = NULL;
     if (queue->tail == NULL) {
-        queue->head = node;
-        queue->tail = node;
+        queue->head = job;
+        queue->tail = job;
     } else {
-        queue->tail->next = node;
-        queue->tail = node;
+        queue->tail->next = job;
+        queue->tail = job;
     }
 }
 
 static struct task_node *queue_pop(struct queue *queue)
 {
-    struct task_node *node = queue->head;
-    if (node != NULL) {
-        queue->head = node->next;
-        if (queue->head == NULL)
-            queue->tail = NULL;
-    }
+    struct job *job = queue->head;
+    if (job == NULL)
+        return NULL;
+    queue->head = job->next;
+    if (queue->head == NULL)
+        queue->tail = NULL;
+    struct task_node *node = job->task_head;
+    job->task_head = node->next;
+    if (job->task_head == NULL)
+        job->task_tail = NULL;
+    else
+        queue_push_job(queue, job);
     return node;
 }
 
-static size_t count_primes_range(unsigned long long start, unsigned long long end)
+// Whole-interval tasks record each checkpoint interval separately so the finished
+// job can extend the prefix-count index.
+static size_t run_task(const struct task_node *task)
 {
-    if (end < 2 || start > end)
-        return 0;
+    if (task->interval_counts == NULL)
+        return sieve_count_range(task->base, task->start, task->end);
+
     size_t total = 0;
-    if (start < 2)
-        start = 2;
-    for (unsigned long long value = start; value <= end; value++) {
-        bool prime = true;
-        for (unsigned long long divisor = 2; divisor <= value / divisor; divisor++) {
-            if (value % divisor == 0) {
-                prime = false;
-                break;
-            }
-        }
-        if (prime)
-            total++;
+    size_t i = 0;
+    for (unsigned long long lo = task->start; lo <= task->end; lo += PRIME_INDEX_INTERVAL) {
+        size_t primes = sieve_count_range(task->base, lo, lo + PRIME_INDEX_INTERVAL - 1);
+        task->interval_counts[i++] = primes;
+        total += primes;
     }
     return total;
 }
 
+struct worker {
+    struct queue *queue;
+    struct telemetry_worker *telemetry;
+};
+
 static void *worker_run(void *arg)
 {
-    struct queue *queue = arg;
+    struct worker *worker = arg;
+    struct queue *queue = worker->queue;
     for (;;) {
         pthread_mutex_lock(&queue->mutex);
         while (!queue->shutdown && queue->head == NULL)
@@ -109,21 +151,38 @@ static void *worker_run(void *arg)
         struct task_node *task = queue_pop(queue);
         pthread_mutex_unlock(&queue->mutex);
         if (task != NULL) {
+            uint64_t dequeued = telemetry_now();
             struct job *job = task->job;
-            size_t primes = count_primes_range(task->start, task->end);
+            size_t primes = run_task(task);
             free(task);
+            uint64_t finished = telemetry_now();
+            telemetry_task(worker->telemetry, job->queued_ns, dequeued, finished);
             pthread_mutex_lock(&job->mutex);
             job->result += primes;
             job->pending--;
+            job->wait_ns += dequeued - job->queued_ns;
+            job->compute_ns += finished - dequeued;
             bool done = job->pending == 0;
             size_t total = job->result;
             size_t id = job->id;
             unsigned long long limit = job->limit;
             pthread_mutex_unlock(&job->mutex);
             if (done) {
+                struct job_record record = {
+                    .id = id,
+                    .limit = limit,
+                    .tasks = job->task_count,
+                    .latency_ns = finished - job->queued_ns,
+                    .wait_ns = job->wait_ns,
+                    .compute_ns = job->compute_ns,
+                };
+                telemetry_job(worker->telemetry, &record);
+                if (job->interval_count != 0)
+                    prime_index_extend(job->index, job->first_interval, job->interval_count, job->interval_counts);
                 printf("task %zu completed: %zu primes <= %llu\n", id, total, limit);
                 fflush(stdout);
                 pthread_mutex_destroy(&job->mutex);
+                free(job->interval_counts);
                 free(job);
             }
         }
@@ -148,6 +207,20 @@ static bool is_exit_token(const char *text)
     return false;
 }
 
+static void record_inline_job(struct telemetry *telemetry, size_t id, unsigned long long limit, uint64_t started)
+{
+    uint64_t finished = telemetry_now();
+    struct job_record record = {
+        .id = id,
+        .limit = limit,
+        .tasks = 0,
+        .latency_ns = finished - started,
+        .wait_ns = 0,
+        .compute_ns = finished - started,
+    };
+    telemetry_inline_job(telemetry, &record);
+}
+
 static unsigned long long parse_limit(const char *text, bool *ok)
 {
     *ok = false;
@@ -170,16 +243,56 @@ static unsigned long long parse_limit(const char *text, bool *ok)
     return value;
 }
 
-int main(void)
+// Sieving cost per number grows with the number of sieving primes, roughly
+// ln ln sqrt(n), so chunks get fewer intervals as the values grow.
+static size_t chunk_intervals(unsigned long long value)
+{
+    double weight = log(log((double)value) / 2.0);
+    if (weight < 1.0)
+        weight = 1.0;
+    size_t intervals = (size_t)(TASK_CHUNK_COST / weight + 0.5);
+    return intervals == 0 ? 1 : intervals;
+}
+
+static struct task_node *make_task(struct job *job,
+                                   const struct base_primes *base,
+                                   unsigned long long start,
+                                   unsigned long long end,
+                                   unsigned long long *interval_counts)
+{
+    struct task_node *task = new(struct task_node);
+    task->job = job;
+    task->base = base;
+    task->start = start;
+    task->end = end;
+    task->interval_counts = interval_counts;
+    job->pending++;
+    job->task_count++;
+    job_push_task(job, task);
+    return task;
+}
+
+int main(int argc, char **argv)
 {
     size_t workers = 8;
+    const char *index_path = argc > 1 ? argv[1] : NULL;
+    struct prime_index index;
+    prime_index_init(&index);
+    if (index_path != NULL)
+        prime_index_load(&index, index_path);
     struct queue queue;
     queue_init(&queue);
+    struct telemetry telemetry;
+    telemetry_init(&telemetry, workers);
     pthread_t *threads = newarr(pthread_t, workers);
+    struct worker *worker_ctx = newarr(struct worker, workers);
     for (size_t i = 0; i < workers; i++) {
-        if (pthread_create(&threads[i], NULL, worker_run, &queue) != 0)
+        worker_ctx[i].queue = &queue;
+        worker_ctx[i].telemetry = &telemetry.per_worker[i];
+        if (pthread_create(&threads[i], NULL, worker_run, &worker_ctx[i]) != 0)
             die("pthread_create failed");
     }
+    struct base_primes *base_table = NULL;
     size_t next_id = 1;
     char buffer[256];
     for (;;) {
@@ -197,6 +310,11 @@ int main(void)
             continue;
         if (is_exit_token(line))
             break;
+        if (strcmp(line, "stats") == 0) {
+            telemetry_print(&telemetry, stdout);
+            continue;
+        }
+        uint64_t started = telemetry_now();
         bool ok = false;
         unsigned long long limit = parse_limit(line, &ok);
         if (!ok) {
@@ -209,44 +327,52 @@ int main(void)
             printf("task %zu created for %llu\n", id, limit);
             printf("task %zu completed: 0 primes <= %llu\n", id, limit);
             fflush(stdout);
+            record_inline_job(&telemetry, id, limit, started);
+            continue;
+        }
+        base_table = base_primes_ensure(base_table, isqrt_ull(limit));
+        unsigned long long known = 0;
+        size_t checkpoint = prime_index_lookup(&index, limit, &known);
+        size_t target = (size_t)(limit / PRIME_INDEX_INTERVAL);
+        unsigned long long tail_start = (unsigned long long)target * PRIME_INDEX_INTERVAL + 1;
+        if (checkpoint == target) {
+            size_t total = known + sieve_count_range(base_table, tail_start, limit);
+            printf("task %zu created for %llu\n", id, limit);
+            printf("task %zu completed: %zu primes <= %llu\n", id, total, limit);
+            fflush(stdout);
+            record_inline_job(&telemetry, id, limit, started);
             continue;
         }
         struct job *job = new(struct job);
         job->id = id;
         job->limit = limit;
         job->pending = 0;
-        job->result = 0;
+        job->result = known;
+        job->index = &index;
+        job->first_interval = checkpoint;
+        job->interval_count = target - checkpoint;
+        job->interval_counts = newarr(unsigned long long, job->interval_count);
         if (pthread_mutex_init(&job->mutex, NULL) != 0)
             die("mutex init failed");
-        pthread_mutex_lock(&queue.mutex);
-        size_t segments = workers;
-        if (segments == 0)
-            segments = 1;
-        unsigned long long numbers = limit - 1;
-        unsigned long long base = numbers / segments;
-        unsigned long long extra = numbers % segments;
-        unsigned long long start = 2;
-        for (size_t i = 0; i < segments; i++) {
-            unsigned long long chunk = base + (i < extra ? 1 : 0);
-            if (chunk == 0)
-                continue;
-            struct task_node *task = new(struct task_node);
-            task->job = job;
-            task->start = start;
-            task->end = start + chunk - 1;
-            start = task->end + 1;
-            queue_push(&queue, task);
-            job->pending++;
-        }
-        if (job->pending == 0) {
-            pthread_mutex_unlock(&queue.mutex);
-            pthread_mutex_destroy(&job->mutex);
-            free(job);
-            printf("task %zu created for %llu\n", id, limit);
-            printf("task %zu completed: 0 primes <= %llu\n", id, limit);
-            fflush(stdout);
-            continue;
+        job->task_head = NULL;
+        job->task_tail = NULL;
+        job->task_count = 0;
+        job->wait_ns = 0;
+        job->compute_ns = 0;
+        for (size_t interval = checkpoint; interval < target;) {
+            size_t chunk = chunk_intervals((unsigned long long)interval * PRIME_INDEX_INTERVAL + 1);
+            if (chunk > target - interval)
+                chunk = target - interval;
+            unsigned long long start = (unsigned long long)interval * PRIME_INDEX_INTERVAL + 1;
+            unsigned long long end = (unsigned long long)(interval + chunk) * PRIME_INDEX_INTERVAL;
+            make_task(job, base_table, start, end, job->interval_counts + (interval - checkpoint));
+            interval += chunk;
         }
+        if (tail_start <= limit)
+            make_task(job, base_table, tail_start, limit, NULL);
+        pthread_mutex_lock(&queue.mutex);
+        job->queued_ns = telemetry_now();
+        queue_push_job(&queue, job);
         printf("task %zu created for %llu\n", id, limit);
         fflush(stdout);
         pthread_cond_broadcast(&queue.cond);
@@ -259,6 +385,12 @@ int main(void)
     for (size_t i = 0; i < workers; i++)
         pthread_join(threads[i], NULL);
     queue_destroy(&queue);
+    telemetry_destroy(&telemetry);
+    if (index_path != NULL && !prime_index_save(&index, index_path))
+        fprintf(stderr, "error: failed to save prime index to %s\n", index_path);
+    prime_index_destroy(&index);
+    base_primes_free(base_table);
     free(threads);
+    free(worker_ctx);
     return 0;
 }
@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "prime_index.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../core/util.h"
+
+#define PRIME_INDEX_MAGIC 0x3130584449504dull
+#define PRIME_INDEX_HEADER_WORDS 3
+
+void prime_index_init(struct prime_index *index)
+{
+    if (pthread_mutex_init(&index->mutex, NULL) != 0)
+        die("mutex init failed");
+    index->mapped = NULL;
+    index->mapped_len = 0;
+    index->mapping = NULL;
+    index->mapping_size = 0;
+    index->grown_cap = 64;
+    index->grown = newarr(unsigned long long, index->grown_cap);
+    index->grown[0] = 0;
+    index->grown_len = 1;
+}
+
+void prime_index_destroy(struct prime_index *index)
+{
+    if (index->mapping != NULL)
+        munmap(index->mapping, index->mapping_size);
+    free(index->grown);
+    pthread_mutex_destroy(&index->mutex);
+}
+
+static size_t prime_index_len(const struct prime_index *index)
+{
+    return index->mapped_len + index->grown_len;
+}
+
+static unsigned long long prime_index_at(const struct prime_index *index, size_t i)
+{
+    return i < index->mapped_len
+        ? index->mapped[i]
+        : index->grown[i - index->mapped_len];
+}
+
+// File layout: magic, interval, checkpoint count, then the checkpoints, all as
+// native 64-bit words. Only meant to be read back on the machine that wrote it.
+bool prime_index_load(struct prime_index *index, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < PRIME_INDEX_HEADER_WORDS * sizeof(uint64_t)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const uint64_t *words = mapping;
+    size_t len = (size_t)words[2];
+    if (words[0] != PRIME_INDEX_MAGIC
+        || words[1] != PRIME_INDEX_INTERVAL
+        || len == 0
+        || size != (PRIME_INDEX_HEADER_WORDS + len) * sizeof(uint64_t)
+        || words[PRIME_INDEX_HEADER_WORDS] != 0) {
+        munmap(mapping, size);
+        return false;
+    }
+
+    pthread_mutex_lock(&index->mutex);
+    if (len <= prime_index_len(index)) {
+        pthread_mutex_unlock(&index->mutex);
+        munmap(mapping, size);
+        return true;
+    }
+    if (index->mapping != NULL)
+        munmap(index->mapping, index->mapping_size);
+    index->mapping = mapping;
+    index->mapping_size = size;
+    index->mapped = (const unsigned long long *)(words + PRIME_INDEX_HEADER_WORDS);
+    index->mapped_len = len;
+    index->grown_len = 0;
+    pthread_mutex_unlock(&index->mutex);
+    return true;
+}
+
+bool prime_index_save(struct prime_index *index, const char *path)
+{
+    size_t path_len = strlen(path);
+    char *temp_path = newarr(char, path_len + 5);
+    memcpy(temp_path, path, path_len);
+    memcpy(temp_path + path_len, ".tmp", 5);
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        free(temp_path);
+        return false;
+    }
+
+    pthread_mutex_lock(&index->mutex);
+    uint64_t header[PRIME_INDEX_HEADER_WORDS] = {
+        PRIME_INDEX_MAGIC, PRIME_INDEX_INTERVAL, prime_index_len(index)};
+    bool ok = fwrite(header, sizeof header, 1, file) == 1
+        && fwrite(index->mapped, sizeof(unsigned long long), index->mapped_len, file) == index->mapped_len
+        && fwrite(index->grown, sizeof(unsigned long long), index->grown_len, file) == index->grown_len;
+    pthread_mutex_unlock(&index->mutex);
+
+    ok = fclose(file) == 0 && ok;
+    if (ok)
+        ok = rename(temp_path, path) == 0;
+    else
+        remove(temp_path);
+    free(temp_path);
+    return ok;
+}
+
+// Returns the largest known checkpoint k with k * PRIME_INDEX_INTERVAL <= limit and
+// stores pi(k * PRIME_INDEX_INTERVAL) in count.
+size_t prime_index_lookup(struct prime_index *index, unsigned long long limit, unsigned long long *count)
+{
+    pthread_mutex_lock(&index->mutex);
+    size_t k = prime_index_len(index) - 1;
+    if (limit / PRIME_INDEX_INTERVAL < k)
+        k = (size_t)(limit / PRIME_INDEX_INTERVAL);
+    *count = prime_index_at(index, k);
+    pthread_mutex_unlock(&index->mutex);
+    return k;
+}
+
+// interval_counts[j] is the number of primes in (i * INTERVAL, (i + 1) * INTERVAL] for
+// i = first + j. first must not be past the last known checkpoint; checkpoints another
+// job already added are skipped.
+void prime_index_extend(struct prime_index *index,
+                        size_t first,
+                        size_t intervals,
+                        const unsigned long long *interval_counts)
+{
+    pthread_mutex_lock(&index->mutex);
+    size_t len = prime_index_len(index);
+    for (size_t i = first; i < first + intervals; i++) {
+        if (i + 1 < len)
+            continue;
+        if (index->grown_len == index->grown_cap) {
+            index->grown_cap *= 2;
+            index->grown = resize(index->grown, unsigned long long, index->grown_cap);
+        }
+        index->grown[index->grown_len++] = prime_index_at(index, i) + interval_counts[i - first];
+        len++;
+    }
+    pthread_mutex_unlock(&index->mutex);
+}
@@ -0,0 +1,35 @@
+#ifndef PRIME_INDEX_H
+#define PRIME_INDEX_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PRIME_INDEX_INTERVAL (1ull << 20)
+
+// Checkpoint i holds pi(i * PRIME_INDEX_INTERVAL). Checkpoints loaded from disk stay
+// in the read-only mapping; the ones computed since startup live in grown.
+struct prime_index {
+    pthread_mutex_t mutex;
+    const unsigned long long *mapped;
+    size_t mapped_len;
+    void *mapping;
+    size_t mapping_size;
+    unsigned long long *grown;
+    size_t grown_len;
+    size_t grown_cap;
+};
+
+void prime_index_init(struct prime_index *index);
+void prime_index_destroy(struct prime_index *index);
+
+bool prime_index_load(struct prime_index *index, const char *path);
+bool prime_index_save(struct prime_index *index, const char *path);
+
+size_t prime_index_lookup(struct prime_index *index, unsigned long long limit, unsigned long long *count);
+void prime_index_extend(struct prime_index *index,
+                        size_t first,
+                        size_t intervals,
+                        const unsigned long long *interval_counts);
+
+#endif // PRIME_INDEX_H
@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sieve.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../core/util.h"
+
+// Each sieve byte covers 30 numbers; bit i stands for 30 * byte + wheel_residues[i].
+static const unsigned char wheel_residues[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+static const unsigned char wheel_gaps[8] = {6, 4, 2, 4, 2, 4, 6, 2};
+
+// wheel_bit[r] is the bit for residue r, or -1 when r shares a factor with 30.
+static const signed char wheel_bit[30] = {
+    -1, 0, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 3, -1,
+    -1, -1, 4, -1, 5, -1, -1, -1, 6, -1, -1, -1, -1, -1, 7,
+};
+
+// wheel_next[r] is the index of the first wheel residue >= r.
+static const unsigned char wheel_next[30] = {
+    0, 0, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 4,
+    4, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7,
+};
+
+unsigned long long isqrt_ull(unsigned long long value)
+{
+    unsigned long long root = (unsigned long long)sqrtl((long double)value);
+    while (root > 0 && root > value / root)
+        root--;
+    while ((root + 1) <= value / (root + 1))
+        root++;
+    return root;
+}
+
+struct base_primes *base_primes_ensure(struct base_primes *base, unsigned long long limit)
+{
+    if (base != NULL && base->limit >= limit)
+        return base;
+
+    if (base != NULL && limit < base->limit * 2)
+        limit = base->limit * 2;
+    if (limit < 1024)
+        limit = 1024;
+    if (limit > UINT32_MAX)
+        limit = UINT32_MAX;
+
+    size_t size = (size_t)limit + 1;
+    bool *composite = safe_alloc(size, sizeof(bool), true);
+    size_t count = 0;
+    for (size_t value = 2; value < size; value++) {
+        if (composite[value])
+            continue;
+        count++;
+        for (size_t multiple = value * value; multiple < size; multiple += value)
+            composite[multiple] = true;
+    }
+
+    struct base_primes *grown = new(struct base_primes);
+    grown->limit = limit;
+    grown->count = count;
+    grown->primes = newarr(uint32_t, count);
+    grown->prev = base;
+    count = 0;
+    for (size_t value = 2; value < size; value++) {
+        if (!composite[value])
+            grown->primes[count++] = (uint32_t)value;
+    }
+    free(composite);
+    return grown;
+}
+
+void base_primes_free(struct base_primes *base)
+{
+    while (base != NULL) {
+        struct base_primes *prev = base->prev;
+        free(base->primes);
+        free(base);
+        base = prev;
+    }
+}
+
+struct cross_state {
+    unsigned long long byte;
+    unsigned int wheel_index;
+};
+
+// For a prime in residue class pc and a multiplier at wheel index i, cross_mask is the
+// bit to clear and cross_carry the extra bytes (beyond (p / 30) * gap) to the next multiple.
+struct cross_tables {
+    unsigned char mask[8][8];
+    unsigned char carry[8][8];
+};
+
+static void cross_tables_init(struct cross_tables *tables)
+{
+    for (unsigned int pc = 0; pc < 8; pc++) {
+        for (unsigned int i = 0; i < 8; i++) {
+            unsigned int residue = (wheel_residues[pc] * wheel_residues[i]) % 30;
+            tables->mask[pc][i] = (unsigned char)~(1u << wheel_bit[residue]);
+            tables->carry[pc][i] = (unsigned char)((residue + wheel_residues[pc] * wheel_gaps[i]) / 30);
+        }
+    }
+}
+
+static size_t count_small(unsigned long long start, unsigned long long end)
+{
+    static const unsigned long long small[] = {2, 3, 5};
+    size_t total = 0;
+    for (size_t i = 0; i < 3; i++) {
+        if (small[i] >= start && small[i] <= end)
+            total++;
+    }
+    return total;
+}
+
+// First multiple p * k >= from with k >= p and k coprime to 30.
+static void cross_state_init(struct cross_state *state, unsigned long long p, unsigned long long from)
+{
+    unsigned long long k = (from + p - 1) / p;
+    if (k < p)
+        k = p;
+    unsigned int index = wheel_next[k % 30];
+    k = k - k % 30 + wheel_residues[index];
+    state->wheel_index = index;
+    state->byte = p * k / 30;
+}
+
+// Bits of the wheel byte that stand for numbers inside [start, end].
+static unsigned char edge_mask(unsigned long long byte, unsigned long long start, unsigned long long end)
+{
+    unsigned char mask = 0;
+    for (unsigned int bit = 0; bit < 8; bit++) {
+        unsigned long long value = byte * 30 + wheel_residues[bit];
+        if (value >= start && value <= end)
+            mask |= (unsigned char)(1u << bit);
+    }
+    return mask;
+}
+
+size_t sieve_count_range(const struct base_primes *base, unsigned long long start, unsigned long long end)
+{
+    if (end < 2 || start > end)
+        return 0;
+
+    size_t total = count_small(start, end);
+    if (end < 7)
+        return total;
+    if (start < 7)
+        start = 7;
+
+    unsigned long long root = isqrt_ull(end);
+    size_t prime_count = 0;
+    while (prime_count < base->count && base->primes[prime_count] <= root)
+        prime_count++;
+
+    // The first three base primes are 2, 3 and 5, which the wheel already removes.
+    size_t first_prime = prime_count < 3 ? prime_count : 3;
+    struct cross_state *states = newarr(struct cross_state, prime_count + 1);
+    size_t active = first_prime;
+
+    struct cross_tables tables;
+    cross_tables_init(&tables);
+
+    uint64_t segment[SIEVE_SEGMENT_BYTES / sizeof(uint64_t)];
+    unsigned char *bytes = (unsigned char *)segment;
+
+    unsigned long long byte_first = start / 30;
+    unsigned long long byte_last = end / 30;
+
+    for (unsigned long long byte_lo = byte_first; byte_lo <= byte_last; byte_lo += SIEVE_SEGMENT_BYTES) {
+        unsigned long long byte_count = byte_last - byte_lo + 1;
+        if (byte_count > SIEVE_SEGMENT_BYTES)
+            byte_count = SIEVE_SEGMENT_BYTES;
+        unsigned long long seg_lo = byte_lo * 30;
+        unsigned long long seg_hi = (byte_lo + byte_count) * 30 - 1;
+
+        memset(bytes, 0xff, SIEVE_SEGMENT_BYTES);
+        if (byte_lo == byte_first)
+            bytes[0] &= edge_mask(byte_first, start, end);
+        if (byte_last - byte_lo < byte_count)
+            bytes[byte_last - byte_lo] &= edge_mask(byte_last, start, end);
+
+        while (active < prime_count) {
+            unsigned long long p = base->primes[active];
+            if (p * p > seg_hi)
+                break;
+            cross_state_init(&states[active], p, seg_lo > start ? seg_lo : start);
+            active++;
+        }
+
+        unsigned long long byte_end = byte_lo + byte_count;
+        for (size_t i = first_prime; i < active; i++) {
+            unsigned long long p = base->primes[i];
+            unsigned long long q = p / 30;
+            unsigned int pc = (unsigned int)wheel_bit[p % 30];
+            unsigned long long byte = states[i].byte;
+            unsigned int index = states[i].wheel_index;
+            while (byte < byte_end) {
+                bytes[byte - byte_lo] &= tables.mask[pc][index];
+                byte += q * wheel_gaps[index] + tables.carry[pc][index];
+                index = (index + 1) & 7;
+            }
+            states[i].byte = byte;
+            states[i].wheel_index = index;
+        }
+
+        size_t words = (size_t)((byte_count + 7) / 8);
+        if (byte_count % 8 != 0)
+            memset(bytes + byte_count, 0, words * 8 - byte_count);
+        for (size_t w = 0; w < words; w++)
+            total += (size_t)__builtin_popcountll(segment[w]);
+    }
+
+    free(states);
+    return total;
+}
@@ -0,0 +1,26 @@
+#ifndef SIEVE_H
+#define SIEVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIEVE_SEGMENT_BYTES (32 * 1024)
+
+// Sieving primes up to limit. Tables are immutable once published; a larger table
+// links to the one it replaced so tasks still holding it stay valid until shutdown.
+struct base_primes {
+    unsigned long long limit;
+    size_t count;
+    uint32_t *primes;
+    struct base_primes *prev;
+};
+
+struct base_primes *base_primes_ensure(struct base_primes *base, unsigned long long limit);
+void base_primes_free(struct base_primes *base);
+
+unsigned long long isqrt_ull(unsigned long long value);
+
+// base must cover isqrt_ull(end).
+size_t sieve_count_range(const struct base_primes *base, unsigned long long start, unsigned long long end);
+
+#endif // SIEVE_H
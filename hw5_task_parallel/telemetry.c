@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "telemetry.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../core/util.h"
+
+uint64_t telemetry_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static size_t histogram_bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return (size_t)value;
+    unsigned int log = 63u - (unsigned int)__builtin_clzll(value);
+    size_t sub = (size_t)(value >> (log - 2)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return log * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+// Upper bound of the values that land in the bucket.
+static uint64_t histogram_bucket_limit(size_t bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    unsigned int log = (unsigned int)(bucket / HISTOGRAM_SUB_BUCKETS);
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (log - 2)) - 1;
+}
+
+static void histogram_record(struct histogram *histogram, uint64_t value)
+{
+    atomic_fetch_add_explicit(&histogram->buckets[histogram_bucket(value)], 1, memory_order_relaxed);
+}
+
+static void histogram_merge(uint64_t *merged, struct histogram *histogram)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        merged[i] += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+}
+
+static uint64_t histogram_total(const uint64_t *merged)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += merged[i];
+    return total;
+}
+
+static uint64_t histogram_percentile(const uint64_t *merged, double fraction)
+{
+    uint64_t total = histogram_total(merged);
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(fraction * (double)total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += merged[i];
+        if (seen > rank)
+            return histogram_bucket_limit(i);
+    }
+    return histogram_bucket_limit(HISTOGRAM_BUCKETS - 1);
+}
+
+void telemetry_init(struct telemetry *telemetry, size_t workers)
+{
+    memset(telemetry, 0, sizeof(struct telemetry));
+    telemetry->workers = workers;
+    telemetry->start_ns = telemetry_now();
+    telemetry->per_worker = newarr_aligned(struct telemetry_worker, workers, 64);
+    memset(telemetry->per_worker, 0, workers * sizeof(struct telemetry_worker));
+}
+
+void telemetry_destroy(struct telemetry *telemetry)
+{
+    free(telemetry->per_worker);
+    telemetry->per_worker = NULL;
+}
+
+void telemetry_task(struct telemetry_worker *worker, uint64_t enqueue_ns, uint64_t dequeue_ns, uint64_t done_ns)
+{
+    atomic_fetch_add_explicit(&worker->tasks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&worker->busy_ns, done_ns - dequeue_ns, memory_order_relaxed);
+    histogram_record(&worker->wait, dequeue_ns - enqueue_ns);
+    histogram_record(&worker->compute, done_ns - dequeue_ns);
+}
+
+void telemetry_job(struct telemetry_worker *worker, const struct job_record *record)
+{
+    histogram_record(&worker->latency, record->latency_ns);
+
+    size_t tail = atomic_load_explicit(&worker->ring_tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&worker->ring_head, memory_order_acquire);
+    if (tail - head == TELEMETRY_RING_SIZE) {
+        atomic_fetch_add_explicit(&worker->ring_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    worker->ring[tail % TELEMETRY_RING_SIZE] = *record;
+    atomic_store_explicit(&worker->ring_tail, tail + 1, memory_order_release);
+}
+
+static void telemetry_remember(struct telemetry *telemetry, const struct job_record *record)
+{
+    telemetry->recent[telemetry->recent_next] = *record;
+    telemetry->recent_next = (telemetry->recent_next + 1) % TELEMETRY_RECENT_JOBS;
+    if (telemetry->recent_count < TELEMETRY_RECENT_JOBS)
+        telemetry->recent_count++;
+}
+
+void telemetry_inline_job(struct telemetry *telemetry, const struct job_record *record)
+{
+    histogram_record(&telemetry->inline_latency, record->latency_ns);
+    telemetry->inline_jobs++;
+    telemetry_remember(telemetry, record);
+}
+
+static void telemetry_drain(struct telemetry *telemetry)
+{
+    for (size_t w = 0; w < telemetry->workers; w++) {
+        struct telemetry_worker *worker = &telemetry->per_worker[w];
+        size_t head = atomic_load_explicit(&worker->ring_head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&worker->ring_tail, memory_order_acquire);
+        for (; head != tail; head++)
+            telemetry_remember(telemetry, &worker->ring[head % TELEMETRY_RING_SIZE]);
+        atomic_store_explicit(&worker->ring_head, head, memory_order_release);
+    }
+}
+
+static void print_histogram(FILE *out, const char *name, const uint64_t *merged)
+{
+    fprintf(out, "%-12s n=%llu p50=%.3f ms p99=%.3f ms\n",
+            name,
+            (unsigned long long)histogram_total(merged),
+            (double)histogram_percentile(merged, 0.50) / 1.0e6,
+            (double)histogram_percentile(merged, 0.99) / 1.0e6);
+}
+
+void telemetry_print(struct telemetry *telemetry, FILE *out)
+{
+    telemetry_drain(telemetry);
+
+    uint64_t uptime_ns = telemetry_now() - telemetry->start_ns;
+    uint64_t wait[HISTOGRAM_BUCKETS] = {0};
+    uint64_t compute[HISTOGRAM_BUCKETS] = {0};
+    uint64_t latency[HISTOGRAM_BUCKETS] = {0};
+    uint64_t max_busy = 0;
+    uint64_t total_busy = 0;
+    uint64_t dropped = 0;
+
+    flockfile(out);
+    fprintf(out, "stats: uptime %.3f s, %zu workers\n", (double)uptime_ns / 1.0e9, telemetry->workers);
+    for (size_t w = 0; w < telemetry->workers; w++) {
+        struct telemetry_worker *worker = &telemetry->per_worker[w];
+        uint64_t tasks = atomic_load_explicit(&worker->tasks, memory_order_relaxed);
+        uint64_t busy = atomic_load_explicit(&worker->busy_ns, memory_order_relaxed);
+        fprintf(out, "worker %zu: %llu tasks, busy %.3f s, utilization %.1f%%\n",
+                w, (unsigned long long)tasks, (double)busy / 1.0e9,
+                uptime_ns == 0 ? 0.0 : 100.0 * (double)busy / (double)uptime_ns);
+        if (busy > max_busy)
+            max_busy = busy;
+        total_busy += busy;
+        dropped += atomic_load_explicit(&worker->ring_dropped, memory_order_relaxed);
+        histogram_merge(wait, &worker->wait);
+        histogram_merge(compute, &worker->compute);
+        histogram_merge(latency, &worker->latency);
+    }
+    histogram_merge(latency, &telemetry->inline_latency);
+
+    double mean_busy = telemetry->workers == 0 ? 0.0 : (double)total_busy / (double)telemetry->workers;
+    fprintf(out, "imbalance: max/mean busy %.3f\n", mean_busy == 0.0 ? 1.0 : (double)max_busy / mean_busy);
+    print_histogram(out, "queue wait", wait);
+    print_histogram(out, "compute", compute);
+    print_histogram(out, "job latency", latency);
+    fprintf(out, "inline answers: %zu\n", telemetry->inline_jobs);
+    if (dropped != 0)
+        fprintf(out, "dropped job records: %llu\n", (unsigned long long)dropped);
+
+    for (size_t i = 0; i < telemetry->recent_count; i++) {
+        size_t slot = (telemetry->recent_next + TELEMETRY_RECENT_JOBS - telemetry->recent_count + i) % TELEMETRY_RECENT_JOBS;
+        const struct job_record *record = &telemetry->recent[slot];
+        fprintf(out, "task %zu (%llu): latency %.3f ms; over %zu chunks wait %.3f ms, compute %.3f ms in total\n",
+                record->id, record->limit, (double)record->latency_ns / 1.0e6, record->tasks,
+                (double)record->wait_ns / 1.0e6, (double)record->compute_ns / 1.0e6);
+    }
+    fflush(out);
+    funlockfile(out);
+}
@@ -0,0 +1,64 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Log-linear buckets: 4 per power of two, enough for any 64-bit nanosecond count.
+#define HISTOGRAM_SUB_BUCKETS 4
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+#define TELEMETRY_RING_SIZE 64
+#define TELEMETRY_RECENT_JOBS 8
+
+struct histogram {
+    atomic_ullong buckets[HISTOGRAM_BUCKETS];
+};
+
+struct job_record {
+    size_t id;
+    unsigned long long limit;
+    size_t tasks;
+    uint64_t latency_ns;
+    uint64_t wait_ns;
+    uint64_t compute_ns;
+};
+
+// Written only by its own worker; the REPL thread reads the counters and drains
+// the job ring (single producer, single consumer) when stats are requested.
+struct telemetry_worker {
+    alignas(64) atomic_ullong tasks;
+    atomic_ullong busy_ns;
+    struct histogram wait;
+    struct histogram compute;
+    struct histogram latency;
+    struct job_record ring[TELEMETRY_RING_SIZE];
+    atomic_size_t ring_head;
+    atomic_size_t ring_tail;
+    atomic_ullong ring_dropped;
+};
+
+struct telemetry {
+    size_t workers;
+    uint64_t start_ns;
+    struct telemetry_worker *per_worker;
+    struct histogram inline_latency;
+    size_t inline_jobs;
+    struct job_record recent[TELEMETRY_RECENT_JOBS];
+    size_t recent_count;
+    size_t recent_next;
+};
+
+uint64_t telemetry_now(void);
+
+void telemetry_init(struct telemetry *telemetry, size_t workers);
+void telemetry_destroy(struct telemetry *telemetry);
+
+void telemetry_task(struct telemetry_worker *worker, uint64_t enqueue_ns, uint64_t dequeue_ns, uint64_t done_ns);
+void telemetry_job(struct telemetry_worker *worker, const struct job_record *record);
+void telemetry_inline_job(struct telemetry *telemetry, const struct job_record *record);
+
+void telemetry_print(struct telemetry *telemetry, FILE *out);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,55 @@
+#define _GNU_SOURCE
+#include "futex.h"
+
+#include <immintrin.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+void futex_wait(atomic_uint *word, unsigned int expected)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+void futex_wake(atomic_uint *word, int count)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+void cpu_relax(void)
+{
+    _mm_pause();
+}
+
+void latch_init(struct latch *latch, unsigned int count)
+{
+    atomic_init(&latch->state, count);
+}
+
+void latch_count_down(struct latch *latch)
+{
+    unsigned int old = atomic_fetch_sub(&latch->state, 1);
+    if (old == (LATCH_WAITER_BIT | 1))
+        futex_wake(&latch->state, INT_MAX);
+}
+
+void latch_wait(struct latch *latch, size_t spin_count)
+{
+    for (size_t spin = 0; spin < spin_count; spin++)
+    {
+        if ((atomic_load(&latch->state) & ~LATCH_WAITER_BIT) == 0)
+            return;
+        cpu_relax();
+    }
+
+    unsigned int state = atomic_load(&latch->state);
+    while ((state & ~LATCH_WAITER_BIT) != 0)
+    {
+        if ((state & LATCH_WAITER_BIT) == 0
+            && !atomic_compare_exchange_weak(&latch->state, &state, state | LATCH_WAITER_BIT))
+            continue;
+        futex_wait(&latch->state, state | LATCH_WAITER_BIT);
+        state = atomic_load(&latch->state);
+    }
+}
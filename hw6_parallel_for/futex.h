@@ -0,0 +1,25 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+void futex_wait(atomic_uint *word, unsigned int expected);
+void futex_wake(atomic_uint *word, int count);
+
+void cpu_relax(void);
+
+// Single-use countdown latch: the low bits hold the count, LATCH_WAITER_BIT is set
+// by a thread sleeping in latch_wait so the last count_down knows to wake it.
+#define LATCH_WAITER_BIT 0x80000000u
+
+struct latch
+{
+    atomic_uint state;
+};
+
+void latch_init(struct latch *latch, unsigned int count);
+void latch_count_down(struct latch *latch);
+void latch_wait(struct latch *latch, size_t spin_count);
+
+#endif // FUTEX_H
@@ -1,4 +1,5 @@
 #define _GNU_SOURCE
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -47,6 +48,76 @@ static void matmul_row(void *arg)
     }
 }
 
+static void matmul_rows(void *arg, long begin, long end)
+{
+    struct matmul_ctx *ctx = arg;
+    size_t n = ctx->n;
+
+    for (size_t i = (size_t)begin; i < (size_t)end; i++) {
+        for (size_t j = 0; j < n; j++) {
+            float sum = 0.0f;
+            for (size_t k = 0; k < n; k++)
+                sum += ctx->a[i * n + k] * ctx->b[k * n + j];
+            ctx->c[i * n + j] = sum;
+        }
+    }
+}
+
+struct dot_ctx {
+    const float *x;
+    const float *y;
+};
+
+static void float_identity(void *acc)
+{
+    *(float *)acc = 0.0f;
+}
+
+static void float_combine(void *acc, const void *other)
+{
+    *(float *)acc += *(const float *)other;
+}
+
+static void double_identity(void *acc)
+{
+    *(double *)acc = 0.0;
+}
+
+static void double_combine(void *acc, const void *other)
+{
+    *(double *)acc += *(const double *)other;
+}
+
+static void dot_range(void *arg, long begin, long end, void *acc)
+{
+    struct dot_ctx *ctx = arg;
+    float sum = *(float *)acc;
+    for (long i = begin; i < end; i++)
+        sum += ctx->x[i] * ctx->y[i];
+    *(float *)acc = sum;
+}
+
+static void trig_range(void *arg, long begin, long end, void *acc)
+{
+    (void)arg;
+    double sum = *(double *)acc;
+    for (long i = begin; i < end; i++)
+        sum += pow(cos(sin((float)(i + 1))), 10);
+    *(double *)acc = sum;
+}
+
+static void noop_iter(void *arg)
+{
+    (void)arg;
+}
+
+static void noop_range(void *arg, long begin, long end)
+{
+    (void)arg;
+    (void)begin;
+    (void)end;
+}
+
 static double get_time_ms(void)
 {
     struct timespec ts;
@@ -54,12 +125,41 @@ static double get_time_ms(void)
     return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
 }
 
+#define WEAK_RUNS 7
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Median of WEAK_RUNS timed runs after one warmup run that starts the workers
+// and faults in the output rows.
+static double weak_run_ms(struct task_sched *pool, struct matmul_ctx *ctx, size_t rows)
+{
+    double times[WEAK_RUNS];
+    parallel_for_range(pool, 0, (long)rows, matmul_rows, ctx, PARALLEL_SCHEDULE_STATIC, 0);
+    for (size_t r = 0; r < WEAK_RUNS; r++) {
+        double start = get_time_ms();
+        parallel_for_range(pool, 0, (long)rows, matmul_rows, ctx, PARALLEL_SCHEDULE_STATIC, 0);
+        times[r] = get_time_ms() - start;
+    }
+    qsort(times, WEAK_RUNS, sizeof(double), compare_double);
+    return times[WEAK_RUNS / 2];
+}
+
 int main(void)
 {
     size_t sizes[] = {200, 400, 600};
     size_t workers[] = {1, 2, 4, 8};
     size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
     size_t worker_count = sizeof(workers) / sizeof(workers[0]);
+    enum parallel_schedule schedules[] = {
+        PARALLEL_SCHEDULE_STATIC, PARALLEL_SCHEDULE_DYNAMIC, PARALLEL_SCHEDULE_GUIDED
+    };
+    const char *schedule_names[] = { "static", "dynamic", "guided" };
+    size_t schedule_count = sizeof(schedules) / sizeof(schedules[0]);
 
     for (size_t si = 0; si < size_count; si++) {
         size_t n = sizes[si];
@@ -79,10 +179,24 @@ int main(void)
         for (size_t wi = 0; wi < worker_count; wi++) {
             size_t w = workers[wi];
             start = get_time_ms();
-            parallel_for_n(0, 1, (int)n, matmul_row, &ctx, w);
-            double tw = get_time_ms() - start;
-            double speedup = t1 / tw;
-            printf("%zu %zu %.4f\n", n, w, speedup);
+            parallel_for_n_mode(0, 1, (int)n, matmul_row, &ctx, w, TASK_SCHED_FIFO);
+            double t_fifo = get_time_ms() - start;
+            start = get_time_ms();
+            parallel_for_n_mode(0, 1, (int)n, matmul_row, &ctx, w, TASK_SCHED_WORK_STEALING);
+            double t_ws = get_time_ms() - start;
+            printf("%zu %zu %.4f %.4f\n", n, w, t1 / t_fifo, t1 / t_ws);
+        }
+
+        for (size_t wi = 0; wi < worker_count; wi++) {
+            size_t w = workers[wi];
+            struct task_sched *pool = task_sched_create(w, 0, TASK_SCHED_WORK_STEALING);
+            for (size_t si2 = 0; si2 < schedule_count; si2++) {
+                start = get_time_ms();
+                parallel_for_range(pool, 0, (long)n, matmul_rows, &ctx, schedules[si2], 0);
+                double t_range = get_time_ms() - start;
+                printf("range %s %zu %zu %.4f\n", schedule_names[si2], n, w, t1 / t_range);
+            }
+            task_sched_destroy(pool);
         }
 
         free(a);
@@ -90,5 +204,103 @@ int main(void)
         free(c);
     }
 
+    // Weak scaling: every worker keeps the same number of rows, so the ideal
+    // time stays flat as workers are added.
+    size_t weak_n = 400;
+    size_t weak_rows = 50;
+    size_t max_rows = weak_rows * workers[worker_count - 1];
+    float *wa = newarr(float, max_rows * weak_n);
+    float *wb = newarr(float, weak_n * weak_n);
+    float *wc = newarr(float, max_rows * weak_n);
+    fill_matrix(wb, weak_n, 3);
+    srand(4);
+    for (size_t i = 0; i < max_rows * weak_n; i++)
+        wa[i] = (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+    struct matmul_ctx weak = { wa, wb, wc, weak_n };
+
+    for (size_t wi = 0; wi < worker_count; wi++) {
+        size_t w = workers[wi];
+        size_t rows = weak_rows * w;
+        struct task_sched *pool = task_sched_create(w, 0, TASK_SCHED_WORK_STEALING);
+        double t_weak = weak_run_ms(pool, &weak, rows);
+        task_sched_destroy(pool);
+        printf("weak %zu %zu %zu %.4f\n", weak_n, w, rows, t_weak);
+    }
+
+    free(wa);
+    free(wb);
+    free(wc);
+
+    size_t calls = 1000;
+    int iters = 64;
+    enum task_sched_mode modes[] = { TASK_SCHED_FIFO, TASK_SCHED_WORK_STEALING };
+    const char *mode_names[] = { "fifo", "ws" };
+
+    for (size_t mi = 0; mi < 2; mi++) {
+        for (size_t wi = 0; wi < worker_count; wi++) {
+            size_t w = workers[wi];
+
+            double start = get_time_ms();
+            for (size_t call = 0; call < calls; call++)
+                parallel_for_n_mode(0, 1, iters, noop_iter, NULL, w, modes[mi]);
+            double spawn_us = (get_time_ms() - start) * 1000.0 / calls;
+
+            struct task_sched *pool = task_sched_create(w, 0, modes[mi]);
+            start = get_time_ms();
+            for (size_t call = 0; call < calls; call++)
+                parallel_for_sched(pool, 0, 1, iters, noop_iter, NULL);
+            double pool_us = (get_time_ms() - start) * 1000.0 / calls;
+
+            start = get_time_ms();
+            for (size_t call = 0; call < calls; call++)
+                parallel_for_range(pool, 0, iters, noop_range, NULL, PARALLEL_SCHEDULE_DYNAMIC, 1);
+            double range_us = (get_time_ms() - start) * 1000.0 / calls;
+            task_sched_destroy(pool);
+
+            printf("overhead %s %zu %.2f %.2f %.2f\n", mode_names[mi], w, spawn_us, pool_us, range_us);
+        }
+    }
+
+    long len = 1 << 22;
+    float *x = newarr(float, len);
+    float *y = newarr(float, len);
+    fill_matrix(x, 1 << 11, 1);
+    fill_matrix(y, 1 << 11, 2);
+    struct dot_ctx dot = { x, y };
+    const struct reduce_op float_sum = { sizeof(float), float_identity, float_combine };
+    const struct reduce_op double_sum = { sizeof(double), double_identity, double_combine };
+    float dot_ref = 0.0f;
+    double trig_ref = 0.0;
+
+    for (size_t wi = 0; wi < worker_count; wi++) {
+        size_t w = workers[wi];
+        struct task_sched *pool = task_sched_create(w, 0, TASK_SCHED_WORK_STEALING);
+
+        float dot_value;
+        double start = get_time_ms();
+        parallel_reduce(pool, 0, len, 0, dot_range, &dot, &float_sum, &dot_value);
+        double t_dot = get_time_ms() - start;
+
+        double trig_value;
+        start = get_time_ms();
+        parallel_reduce(pool, 0, 1000000, 0, trig_range, NULL, &double_sum, &trig_value);
+        double t_trig = get_time_ms() - start;
+
+        task_sched_destroy(pool);
+
+        if (wi == 0) {
+            dot_ref = dot_value;
+            trig_ref = trig_value;
+        } else if (dot_value != dot_ref || trig_value != trig_ref) {
+            fprintf(stderr, "reduce result depends on worker count\n");
+            return 1;
+        }
+
+        printf("reduce %zu %.4f %.4f %.6f %.6f\n", w, t_dot, t_trig, dot_value, trig_value);
+    }
+
+    free(x);
+    free(y);
+
     return 0;
 }
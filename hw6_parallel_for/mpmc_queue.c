@@ -0,0 +1,198 @@
+#include "mpmc_queue.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/sysinfo.h>
+
+#include "futex.h"
+#include "../core/util.h"
+
+#define MPMC_QUEUE_DEFAULT_MAX_DEPTH 32
+#define MPMC_QUEUE_SPIN_COUNT 256
+
+void mpmc_queue_init(struct mpmc_queue *queue, size_t max_depth)
+{
+    size_t capacity = 2;
+    size_t requested = max_depth == 0
+        ? MPMC_QUEUE_DEFAULT_MAX_DEPTH
+        : max_depth;
+    while (capacity < requested)
+        capacity *= 2;
+
+    queue->cells = newarr(struct mpmc_cell, capacity);
+    queue->mask = capacity - 1;
+    for (size_t i = 0; i < capacity; i++)
+    {
+        atomic_init(&queue->cells[i].seq, i);
+        queue->cells[i].task = NULL;
+    }
+
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    atomic_init(&queue->shutdown, 0);
+    queue->spin_count = get_nprocs() > 1
+        ? MPMC_QUEUE_SPIN_COUNT
+        : 0;
+    atomic_init(&queue->not_full.seq, 0);
+    atomic_init(&queue->not_empty.seq, 0);
+}
+
+void mpmc_queue_destroy(struct mpmc_queue *queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+// Bit 0 of the event word is set by a thread about to sleep; the other bits count
+// signals. A signal only enters the kernel when the bit is set, and clears it while
+// waking every sleeper, so a run of operations costs one syscall, not one each.
+// The fences pair up: either the sleeper sees the position the signaller just moved,
+// or the signaller sees the sleeper's bit.
+static void mpmc_event_signal(struct mpmc_event *event)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    unsigned int seq = atomic_load_explicit(&event->seq, memory_order_relaxed);
+    while (seq & 1)
+    {
+        if (atomic_compare_exchange_weak(&event->seq, &seq, seq + 1))
+        {
+            futex_wake(&event->seq, INT_MAX);
+            return;
+        }
+    }
+}
+
+static void mpmc_event_wait(struct mpmc_event *event, struct mpmc_queue *queue, bool (*ready)(struct mpmc_queue *))
+{
+    unsigned int seq = atomic_load(&event->seq);
+    while ((seq & 1) == 0 && !atomic_compare_exchange_weak(&event->seq, &seq, seq | 1))
+        ;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!ready(queue))
+        futex_wait(&event->seq, seq | 1);
+}
+
+static bool mpmc_queue_has_space(struct mpmc_queue *queue)
+{
+    size_t enqueue_pos = atomic_load(&queue->enqueue_pos);
+    size_t dequeue_pos = atomic_load(&queue->dequeue_pos);
+    return enqueue_pos - dequeue_pos <= queue->mask;
+}
+
+static bool mpmc_queue_is_empty(struct mpmc_queue *queue)
+{
+    size_t dequeue_pos = atomic_load(&queue->dequeue_pos);
+    size_t enqueue_pos = atomic_load(&queue->enqueue_pos);
+    return enqueue_pos == dequeue_pos;
+}
+
+static bool mpmc_queue_has_items(struct mpmc_queue *queue)
+{
+    return !mpmc_queue_is_empty(queue) || atomic_load(&queue->shutdown);
+}
+
+bool mpmc_queue_try_enqueue(struct mpmc_queue *queue, struct task *task)
+{
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    struct mpmc_cell *cell;
+
+    for (;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->task = task;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    mpmc_event_signal(&queue->not_empty);
+    return true;
+}
+
+struct task *mpmc_queue_try_dequeue(struct mpmc_queue *queue)
+{
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    struct mpmc_cell *cell;
+
+    for (;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    struct task *task = cell->task;
+    atomic_store_explicit(&cell->seq, pos + queue->mask + 1, memory_order_release);
+    mpmc_event_signal(&queue->not_full);
+    return task;
+}
+
+void mpmc_queue_enqueue(struct mpmc_queue *queue, struct task *task)
+{
+    for (size_t spin = 0;; spin++)
+    {
+        if (mpmc_queue_try_enqueue(queue, task))
+            return;
+
+        if (spin < queue->spin_count)
+            cpu_relax();
+        else
+            mpmc_event_wait(&queue->not_full, queue, mpmc_queue_has_space);
+    }
+}
+
+struct task *mpmc_queue_dequeue(struct mpmc_queue *queue)
+{
+    for (size_t spin = 0;; spin++)
+    {
+        struct task *task = mpmc_queue_try_dequeue(queue);
+        if (task != NULL)
+            return task;
+
+        if (atomic_load(&queue->shutdown) && mpmc_queue_is_empty(queue))
+            return NULL;
+
+        if (spin < queue->spin_count)
+            cpu_relax();
+        else
+            mpmc_event_wait(&queue->not_empty, queue, mpmc_queue_has_items);
+    }
+}
+
+void mpmc_queue_shutdown(struct mpmc_queue *queue)
+{
+    atomic_store(&queue->shutdown, 1);
+    atomic_fetch_add(&queue->not_empty.seq, 2);
+    futex_wake(&queue->not_empty.seq, INT_MAX);
+}
@@ -0,0 +1,47 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct task;
+
+struct mpmc_cell
+{
+    atomic_size_t seq;
+    struct task *task;
+};
+
+struct mpmc_event
+{
+    atomic_uint seq;
+};
+
+// Bounded multi-producer/multi-consumer ring with per-cell sequence numbers (Vyukov).
+// enqueue blocks while the ring is full, dequeue blocks while it is empty and
+// returns NULL once the queue is shut down and drained, like task_queue.
+struct mpmc_queue
+{
+    alignas(64) atomic_size_t enqueue_pos;
+    alignas(64) atomic_size_t dequeue_pos;
+    alignas(64) struct mpmc_cell *cells;
+    size_t mask;
+    size_t spin_count;
+    atomic_int shutdown;
+    struct mpmc_event not_full;
+    struct mpmc_event not_empty;
+};
+
+void mpmc_queue_init(struct mpmc_queue *queue, size_t max_depth);
+void mpmc_queue_destroy(struct mpmc_queue *queue);
+
+bool mpmc_queue_try_enqueue(struct mpmc_queue *queue, struct task *task);
+struct task *mpmc_queue_try_dequeue(struct mpmc_queue *queue);
+
+void mpmc_queue_enqueue(struct mpmc_queue *queue, struct task *task);
+struct task *mpmc_queue_dequeue(struct mpmc_queue *queue);
+
+void mpmc_queue_shutdown(struct mpmc_queue *queue);
+
+#endif // MPMC_QUEUE_H
@@ -6,14 +6,15 @@ def load_data(path):
     with open(path, "r", encoding="utf-8") as f:
         for line in f:
             parts = line.strip().split()
-            if len(parts) != 3:
+            if len(parts) not in (3, 4):
                 continue
             size = int(parts[0])
             workers = int(parts[1])
             speedup = float(parts[2])
+            stealing = float(parts[3]) if len(parts) == 4 else None
             if size not in data:
                 data[size] = []
-            data[size].append((workers, speedup))
+            data[size].append((workers, speedup, stealing))
     return data
 
 def make_svg(path, data):
@@ -24,10 +25,9 @@ def make_svg(path, data):
     all_workers = set()
     max_speedup = 0
     for size, points in data.items():
-        for w, s in points:
+        for w, s, ws in points:
             all_workers.add(w)
-            if s > max_speedup:
-                max_speedup = s
+            max_speedup = max(max_speedup, s, ws or 0)
 
     workers = sorted(all_workers)
     max_w = max(workers)
@@ -65,10 +65,16 @@ def make_svg(path, data):
     for idx, size in enumerate(sizes):
         color = colors[idx % len(colors)]
         points = sorted(data[size])
-        pts = " ".join(f"{x_pos(w)},{y_pos(s)}" for w, s in points)
+        pts = " ".join(f"{x_pos(w)},{y_pos(s)}" for w, s, _ in points)
         items.append(f'<polyline points="{pts}" fill="none" stroke="{color}" stroke-width="2"/>')
-        for w, s in points:
+        for w, s, _ in points:
             items.append(f'<circle cx="{x_pos(w)}" cy="{y_pos(s)}" r="4" fill="{color}"/>')
+        stealing = [(w, ws) for w, _, ws in points if ws is not None]
+        if stealing:
+            pts = " ".join(f"{x_pos(w)},{y_pos(ws)}" for w, ws in stealing)
+            items.append(f'<polyline points="{pts}" fill="none" stroke="{color}" stroke-width="2" stroke-dasharray="2,3"/>')
+            for w, ws in stealing:
+                items.append(f'<rect x="{x_pos(w) - 3}" y="{y_pos(ws) - 3}" width="6" height="6" fill="{color}"/>')
 
     items.append(f'<text x="{width / 2}" y="{height - 15}" font-size="14" text-anchor="middle">N (workers)</text>')
     items.append(f'<text x="15" y="{height / 2}" font-size="14" text-anchor="middle" transform="rotate(-90 15 {height / 2})">Speedup</text>')
@@ -82,6 +88,10 @@ def make_svg(path, data):
         ly = legend_y + 20 * (idx + 1)
         items.append(f'<line x1="{legend_x}" y1="{ly}" x2="{legend_x + 20}" y2="{ly}" stroke="{color}" stroke-width="2"/>')
         items.append(f'<text x="{legend_x + 25}" y="{ly + 4}" font-size="12">M={size}</text>')
+    if any(ws is not None for points in data.values() for _, _, ws in points):
+        ly = legend_y + 20 * (len(sizes) + 1)
+        items.append(f'<line x1="{legend_x}" y1="{ly}" x2="{legend_x + 20}" y2="{ly}" stroke="black" stroke-width="2" stroke-dasharray="2,3"/>')
+        items.append(f'<text x="{legend_x + 25}" y="{ly + 4}" font-size="12">work stealing</text>')
 
     with open(path, "w", encoding="utf-8") as f:
         f.write(f'<svg xmlns="http://www.w3.org/2000/svg" width="{width}" height="{height}">')
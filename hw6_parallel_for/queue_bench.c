@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "tasks.h"
+#include "mpmc_queue.h"
+#include "../core/util.h"
+
+enum queue_kind {
+    QUEUE_MUTEX,
+    QUEUE_MPMC
+};
+
+// One cache line per thread, so that consumers bumping their counters do not
+// share lines with each other.
+struct bench_ctx {
+    alignas(64) enum queue_kind kind;
+    struct task_queue *mutex_queue;
+    struct mpmc_queue *mpmc_queue;
+    size_t items;
+    size_t consumed;
+};
+
+static void *produce(void *arg)
+{
+    struct bench_ctx *ctx = arg;
+    for (size_t i = 1; i <= ctx->items; i++) {
+        struct task *item = (struct task *)(uintptr_t)i;
+        if (ctx->kind == QUEUE_MUTEX)
+            task_queue_enqueue(ctx->mutex_queue, item);
+        else
+            mpmc_queue_enqueue(ctx->mpmc_queue, item);
+    }
+    return NULL;
+}
+
+static void *consume(void *arg)
+{
+    struct bench_ctx *ctx = arg;
+    for (;;) {
+        struct task *item = ctx->kind == QUEUE_MUTEX
+            ? task_queue_dequeue(ctx->mutex_queue)
+            : mpmc_queue_dequeue(ctx->mpmc_queue);
+        if (item == NULL)
+            break;
+        ctx->consumed++;
+    }
+    return NULL;
+}
+
+static double get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1.0e6;
+}
+
+static double run(enum queue_kind kind, size_t producers, size_t consumers, size_t items)
+{
+    struct task_queue mutex_queue;
+    struct mpmc_queue mpmc_queue;
+    if (kind == QUEUE_MUTEX)
+        task_queue_init(&mutex_queue, 0);
+    else
+        mpmc_queue_init(&mpmc_queue, 0);
+
+    pthread_t *threads = newarr(pthread_t, producers + consumers);
+    struct bench_ctx *ctx = newarr_aligned(struct bench_ctx, producers + consumers, 64);
+    for (size_t i = 0; i < producers + consumers; i++) {
+        ctx[i].kind = kind;
+        ctx[i].mutex_queue = &mutex_queue;
+        ctx[i].mpmc_queue = &mpmc_queue;
+        ctx[i].items = items;
+        ctx[i].consumed = 0;
+    }
+
+    double start = get_time_ms();
+    for (size_t i = 0; i < consumers; i++) {
+        if (pthread_create(&threads[i], NULL, consume, &ctx[i]) != 0)
+            die("pthread_create failed");
+    }
+    for (size_t i = consumers; i < producers + consumers; i++) {
+        if (pthread_create(&threads[i], NULL, produce, &ctx[i]) != 0)
+            die("pthread_create failed");
+    }
+    for (size_t i = consumers; i < producers + consumers; i++)
+        pthread_join(threads[i], NULL);
+
+    if (kind == QUEUE_MUTEX)
+        task_queue_shutdown(&mutex_queue);
+    else
+        mpmc_queue_shutdown(&mpmc_queue);
+
+    size_t consumed = 0;
+    for (size_t i = 0; i < consumers; i++) {
+        pthread_join(threads[i], NULL);
+        consumed += ctx[i].consumed;
+    }
+    double elapsed = get_time_ms() - start;
+
+    if (consumed != producers * items)
+        die("queue lost items");
+
+    if (kind == QUEUE_MUTEX)
+        task_queue_destroy(&mutex_queue);
+    else
+        mpmc_queue_destroy(&mpmc_queue);
+    free(threads);
+    free(ctx);
+
+    return (double)consumed / (elapsed * 1000.0);
+}
+
+int main(void)
+{
+    size_t counts[] = {1, 2, 4, 8};
+    size_t count_len = sizeof(counts) / sizeof(counts[0]);
+    size_t items = 200000;
+
+    for (size_t pi = 0; pi < count_len; pi++) {
+        for (size_t ci = 0; ci < count_len; ci++) {
+            size_t p = counts[pi];
+            size_t c = counts[ci];
+            double mutex_mops = run(QUEUE_MUTEX, p, c, items);
+            double mpmc_mops = run(QUEUE_MPMC, p, c, items);
+            printf("%zu %zu %.3f %.3f\n", p, c, mutex_mops, mpmc_mops);
+        }
+    }
+
+    return 0;
+}
@@ -1,11 +1,14 @@
 #include "tasks.h"
 
+#include <limits.h>
 #include <math.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 #include <sys/sysinfo.h>
 
+#include "futex.h"
 #include "../core/util.h"
 
 void task_init(struct task *task, void (*func)(void *), void *ctx)
@@ -15,8 +18,8 @@ void task_init(struct task *task, void (*func)(void *), void *ctx)
     task->func = func;
     task->ctx = ctx;
     task->status = TASK_STATUS_CREATED;
-    pthread_mutex_init(&task->status_lock, NULL);
-    pthread_cond_init(&task->status_cond, NULL);
+    pthread_mutex_init(&task->status_lock, nullptr);
+    pthread_cond_init(&task->status_cond, nullptr);
 }
 
 struct task *task_create(void (*func)(void *), void *ctx)
@@ -26,7 +29,32 @@ struct task *task_create(void (*func)(void *), void *ctx)
     return task;
 }
 
+// Latched tasks report completion only through the latch; they carry no status
+// mutex, so await_task and task_uninit do not apply to them.
+void task_init_latch(struct task *task, void (*func)(void *), void *ctx, struct latch *latch)
+{
+    memset(task, 0, sizeof(struct task));
+
+    task->func = func;
+    task->ctx = ctx;
+    task->status = TASK_STATUS_CREATED;
+    task->latch = latch;
+}
+
+void task_uninit(struct task *task)
+{
+    pthread_mutex_destroy(&task->status_lock);
+    pthread_cond_destroy(&task->status_cond);
+}
+
+void task_destroy(struct task *task)
+{
+    task_uninit(task);
+    free(task);
+}
+
 #define TASK_QUEUE_DEFAULT_MAX_DEPTH 32
+#define TASK_SCHED_SPIN_COUNT 2048
 
 static struct task_queue task_queue_blank = {};
 
@@ -40,9 +68,18 @@ void task_queue_init(struct task_queue *task_queue, size_t max_depth)
 
     task_queue->tasks = newarr(struct task *, task_queue->max_depth);
 
-    pthread_mutex_init(&task_queue->lock, NULL);
-    pthread_cond_init(&task_queue->enqueue_cond, NULL);
-    pthread_cond_init(&task_queue->dequeue_cond, NULL);
+    pthread_mutex_init(&task_queue->lock, nullptr);
+    pthread_cond_init(&task_queue->enqueue_cond, nullptr);
+    pthread_cond_init(&task_queue->dequeue_cond, nullptr);
+}
+
+void task_queue_destroy(struct task_queue *task_queue)
+{
+    pthread_mutex_destroy(&task_queue->lock);
+    pthread_cond_destroy(&task_queue->enqueue_cond);
+    pthread_cond_destroy(&task_queue->dequeue_cond);
+    free(task_queue->tasks);
+    task_queue->tasks = nullptr;
 }
 
 void task_queue_move_next(struct task_queue *task_queue, size_t *index)
@@ -84,7 +121,7 @@ struct task *task_queue_dequeue(struct task_queue *task_queue)
     if (task_queue->shutdown && task_queue->count == 0)
     {
         pthread_mutex_unlock(&task_queue->lock);
-        return NULL;
+        return nullptr;
     }
 
     struct task *removed = task_queue->tasks[task_queue->head];
@@ -97,6 +134,34 @@ struct task *task_queue_dequeue(struct task_queue *task_queue)
     return removed;
 }
 
+struct task *task_queue_try_dequeue(struct task_queue *task_queue)
+{
+    pthread_mutex_lock(&task_queue->lock);
+
+    if (task_queue->count == 0)
+    {
+        pthread_mutex_unlock(&task_queue->lock);
+        return nullptr;
+    }
+
+    struct task *removed = task_queue->tasks[task_queue->head];
+    task_queue_move_next(task_queue, &task_queue->head);
+    --task_queue->count;
+
+    pthread_cond_signal(&task_queue->enqueue_cond);
+    pthread_mutex_unlock(&task_queue->lock);
+
+    return removed;
+}
+
+void task_queue_shutdown(struct task_queue *task_queue)
+{
+    pthread_mutex_lock(&task_queue->lock);
+    task_queue->shutdown = 1;
+    pthread_cond_broadcast(&task_queue->dequeue_cond);
+    pthread_mutex_unlock(&task_queue->lock);
+}
+
 void update_task_status(struct task *task, enum task_status new_status)
 {
     pthread_mutex_lock(&task->status_lock);
@@ -105,46 +170,220 @@ void update_task_status(struct task *task, enum task_status new_status)
     pthread_mutex_unlock(&task->status_lock);
 }
 
+static thread_local struct task_worker *current_worker = nullptr;
+
+static unsigned int ws_next_random(unsigned int *seed)
+{
+    unsigned int x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static struct task *find_task(struct task_worker *worker)
+{
+    struct task_sched *task_sched = worker->sched;
+    struct task *task;
+
+    if (task_sched->mode == TASK_SCHED_FIFO)
+        return mpmc_queue_try_dequeue(&task_sched->task_queue);
+
+    task = ws_deque_take(&worker->deque);
+    if (task != nullptr)
+        return task;
+
+    task = mpmc_queue_try_dequeue(&task_sched->task_queue);
+    if (task != nullptr)
+        return task;
+
+    size_t count = task_sched->worker_count;
+    for (size_t attempt = 0; attempt < 2 * count; attempt++)
+    {
+        size_t victim = ws_next_random(&worker->seed) % count;
+        if (victim == worker->index)
+            continue;
+        if (ws_deque_steal(&task_sched->worker_ctx[victim].deque, &task) == WS_STEAL_SUCCESS)
+            return task;
+    }
+
+    return nullptr;
+}
+
+static bool has_work(struct task_sched *task_sched)
+{
+    return atomic_load(&task_sched->pending) != 0 || atomic_load(&task_sched->shutdown);
+}
+
+// Idle workers spin for a while so back-to-back parallel_for calls find them awake,
+// then sleep on wake_seq until run_task or shutdown bumps it.
+static void park_worker(struct task_sched *task_sched)
+{
+    for (size_t spin = 0; spin < task_sched->spin_count; spin++)
+    {
+        if (has_work(task_sched))
+            return;
+        cpu_relax();
+    }
+
+    unsigned int seq = atomic_load(&task_sched->wake_seq);
+    atomic_fetch_add(&task_sched->sleepers, 1);
+    if (!has_work(task_sched))
+        futex_wait(&task_sched->wake_seq, seq);
+    atomic_fetch_sub(&task_sched->sleepers, 1);
+}
+
 void *worker_routine(void *ctx)
 {
-    struct task_queue *task_queue = ctx;
+    struct task_worker *worker = ctx;
+    struct task_sched *task_sched = worker->sched;
+    current_worker = worker;
 
     while (1)
     {
-        struct task *task = task_queue_dequeue(task_queue);
-        if (task == NULL)
+        struct task *task = find_task(worker);
+        if (task != nullptr)
+        {
+            atomic_fetch_sub(&task_sched->pending, 1);
+            struct latch *latch = task->latch;
+            if (latch != nullptr)
+            {
+                task->func(task->ctx);
+                latch_count_down(latch);
+                continue;
+            }
+            update_task_status(task, TASK_STATUS_RUNNING);
+            task->func(task->ctx);
+            update_task_status(task, TASK_STATUS_COMPLETED);
+            continue;
+        }
+
+        if (atomic_load(&task_sched->shutdown) && atomic_load(&task_sched->pending) == 0)
             break;
-        update_task_status(task, TASK_STATUS_RUNNING);
-        task->func(task->ctx);
-        update_task_status(task, TASK_STATUS_COMPLETED);
+
+        park_worker(task_sched);
     }
 
-    return NULL;
+    current_worker = nullptr;
+    return nullptr;
+}
+
+static void task_sched_notify(struct task_sched *task_sched, int count)
+{
+    atomic_fetch_add(&task_sched->wake_seq, 1);
+    if (atomic_load(&task_sched->sleepers) != 0)
+        futex_wake(&task_sched->wake_seq, count);
 }
 
 static struct task_sched task_sched_blank = {};
 
-void task_sched_init(struct task_sched *task_sched, size_t worker_count, size_t task_queue_max_depth)
+void task_sched_init_mode(struct task_sched *task_sched,
+                          size_t worker_count,
+                          size_t task_queue_max_depth,
+                          enum task_sched_mode mode)
 {
     memcpy(task_sched, &task_sched_blank, sizeof(struct task_sched));
 
+    task_sched->mode = mode;
     task_sched->worker_count = worker_count == 0
         ? get_nprocs()
         : worker_count;
 
-    task_queue_init(&task_sched->task_queue, task_queue_max_depth);
+    mpmc_queue_init(&task_sched->task_queue, task_queue_max_depth);
+
+    atomic_init(&task_sched->pending, 0);
+    atomic_init(&task_sched->sleepers, 0);
+    atomic_init(&task_sched->shutdown, 0);
+    atomic_init(&task_sched->wake_seq, 0);
+
+    // Spinning only helps when the submitting thread can run on another core.
+    task_sched->spin_count = get_nprocs() > 1
+        ? TASK_SCHED_SPIN_COUNT
+        : 0;
 
     task_sched->workers = newarr(pthread_t, task_sched->worker_count);
+    task_sched->worker_ctx = newarr(struct task_worker, task_sched->worker_count);
+
+    for (size_t i = 0; i < task_sched->worker_count; i++)
+    {
+        struct task_worker *worker = &task_sched->worker_ctx[i];
+        worker->sched = task_sched;
+        worker->index = i;
+        worker->seed = (unsigned int)((i + 1) * 2654435761u);
+        if (mode == TASK_SCHED_WORK_STEALING)
+            ws_deque_init(&worker->deque, 0);
+    }
 
     for (size_t i = 0; i < task_sched->worker_count; i++)
     {
-        pthread_create(&task_sched->workers[i], NULL, worker_routine, &task_sched->task_queue);
+        pthread_create(&task_sched->workers[i], nullptr, worker_routine, &task_sched->worker_ctx[i]);
     }
 }
 
+void task_sched_init(struct task_sched *task_sched, size_t worker_count, size_t task_queue_max_depth)
+{
+    task_sched_init_mode(task_sched, worker_count, task_queue_max_depth, TASK_SCHED_FIFO);
+}
+
+void task_sched_uninit(struct task_sched *task_sched)
+{
+    atomic_store(&task_sched->shutdown, 1);
+    task_sched_notify(task_sched, INT_MAX);
+
+    for (size_t i = 0; i < task_sched->worker_count; i++)
+    {
+        pthread_join(task_sched->workers[i], nullptr);
+    }
+
+    if (task_sched->mode == TASK_SCHED_WORK_STEALING)
+    {
+        for (size_t i = 0; i < task_sched->worker_count; i++)
+        {
+            ws_deque_destroy(&task_sched->worker_ctx[i].deque);
+        }
+    }
+
+    mpmc_queue_destroy(&task_sched->task_queue);
+
+    free(task_sched->worker_ctx);
+    free(task_sched->workers);
+}
+
+struct task_sched *task_sched_create(size_t worker_count,
+                                     size_t task_queue_max_depth,
+                                     enum task_sched_mode mode)
+{
+    struct task_sched *task_sched = new(struct task_sched);
+    task_sched_init_mode(task_sched, worker_count, task_queue_max_depth, mode);
+    return task_sched;
+}
+
+void task_sched_destroy(struct task_sched *task_sched)
+{
+    task_sched_uninit(task_sched);
+    free(task_sched);
+}
+
 void run_task(struct task_sched *task_sched, struct task *task)
 {
-    task_queue_enqueue(&task_sched->task_queue, task);
+    atomic_fetch_add(&task_sched->pending, 1);
+
+    if (task_sched->mode == TASK_SCHED_WORK_STEALING
+        && current_worker != nullptr
+        && current_worker->sched == task_sched)
+        ws_deque_push(&current_worker->deque, task);
+    else
+        mpmc_queue_enqueue(&task_sched->task_queue, task);
+
+    task_sched_notify(task_sched, 1);
+}
+
+struct task *task_sched_submit(struct task_sched *task_sched, void (*func)(void *), void *ctx)
+{
+    struct task *task = task_create(func, ctx);
+    run_task(task_sched, task);
+    return task;
 }
 
 void await_task(struct task *task)
@@ -159,16 +398,30 @@ void await_task(struct task *task)
     pthread_mutex_unlock(&task->status_lock);
 }
 
-void parallel_for_n(int start,
-                    int step,
-                    int end,
-                    void (*iter_func)(void *),
-                    void *ctx,
-                    size_t worker_count)
+struct spawn_data
 {
-    struct task_sched task_sched;
-    task_sched_init(&task_sched, worker_count, 0);
+    struct task_sched *task_sched;
+    struct task *tasks;
+    int count;
+};
+
+static void spawn_tasks(void *ctx)
+{
+    struct spawn_data *spawn = ctx;
 
+    for (int i = 0; i < spawn->count; i++)
+    {
+        run_task(spawn->task_sched, &spawn->tasks[i]);
+    }
+}
+
+void parallel_for_sched(struct task_sched *task_sched,
+                        int start,
+                        int step,
+                        int end,
+                        void (*iter_func)(void *),
+                        void *ctx)
+{
     int iter_count = ceil((end - start) / (double)step);
     struct iter_data *iter_data = newarr(struct iter_data, iter_count);
     struct task *tasks = newarr(struct task, iter_count);
@@ -179,30 +432,315 @@ void parallel_for_n(int start,
         iter_data[i].i = start + i * step;
 
         task_init(&tasks[i], iter_func, &iter_data[i]);
-        run_task(&task_sched, &tasks[i]);
+    }
+
+    // In work-stealing mode one worker spawns the iterations into its own deque,
+    // so the rest of the pool picks them up by stealing instead of through the shared queue.
+    struct spawn_data spawn = { task_sched, tasks, iter_count };
+    struct task spawner;
+    bool spawned = task_sched->mode == TASK_SCHED_WORK_STEALING
+        && (current_worker == nullptr || current_worker->sched != task_sched);
+
+    if (spawned)
+    {
+        task_init(&spawner, spawn_tasks, &spawn);
+        run_task(task_sched, &spawner);
+    }
+    else
+    {
+        for (int i = 0; i < iter_count; i++)
+        {
+            run_task(task_sched, &tasks[i]);
+        }
     }
 
     for (int i = 0; i < iter_count; i++)
     {
         await_task(&tasks[i]);
+        task_uninit(&tasks[i]);
     }
 
-    pthread_mutex_lock(&task_sched.task_queue.lock);
-    task_sched.task_queue.shutdown = 1;
-    pthread_cond_broadcast(&task_sched.task_queue.dequeue_cond);
-    pthread_mutex_unlock(&task_sched.task_queue.lock);
-
-    for (size_t i = 0; i < task_sched.worker_count; i++)
+    if (spawned)
     {
-        pthread_join(task_sched.workers[i], NULL);
+        await_task(&spawner);
+        task_uninit(&spawner);
     }
 
-    free(task_sched.workers);
-    free(task_sched.task_queue.tasks);
     free(tasks);
     free(iter_data);
 }
 
+struct range_loop
+{
+    // Exactly one of the two is set.
+    void (*range_func)(void *ctx, long begin, long end);
+    void (*indexed_func)(void *ctx, size_t part, long begin, long end);
+    void *ctx;
+    long begin;
+    long end;
+    long chunk;
+    enum parallel_schedule schedule;
+    size_t participants;
+    atomic_long next;
+};
+
+struct range_part
+{
+    struct range_loop *loop;
+    size_t index;
+};
+
+static long min_long(long a, long b)
+{
+    return a < b ? a : b;
+}
+
+static void run_range(const struct range_part *part, long lo, long hi)
+{
+    struct range_loop *loop = part->loop;
+    if (loop->indexed_func != nullptr)
+        loop->indexed_func(loop->ctx, part->index, lo, hi);
+    else
+        loop->range_func(loop->ctx, lo, hi);
+}
+
+static void run_range_part(void *ctx)
+{
+    struct range_part *part = ctx;
+    struct range_loop *loop = part->loop;
+    long begin = loop->begin;
+    long end = loop->end;
+    long chunk = loop->chunk;
+    long participants = (long)loop->participants;
+
+    switch (loop->schedule)
+    {
+    case PARALLEL_SCHEDULE_STATIC:
+        if (chunk == 0)
+        {
+            long block = (end - begin + participants - 1) / participants;
+            long lo = begin + (long)part->index * block;
+            if (lo < end)
+                run_range(part, lo, min_long(lo + block, end));
+            break;
+        }
+        for (long lo = begin + (long)part->index * chunk; lo < end; lo += participants * chunk)
+            run_range(part, lo, min_long(lo + chunk, end));
+        break;
+
+    case PARALLEL_SCHEDULE_DYNAMIC:
+        for (;;)
+        {
+            long lo = atomic_fetch_add(&loop->next, chunk);
+            if (lo >= end)
+                break;
+            run_range(part, lo, min_long(lo + chunk, end));
+        }
+        break;
+
+    case PARALLEL_SCHEDULE_GUIDED:
+        for (;;)
+        {
+            long lo = atomic_load(&loop->next);
+            long size;
+            do
+            {
+                if (lo >= end)
+                    return;
+                size = (end - lo + participants - 1) / participants;
+                if (size < chunk)
+                    size = chunk;
+            } while (!atomic_compare_exchange_weak(&loop->next, &lo, lo + size));
+            run_range(part, lo, min_long(lo + size, end));
+        }
+        break;
+    }
+}
+
+// Splits [begin, end) into one part per worker; the calling thread runs part 0 itself
+// and waits for the others on a single latch. chunk == 0 means one contiguous block per
+// part for static, and 1 for dynamic and guided (where it is the minimum chunk size).
+static void run_range_loop(struct task_sched *task_sched, struct range_loop *loop)
+{
+    if (loop->begin >= loop->end)
+        return;
+
+    if (loop->chunk <= 0)
+        loop->chunk = loop->schedule == PARALLEL_SCHEDULE_STATIC ? 0 : 1;
+    loop->participants = task_sched->worker_count;
+    atomic_init(&loop->next, loop->begin);
+
+    size_t helpers = loop->participants - 1;
+    struct range_part *parts = newarr(struct range_part, loop->participants);
+    struct task *tasks = newarr(struct task, helpers + 1);
+    struct latch latch;
+    latch_init(&latch, (unsigned int)helpers);
+
+    for (size_t i = 0; i < loop->participants; i++)
+    {
+        parts[i].loop = loop;
+        parts[i].index = i;
+    }
+
+    for (size_t i = 0; i < helpers; i++)
+    {
+        task_init_latch(&tasks[i], run_range_part, &parts[i + 1], &latch);
+        run_task(task_sched, &tasks[i]);
+    }
+
+    run_range_part(&parts[0]);
+    latch_wait(&latch, task_sched->spin_count);
+
+    free(tasks);
+    free(parts);
+}
+
+void parallel_for_range(struct task_sched *task_sched,
+                        long begin,
+                        long end,
+                        void (*range_func)(void *ctx, long begin, long end),
+                        void *ctx,
+                        enum parallel_schedule schedule,
+                        long chunk)
+{
+    struct range_loop loop = {
+        .range_func = range_func,
+        .ctx = ctx,
+        .begin = begin,
+        .end = end,
+        .chunk = chunk,
+        .schedule = schedule,
+    };
+    run_range_loop(task_sched, &loop);
+}
+
+void parallel_for_range_indexed(struct task_sched *task_sched,
+                                long begin,
+                                long end,
+                                void (*range_func)(void *ctx, size_t part, long begin, long end),
+                                void *ctx,
+                                enum parallel_schedule schedule,
+                                long chunk)
+{
+    struct range_loop loop = {
+        .indexed_func = range_func,
+        .ctx = ctx,
+        .begin = begin,
+        .end = end,
+        .chunk = chunk,
+        .schedule = schedule,
+    };
+    run_range_loop(task_sched, &loop);
+}
+
+size_t parallel_participants(const struct task_sched *task_sched)
+{
+    return task_sched->worker_count;
+}
+
+#define REDUCE_DEFAULT_GRAIN 4096
+#define CACHE_LINE_SIZE 64
+
+struct reduce_data
+{
+    void (*range_func)(void *ctx, long begin, long end, void *acc);
+    void *ctx;
+    const struct reduce_op *op;
+    long begin;
+    long end;
+    long grain;
+    size_t stride;
+    unsigned char *slots;
+};
+
+static void reduce_blocks(void *arg, long first, long last)
+{
+    struct reduce_data *data = arg;
+
+    for (long block = first; block < last; block++)
+    {
+        void *acc = data->slots + (size_t)block * data->stride;
+        long lo = data->begin + block * data->grain;
+        long hi = min_long(lo + data->grain, data->end);
+        data->op->identity(acc);
+        data->range_func(data->ctx, lo, hi, acc);
+    }
+}
+
+// The range is cut into fixed grain-sized blocks, each reduced into its own cache-line
+// padded slot, and the slots are combined pairwise in a fixed tree. The combine order
+// depends only on the range and the grain, so float results do not change with the
+// worker count or with which worker happened to take which block.
+void parallel_reduce(struct task_sched *task_sched,
+                     long begin,
+                     long end,
+                     long grain,
+                     void (*range_func)(void *ctx, long begin, long end, void *acc),
+                     void *ctx,
+                     const struct reduce_op *op,
+                     void *result)
+{
+    if (begin >= end)
+    {
+        op->identity(result);
+        return;
+    }
+
+    if (grain <= 0)
+        grain = REDUCE_DEFAULT_GRAIN;
+
+    long blocks = (end - begin + grain - 1) / grain;
+    size_t stride = (op->size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+
+    struct reduce_data data = {
+        .range_func = range_func,
+        .ctx = ctx,
+        .op = op,
+        .begin = begin,
+        .end = end,
+        .grain = grain,
+        .stride = stride,
+        .slots = newarr_aligned(unsigned char, (size_t)blocks * stride, CACHE_LINE_SIZE),
+    };
+
+    parallel_for_range(task_sched, 0, blocks, reduce_blocks, &data, PARALLEL_SCHEDULE_DYNAMIC, 1);
+
+    for (long width = 1; width < blocks; width *= 2)
+    {
+        for (long i = 0; i + width < blocks; i += 2 * width)
+        {
+            op->combine(data.slots + (size_t)i * stride, data.slots + (size_t)(i + width) * stride);
+        }
+    }
+
+    memcpy(result, data.slots, op->size);
+    free(data.slots);
+}
+
+void parallel_for_n_mode(int start,
+                         int step,
+                         int end,
+                         void (*iter_func)(void *),
+                         void *ctx,
+                         size_t worker_count,
+                         enum task_sched_mode mode)
+{
+    struct task_sched task_sched;
+    task_sched_init_mode(&task_sched, worker_count, 0, mode);
+    parallel_for_sched(&task_sched, start, step, end, iter_func, ctx);
+    task_sched_uninit(&task_sched);
+}
+
+void parallel_for_n(int start,
+                    int step,
+                    int end,
+                    void (*iter_func)(void *),
+                    void *ctx,
+                    size_t worker_count)
+{
+    parallel_for_n_mode(start, step, end, iter_func, ctx, worker_count, TASK_SCHED_FIFO);
+}
+
 void parallel_for(int start,
                   int step,
                   int end,
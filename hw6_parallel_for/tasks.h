@@ -1,9 +1,14 @@
 #ifndef TASKS_H
 #define TASKS_H
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <pthread.h>
 
+#include "futex.h"
+#include "mpmc_queue.h"
+#include "ws_deque.h"
+
 enum task_status
 {
     TASK_STATUS_CREATED,
@@ -18,6 +23,7 @@ struct task
     enum task_status status;
     pthread_mutex_t status_lock;
     pthread_cond_t status_cond;
+    struct latch *latch;
 };
 
 struct task_queue
@@ -33,11 +39,34 @@ struct task_queue
     pthread_cond_t dequeue_cond;
 };
 
+enum task_sched_mode
+{
+    TASK_SCHED_FIFO,
+    TASK_SCHED_WORK_STEALING
+};
+
+struct task_sched;
+
+struct task_worker
+{
+    struct task_sched *sched;
+    struct ws_deque deque;
+    size_t index;
+    unsigned int seed;
+};
+
 struct task_sched
 {
-    struct task_queue task_queue;
+    enum task_sched_mode mode;
+    struct mpmc_queue task_queue;
+    struct task_worker *worker_ctx;
     pthread_t *workers;
     size_t worker_count;
+    atomic_size_t pending;
+    atomic_size_t sleepers;
+    atomic_int shutdown;
+    atomic_uint wake_seq;
+    size_t spin_count;
 };
 
 struct iter_data
@@ -46,17 +75,87 @@ struct iter_data
     int i;
 };
 
+enum parallel_schedule
+{
+    PARALLEL_SCHEDULE_STATIC,
+    PARALLEL_SCHEDULE_DYNAMIC,
+    PARALLEL_SCHEDULE_GUIDED
+};
+
 struct task *task_create(void (*func)(void *), void *ctx);
 void task_init(struct task *task, void (*func)(void *), void *ctx);
+void task_init_latch(struct task *task, void (*func)(void *), void *ctx, struct latch *latch);
+void task_uninit(struct task *task);
+void task_destroy(struct task *task);
+
+void task_queue_init(struct task_queue *task_queue, size_t max_depth);
+void task_queue_destroy(struct task_queue *task_queue);
+void task_queue_enqueue(struct task_queue *task_queue, struct task *task);
+struct task *task_queue_dequeue(struct task_queue *task_queue);
+struct task *task_queue_try_dequeue(struct task_queue *task_queue);
+void task_queue_shutdown(struct task_queue *task_queue);
 
 void task_sched_init(struct task_sched *sched,
                      size_t worker_count,
                      size_t task_queue_max_depth);
+void task_sched_init_mode(struct task_sched *sched,
+                          size_t worker_count,
+                          size_t task_queue_max_depth,
+                          enum task_sched_mode mode);
 void task_sched_uninit(struct task_sched *sched);
 
+struct task_sched *task_sched_create(size_t worker_count,
+                                     size_t task_queue_max_depth,
+                                     enum task_sched_mode mode);
+void task_sched_destroy(struct task_sched *sched);
+
 void run_task(struct task_sched *task_sched, struct task *task);
+struct task *task_sched_submit(struct task_sched *task_sched, void (*func)(void *), void *ctx);
 void await_task(struct task *task);
 
+void parallel_for_sched(struct task_sched *task_sched,
+                        int start,
+                        int step,
+                        int end,
+                        void (*iter_func)(void *),
+                        void *ctx);
+
+void parallel_for_range(struct task_sched *task_sched,
+                        long begin,
+                        long end,
+                        void (*range_func)(void *ctx, long begin, long end),
+                        void *ctx,
+                        enum parallel_schedule schedule,
+                        long chunk);
+
+// parallel_for_range that also passes the part running each range, below
+// parallel_participants(task_sched). A part runs on one thread at a time, so
+// scratch indexed by part needs no locking and can be allocated once per loop.
+void parallel_for_range_indexed(struct task_sched *task_sched,
+                                long begin,
+                                long end,
+                                void (*range_func)(void *ctx, size_t part, long begin, long end),
+                                void *ctx,
+                                enum parallel_schedule schedule,
+                                long chunk);
+size_t parallel_participants(const struct task_sched *task_sched);
+
+struct reduce_op
+{
+    size_t size;
+    void (*identity)(void *acc);
+    void (*combine)(void *acc, const void *other);
+};
+
+void parallel_reduce(struct task_sched *task_sched,
+                     long begin,
+                     long end,
+                     long grain,
+                     void (*range_func)(void *ctx, long begin, long end, void *acc),
+                     void *ctx,
+                     const struct reduce_op *op,
+                     void *result);
+
 void parallel_for(int start,
                   int step,
                   int end,
@@ -70,4 +169,12 @@ void parallel_for_n(int start,
                     void *ctx,
                     size_t worker_count);
 
+void parallel_for_n_mode(int start,
+                         int step,
+                         int end,
+                         void (*iter_func)(void *),
+                         void *ctx,
+                         size_t worker_count,
+                         enum task_sched_mode mode);
+
 #endif // TASKS_H
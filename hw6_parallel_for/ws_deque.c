@@ -0,0 +1,117 @@
+#include "ws_deque.h"
+
+#include <stdlib.h>
+
+#include "../core/util.h"
+
+#define WS_DEQUE_DEFAULT_CAPACITY 64
+
+static struct ws_array *ws_array_create(long capacity, struct ws_array *prev)
+{
+    struct ws_array *array = safe_alloc(1, sizeof(struct ws_array) + capacity * sizeof(array->slots[0]), false);
+    array->capacity = capacity;
+    array->prev = prev;
+    return array;
+}
+
+static struct task *ws_array_get(struct ws_array *array, long index)
+{
+    return atomic_load_explicit(&array->slots[index & (array->capacity - 1)], memory_order_relaxed);
+}
+
+static void ws_array_put(struct ws_array *array, long index, struct task *task)
+{
+    atomic_store_explicit(&array->slots[index & (array->capacity - 1)], task, memory_order_relaxed);
+}
+
+void ws_deque_init(struct ws_deque *deque, size_t capacity)
+{
+    long rounded = WS_DEQUE_DEFAULT_CAPACITY;
+    while ((size_t)rounded < capacity)
+        rounded *= 2;
+
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->array, ws_array_create(rounded, NULL));
+}
+
+void ws_deque_destroy(struct ws_deque *deque)
+{
+    struct ws_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    while (array != NULL)
+    {
+        struct ws_array *prev = array->prev;
+        free(array);
+        array = prev;
+    }
+    atomic_store_explicit(&deque->array, NULL, memory_order_relaxed);
+}
+
+// Old arrays stay reachable through prev until destroy, since a thief may still be reading them.
+static struct ws_array *ws_deque_grow(struct ws_deque *deque, struct ws_array *array, long top, long bottom)
+{
+    struct ws_array *grown = ws_array_create(array->capacity * 2, array);
+    for (long i = top; i < bottom; i++)
+        ws_array_put(grown, i, ws_array_get(array, i));
+    atomic_store_explicit(&deque->array, grown, memory_order_release);
+    return grown;
+}
+
+void ws_deque_push(struct ws_deque *deque, struct task *task)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    struct ws_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+    if (bottom - top > array->capacity - 1)
+        array = ws_deque_grow(deque, array, top, bottom);
+
+    ws_array_put(array, bottom, task);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+struct task *ws_deque_take(struct ws_deque *deque)
+{
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    struct ws_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    struct task *task = ws_array_get(array, bottom);
+    if (top == bottom)
+    {
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed))
+            task = NULL;
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+enum ws_steal_result ws_deque_steal(struct ws_deque *deque, struct task **task)
+{
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+        return WS_STEAL_EMPTY;
+
+    struct ws_array *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+    struct task *stolen = ws_array_get(array, top);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return WS_STEAL_ABORT;
+
+    *task = stolen;
+    return WS_STEAL_SUCCESS;
+}
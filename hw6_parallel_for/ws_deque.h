@@ -0,0 +1,39 @@
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+struct task;
+
+struct ws_array
+{
+    long capacity;
+    struct ws_array *prev;
+    _Atomic(struct task *) slots[];
+};
+
+// Chase–Lev work-stealing deque: the owner pushes and takes at the bottom,
+// thieves steal from the top.
+struct ws_deque
+{
+    atomic_long top;
+    atomic_long bottom;
+    _Atomic(struct ws_array *) array;
+};
+
+enum ws_steal_result
+{
+    WS_STEAL_SUCCESS,
+    WS_STEAL_EMPTY,
+    WS_STEAL_ABORT
+};
+
+void ws_deque_init(struct ws_deque *deque, size_t capacity);
+void ws_deque_destroy(struct ws_deque *deque);
+
+void ws_deque_push(struct ws_deque *deque, struct task *task);
+struct task *ws_deque_take(struct ws_deque *deque);
+enum ws_steal_result ws_deque_steal(struct ws_deque *deque, struct task **task);
+
+#endif // WS_DEQUE_H
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include "core/cpu.h"
+
 void add(const float *a,
          const float *b,
          float *result,
@@ -17,12 +19,29 @@ void add(const float *a,
     }
 }
 
-void vadd(const float *a,
-          const float *b,
-          float *result,
-          size_t len)
+[[gnu::target("sse4.2")]] static void vadd_sse42(const float *a,
+                                                 const float *b,
+                                                 float *result,
+                                                 size_t len)
+{
+    size_t i = 0;
+    for (; i + 4 <= len; i += 4)
+    {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+
+        _mm_storeu_ps(result + i, _mm_add_ps(va, vb));
+    }
+    add(a + i, b + i, result + i, len - i);
+}
+
+[[gnu::target("avx2")]] static void vadd_avx2(const float *a,
+                                              const float *b,
+                                              float *result,
+                                              size_t len)
 {
-    for (size_t i = 0; i < len; i += 8)
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
     {
         __m256 va = _mm256_loadu_ps(a + i);
         __m256 vb = _mm256_loadu_ps(b + i);
@@ -30,6 +49,45 @@ void vadd(const float *a,
         __m256 vresult = _mm256_add_ps(va, vb);
         _mm256_storeu_ps(result + i, vresult);
     }
+    add(a + i, b + i, result + i, len - i);
+}
+
+// The tail is a masked load and store instead of a scalar loop.
+[[gnu::target("avx512f")]] static void vadd_avx512(const float *a,
+                                                  const float *b,
+                                                  float *result,
+                                                  size_t len)
+{
+    for (size_t i = 0; i < len; i += 16)
+    {
+        __mmask16 m = len - i >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (len - i)) - 1);
+        __m512 va = _mm512_maskz_loadu_ps(m, a + i);
+        __m512 vb = _mm512_maskz_loadu_ps(m, b + i);
+
+        _mm512_mask_storeu_ps(result + i, m, _mm512_add_ps(va, vb));
+    }
+}
+
+// Bound once at startup to the widest variant the CPU runs.
+void (*vadd)(const float *a, const float *b, float *result, size_t len) = add;
+
+[[gnu::constructor]] static void vadd_dispatch(void)
+{
+    switch (cpu_level())
+    {
+    case CPU_LEVEL_AVX512:
+        vadd = vadd_avx512;
+        break;
+    case CPU_LEVEL_AVX2:
+        vadd = vadd_avx2;
+        break;
+    case CPU_LEVEL_SSE42:
+        vadd = vadd_sse42;
+        break;
+    default:
+        vadd = add;
+        break;
+    }
 }
 
 #define BENCH(func, iter_count)                                 \
@@ -64,6 +122,7 @@ int main()
         b[i] = i;
     }
 
+    printf("vadd: %s\n", cpu_level_name(cpu_level()));
     BENCH(add(a, b, result, N), 10'000);
     BENCH(vadd(a, b, result, N), 10'000);
 
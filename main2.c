@@ -1,53 +1,43 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <math.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+
+#include "hw6_parallel_for/tasks.h"
 
 struct context {
   long *a;
-  int size;
-  long start;
-  long end;
 };
 
-void *calc(void *arg) {
+static void long_identity(void *acc) { *(long *)acc = 0; }
+
+static void long_combine(void *acc, const void *other) {
+  *(long *)acc += *(const long *)other;
+}
+
+static void calc(void *arg, long start, long end, void *acc) {
   struct context *ctx = (struct context *)arg;
-  long *sum = malloc(sizeof(long));
-  *sum = 0;
-  for (int i = ctx->start; i < ctx->end; i++) {
+  long *sum = acc;
+  for (long i = start; i < end; i++) {
     for (int j = 0; j < 10000; j++) {
       *sum += pow(cos(sin((float)ctx->a[i])), 10);
     }
   }
-  return (void *)sum;
 }
 
 int main() {
-  int proc_count = 1000;
-  pthread_t threads[proc_count];
-  struct context ctx[proc_count];
   long size = 1000000;
   long *a = malloc(size * sizeof(long));
   for (int i = 0; i < size; i++) {
     a[i] = i + 1;
   }
-  for (int i = 0; i < proc_count; i++) {
-    ctx[i].start = i * (size / proc_count);
-    ctx[i].end = (i + 1) * (size / proc_count);
-    ctx[i].a = a;
-    pthread_create(&threads[i], NULL, calc, &ctx[i]);
-  }
+  struct context ctx = {a};
+  const struct reduce_op op = {sizeof(long), long_identity, long_combine};
+  struct task_sched *sched = task_sched_create(0, 0, TASK_SCHED_WORK_STEALING);
   long total_sum = 0;
-  for (int i = 0; i < proc_count; i++) {
-    long *thread_sum;
-    pthread_join(threads[i], (void **)&thread_sum);
-    total_sum += *thread_sum;
-    printf("Thread %d sum: %ld\n", i, *thread_sum);
-    free(thread_sum);
-  }
+  parallel_reduce(sched, 0, size, size / 1000, calc, &ctx, &op, &total_sum);
+  task_sched_destroy(sched);
   printf("Total sum: %ld\n", total_sum);
   long one_thread_sum = 0;
   for (int i = 0; i < size; i++) {
@@ -1,19 +1,57 @@
+import json
 import math
 import sys
 from pathlib import Path
 
-def load_table(path):
+def structured_records(lines):
+    """CSV rows under a "tag,label,..." header and JSON lines, wherever they
+    are in the output, or None when there are neither. Other lines, such as the
+    "#" notes benchmarks print before their first row, are skipped."""
+    header = None
+    records = []
+    for line in lines:
+        if line.startswith("tag,label,"):
+            header = line.split(",")
+        elif line.startswith("{"):
+            records.append(json.loads(line))
+        elif header and not line.startswith("#"):
+            fields = line.split(",")
+            if len(fields) == len(header):
+                records.append(dict(zip(header, fields)))
+    return records if header or records else None
+
+def load_table(path, tag=""):
+    """Reads "[tag] size scalar vector" text lines, or the CSV or JSON lines that
+    BENCH_FORMAT=csv|json produce, taking median times. Only lines whose tag
+    matches are kept; untagged ones by default."""
     sizes = []
     scalar = []
     vector = []
     with open(path, "r", encoding="utf-8") as file:
-        for line in file:
-            parts = line.strip().split()
-            if len(parts) != 3:
+        lines = [line.strip() for line in file if line.strip()]
+    records = structured_records(lines)
+    if records is None:
+        words = tag.split()
+        for line in lines:
+            if line.startswith("#"):
+                continue
+            parts = line.split()
+            if len(parts) != len(words) + 3 or parts[:len(words)] != words:
                 continue
-            sizes.append(int(parts[0]))
-            scalar.append(float(parts[1]))
-            vector.append(float(parts[2]))
+            sizes.append(int(parts[-3]))
+            scalar.append(float(parts[-2]))
+            vector.append(float(parts[-1]))
+        return sizes, scalar, vector
+
+    for record in records:
+        if record["tag"] != tag:
+            continue
+        value = float(record["median_ms"])
+        if record["variant"] == "scalar":
+            sizes.append(int(record["label"]))
+            scalar.append(value)
+        else:
+            vector.append(value)
     return sizes, scalar, vector
 
 def scale(values, start, end):
@@ -60,13 +98,21 @@ def make_svg(path, sizes, scalar, vector, title):
         file.write("</svg>")
 
 def main():
-    if len(sys.argv) < 4:
-        print("usage: plot.py RESULTS OUTPUT TITLE...", file=sys.stderr)
+    args = sys.argv[1:]
+    tag = ""
+    if len(args) >= 2 and args[0] == "--tag":
+        tag = args[1]
+        args = args[2:]
+    if len(args) < 3:
+        print("usage: plot.py [--tag TAG] RESULTS OUTPUT TITLE...", file=sys.stderr)
+        return 1
+    results = Path(args[0])
+    output = Path(args[1])
+    title = " ".join(args[2:])
+    sizes, scalar, vector = load_table(results, tag)
+    if not sizes:
+        print(f"no rows tagged '{tag}' in {results}", file=sys.stderr)
         return 1
-    results = Path(sys.argv[1])
-    output = Path(sys.argv[2])
-    title = " ".join(sys.argv[3:])
-    sizes, scalar, vector = load_table(results)
     make_svg(output, sizes, scalar, vector, title)
     return 0
 
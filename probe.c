@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <immintrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "core/bench.h"
+#include "core/cpu.h"
+#include "core/util.h"
+#include "hw6_parallel_for/tasks.h"
+
+// Floats per STREAM array: three arrays of 64 MiB are well past any last-level
+// cache, so the loops run at memory bandwidth.
+#define STREAM_LEN (1 << 24)
+// Independent accumulator chains per thread, enough to cover FMA latency on
+// two ports of current cores.
+#define FMA_CHAINS 12
+#define FMA_STEPS 20000
+
+enum stream_kernel
+{
+    STREAM_COPY,
+    STREAM_SCALE,
+    STREAM_ADD,
+    STREAM_TRIAD
+};
+
+struct stream_ctx
+{
+    float *a;
+    float *b;
+    float *c;
+    enum stream_kernel kernel;
+};
+
+struct fma_ctx
+{
+    float *sums;
+};
+
+static const char *const stream_names[] = {"copy", "scale", "add", "triad"};
+// Arrays each kernel reads or writes; write-allocate traffic is not counted,
+// as in STREAM.
+static const int stream_arrays[] = {2, 2, 3, 3};
+
+// Kernel for the CPU level and the floats in its vectors.
+static float (*fma_run)(size_t steps);
+static size_t fma_lanes;
+
+// Kept out of the vectorizer, which would otherwise pack the chains into SIMD
+// registers and report a multiple of the scalar peak.
+[[gnu::optimize("no-tree-vectorize")]] static float fma_scalar(size_t steps)
+{
+    float acc[FMA_CHAINS];
+    for (int c = 0; c < FMA_CHAINS; c++)
+        acc[c] = (float)c;
+    for (size_t s = 0; s < steps; s++)
+    {
+        for (int c = 0; c < FMA_CHAINS; c++)
+            acc[c] = acc[c] * 0.999999f + 1.0e-6f;
+    }
+    float sum = 0.0f;
+    for (int c = 0; c < FMA_CHAINS; c++)
+        sum += acc[c];
+    return sum;
+}
+
+// No FMA before AVX2: a multiply and an add, still two operations per lane.
+[[gnu::target("sse4.2")]] static float fma_sse42(size_t steps)
+{
+    __m128 acc[FMA_CHAINS];
+    __m128 x = _mm_set1_ps(0.999999f);
+    __m128 y = _mm_set1_ps(1.0e-6f);
+    for (int c = 0; c < FMA_CHAINS; c++)
+        acc[c] = _mm_set1_ps((float)c);
+    for (size_t s = 0; s < steps; s++)
+    {
+#pragma GCC unroll 12
+        for (int c = 0; c < FMA_CHAINS; c++)
+            acc[c] = _mm_add_ps(_mm_mul_ps(acc[c], x), y);
+    }
+    __m128 sum = acc[0];
+    for (int c = 1; c < FMA_CHAINS; c++)
+        sum = _mm_add_ps(sum, acc[c]);
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+[[gnu::target("avx2,fma")]] static float fma_avx2(size_t steps)
+{
+    __m256 acc[FMA_CHAINS];
+    __m256 x = _mm256_set1_ps(0.999999f);
+    __m256 y = _mm256_set1_ps(1.0e-6f);
+    for (int c = 0; c < FMA_CHAINS; c++)
+        acc[c] = _mm256_set1_ps((float)c);
+    for (size_t s = 0; s < steps; s++)
+    {
+#pragma GCC unroll 12
+        for (int c = 0; c < FMA_CHAINS; c++)
+            acc[c] = _mm256_fmadd_ps(acc[c], x, y);
+    }
+    __m256 sum = acc[0];
+    for (int c = 1; c < FMA_CHAINS; c++)
+        sum = _mm256_add_ps(sum, acc[c]);
+    float lanes[8];
+    _mm256_storeu_ps(lanes, sum);
+    float total = 0.0f;
+    for (int i = 0; i < 8; i++)
+        total += lanes[i];
+    return total;
+}
+
+[[gnu::target("avx512f")]] static float fma_avx512(size_t steps)
+{
+    __m512 acc[FMA_CHAINS];
+    __m512 x = _mm512_set1_ps(0.999999f);
+    __m512 y = _mm512_set1_ps(1.0e-6f);
+    for (int c = 0; c < FMA_CHAINS; c++)
+        acc[c] = _mm512_set1_ps((float)c);
+    for (size_t s = 0; s < steps; s++)
+    {
+#pragma GCC unroll 12
+        for (int c = 0; c < FMA_CHAINS; c++)
+            acc[c] = _mm512_fmadd_ps(acc[c], x, y);
+    }
+    __m512 sum = acc[0];
+    for (int c = 1; c < FMA_CHAINS; c++)
+        sum = _mm512_add_ps(sum, acc[c]);
+    return _mm512_reduce_add_ps(sum);
+}
+
+[[gnu::constructor]] static void probe_dispatch(void)
+{
+    switch (cpu_level())
+    {
+    case CPU_LEVEL_AVX512:
+        fma_run = fma_avx512;
+        fma_lanes = 16;
+        break;
+    case CPU_LEVEL_AVX2:
+        fma_run = fma_avx2;
+        fma_lanes = 8;
+        break;
+    case CPU_LEVEL_SSE42:
+        fma_run = fma_sse42;
+        fma_lanes = 4;
+        break;
+    default:
+        fma_run = fma_scalar;
+        fma_lanes = 1;
+        break;
+    }
+}
+
+static void fma_threads(void *arg, long begin, long end)
+{
+    struct fma_ctx *ctx = arg;
+    for (long i = begin; i < end; i++)
+        ctx->sums[i] = fma_run(FMA_STEPS);
+}
+
+static void stream_range(void *arg, long begin, long end)
+{
+    struct stream_ctx *ctx = arg;
+    float *a = ctx->a, *b = ctx->b, *c = ctx->c;
+    const float s = 3.0f;
+    switch (ctx->kernel)
+    {
+    case STREAM_COPY:
+        for (long i = begin; i < end; i++)
+            c[i] = a[i];
+        break;
+    case STREAM_SCALE:
+        for (long i = begin; i < end; i++)
+            b[i] = s * c[i];
+        break;
+    case STREAM_ADD:
+        for (long i = begin; i < end; i++)
+            c[i] = a[i] + b[i];
+        break;
+    case STREAM_TRIAD:
+        for (long i = begin; i < end; i++)
+            a[i] = b[i] + s * c[i];
+        break;
+    }
+}
+
+static void stream_init(void *arg, long begin, long end)
+{
+    struct stream_ctx *ctx = arg;
+    for (long i = begin; i < end; i++)
+    {
+        ctx->a[i] = 1.0f;
+        ctx->b[i] = 2.0f;
+        ctx->c[i] = 0.0f;
+    }
+}
+
+static void probe(size_t threads, struct stream_ctx *stream)
+{
+    struct task_sched *sched = task_sched_create(threads, 0, TASK_SCHED_WORK_STEALING);
+
+    struct fma_ctx fma = {newarr(float, threads)};
+    struct bench_stats stats;
+    BENCH_MEASURE(&stats, parallel_for_range(sched, 0, (long)threads, fma_threads, &fma, PARALLEL_SCHEDULE_STATIC, 1));
+    bench_do_not_optimize(fma.sums);
+    double flops = 2.0 * (double)(FMA_STEPS * FMA_CHAINS * fma_lanes * threads);
+    printf("fma %s %zu %.3f\n", cpu_level_name(cpu_level()), threads, flops / (stats.median_ms * 1.0e6));
+    free(fma.sums);
+
+    // First touch from the same threads that run the kernels.
+    parallel_for_range(sched, 0, STREAM_LEN, stream_init, stream, PARALLEL_SCHEDULE_STATIC, 0);
+    for (int k = STREAM_COPY; k <= STREAM_TRIAD; k++)
+    {
+        stream->kernel = (enum stream_kernel)k;
+        BENCH_MEASURE(&stats, parallel_for_range(sched, 0, STREAM_LEN, stream_range, stream, PARALLEL_SCHEDULE_STATIC, 0));
+        double bytes = (double)stream_arrays[k] * STREAM_LEN * sizeof(float);
+        printf("stream %s %zu %.3f\n", stream_names[k], threads, bytes / (stats.median_ms * 1.0e6));
+    }
+
+    task_sched_destroy(sched);
+}
+
+// Prints the compute and bandwidth ceilings report.py draws on rooflines:
+// "fma <level> <threads> <GFLOP/s>" and "stream <kernel> <threads> <GB/s>",
+// for one thread and for every online CPU, or for the given thread count.
+int main(int argc, char **argv)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads[2] = {1, online > 1 ? (size_t)online : 1};
+    size_t runs = threads[1] > 1 ? 2 : 1;
+    if (argc == 2)
+    {
+        threads[0] = (size_t)strtoul(argv[1], nullptr, 10);
+        runs = 1;
+        if (threads[0] == 0)
+            die("probe: thread count must be positive");
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "usage: %s [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct stream_ctx stream = {
+        .a = newarr_aligned(float, STREAM_LEN, 64),
+        .b = newarr_aligned(float, STREAM_LEN, 64),
+        .c = newarr_aligned(float, STREAM_LEN, 64),
+    };
+    for (size_t r = 0; r < runs; r++)
+        probe(threads[r], &stream);
+
+    free(stream.a);
+    free(stream.b);
+    free(stream.c);
+    return EXIT_SUCCESS;
+}
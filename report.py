@@ -0,0 +1,331 @@
+import argparse
+import math
+import sys
+from pathlib import Path
+
+from plot import structured_records
+
+COLORS = ["#d62728", "#1f77b4", "#2ca02c", "#ff7f0e", "#9467bd", "#8c564b", "#e377c2", "#17becf"]
+
+def number(text):
+    try:
+        return float(text)
+    except ValueError:
+        return None
+
+def load_records(path):
+    """Benchmark rows as dicts with tag, label, variant and median_ms. CSV and JSON
+    output (BENCH_FORMAT) also carries counters and derived figures; text lines
+    "[tag] label scalar vector" give medians only."""
+    with open(path, "r", encoding="utf-8") as file:
+        lines = [line.strip() for line in file if line.strip()]
+    records = structured_records(lines)
+    if records is not None:
+        for record in records:
+            for key, value in record.items():
+                if isinstance(value, str) and key not in ("tag", "variant"):
+                    record[key] = number(value) if value else None
+    else:
+        records = []
+        for line in lines:
+            parts = line.split()
+            if line.startswith("#") or len(parts) < 3 or not parts[-3].isdigit():
+                continue
+            tag = " ".join(parts[:-3])
+            for variant, value in (("scalar", parts[-2]), ("vector", parts[-1])):
+                records.append({"tag": tag, "label": int(parts[-3]), "variant": variant, "median_ms": float(value)})
+    for record in records:
+        record["label"] = int(record["label"])
+    return records
+
+def record_name(record):
+    tag = f'{record["tag"]} ' if record["tag"] else ""
+    return f'{tag}{record["label"]} {record["variant"]}'
+
+def load_probe(path):
+    """Ceilings printed by probe.c: peak GFLOP/s and STREAM GB/s by thread count."""
+    fma = {}
+    stream = {}
+    with open(path, "r", encoding="utf-8") as file:
+        for line in file:
+            parts = line.split()
+            if len(parts) != 4:
+                continue
+            if parts[0] == "fma":
+                fma[int(parts[2])] = float(parts[3])
+            elif parts[0] == "stream":
+                stream.setdefault(parts[1], {})[int(parts[2])] = float(parts[3])
+    return fma, stream
+
+def load_scaling(path):
+    """Strong scaling as speedups and weak scaling as times, both keyed by series
+    name and worker count. Reads the hw6 benchmark lines ("M N speedup [stealing]",
+    "range", "weak", "reduce") and the hw3 "file first|all" rows; reduce speedups
+    are taken against the smallest worker count, file speedups against the
+    calling thread alone."""
+    strong = {}
+    times = {}
+    weak = {}
+    with open(path, "r", encoding="utf-8") as file:
+        for line in file:
+            parts = line.split()
+            if not parts:
+                continue
+            if parts[0] == "range" and len(parts) == 5:
+                strong.setdefault(f"range {parts[1]} M={parts[2]}", {})[int(parts[3])] = float(parts[4])
+            elif parts[0] == "weak" and len(parts) == 5:
+                weak.setdefault(f"weak n={parts[1]}", {})[int(parts[2])] = float(parts[4])
+            elif parts[0] == "reduce" and len(parts) == 6:
+                times.setdefault("reduce dot", {})[int(parts[1])] = float(parts[2])
+                times.setdefault("reduce trig", {})[int(parts[1])] = float(parts[3])
+            elif parts[0].isdigit() and len(parts) in (3, 4):
+                strong.setdefault(f"fifo M={parts[0]}", {})[int(parts[1])] = float(parts[2])
+                if len(parts) == 4:
+                    strong.setdefault(f"stealing M={parts[0]}", {})[int(parts[1])] = float(parts[3])
+    for name, points in times.items():
+        base = points[min(points)]
+        strong[name] = {workers: base / value for workers, value in points.items()}
+    # hw3 file rows time the calling thread alone as "scalar" and the pool as
+    # "vector", labelled by worker count.
+    alone = {}
+    for record in load_records(path):
+        if record["tag"] in ("file first", "file all"):
+            points = strong if record["variant"] == "vector" else alone
+            points.setdefault(record["tag"], {})[record["label"]] = float(record["median_ms"])
+    for name, points in alone.items():
+        strong[name] = {workers: points[workers] / value for workers, value in strong.get(name, {}).items()
+                        if workers in points}
+    return strong, weak
+
+def write_svg(path, width, height, items):
+    with open(path, "w", encoding="utf-8") as file:
+        file.write(f'<svg xmlns="http://www.w3.org/2000/svg" width="{width}" height="{height}">')
+        file.write(f'<rect width="{width}" height="{height}" fill="white"/>')
+        for item in items:
+            file.write(item)
+        file.write("</svg>")
+
+def axes(items, left, top, right, bottom, x_label, y_label):
+    items.append(f'<line x1="{left}" y1="{bottom}" x2="{right}" y2="{bottom}" stroke="black" stroke-width="2"/>')
+    items.append(f'<line x1="{left}" y1="{top}" x2="{left}" y2="{bottom}" stroke="black" stroke-width="2"/>')
+    items.append(f'<text x="{(left + right) / 2}" y="{bottom + 40}" font-size="14" text-anchor="middle">{x_label}</text>')
+    middle = (top + bottom) / 2
+    items.append(f'<text x="{left - 45}" y="{middle}" font-size="14" text-anchor="middle" transform="rotate(-90 {left - 45} {middle})">{y_label}</text>')
+
+def legend(items, x, y, entries):
+    for idx, (name, color, dash) in enumerate(entries):
+        ly = y + 18 * idx
+        style = f' stroke-dasharray="{dash}"' if dash else ""
+        items.append(f'<line x1="{x}" y1="{ly}" x2="{x + 20}" y2="{ly}" stroke="{color}" stroke-width="2"{style}/>')
+        items.append(f'<text x="{x + 25}" y="{ly + 4}" font-size="11">{name}</text>')
+
+def log_ticks(low, high):
+    return [10.0 ** e for e in range(math.floor(math.log10(low)), math.ceil(math.log10(high)) + 1)
+            if low <= 10.0 ** e <= high]
+
+def roofline(probe_path, results_path, output, threads):
+    fma, stream = load_probe(probe_path)
+    if not fma or "triad" not in stream:
+        print(f"{probe_path}: no fma or stream triad lines", file=sys.stderr)
+        return 1
+    threads = threads if threads in fma else max(fma)
+    peak = fma[threads]
+    bandwidth = stream["triad"].get(threads, max(stream["triad"].values()))
+    ridge = peak / bandwidth
+
+    points = []
+    streaming = []
+    for record in load_records(results_path):
+        gflops = record.get("gflops")
+        gbps = record.get("gb_per_s")
+        if gflops and gbps:
+            points.append((record_name(record), record["variant"], gflops / gbps, gflops))
+        elif gbps:
+            streaming.append((record_name(record), gbps))
+    if not points and not streaming:
+        print(f"{results_path}: no gflops or gb_per_s fields, run with BENCH_FORMAT=csv or json", file=sys.stderr)
+        return 1
+
+    print(f"ceilings ({threads} threads): {peak:.1f} GFLOP/s, {bandwidth:.1f} GB/s, ridge {ridge:.2f} flop/byte")
+    # Kernels without floating-point work can only be held against bandwidth.
+    if streaming:
+        print(f"{'kernel':<40} {'GB/s':>10} {'of STREAM':>10}")
+        for name, gbps in sorted(streaming, key=lambda p: p[1]):
+            print(f"{name:<40} {gbps:>10.2f} {gbps / bandwidth:>9.0%}")
+    if not points:
+        return 0
+    print(f"{'kernel':<40} {'flop/byte':>10} {'GFLOP/s':>10} {'roof':>10} {'of roof':>8}")
+    for name, _, intensity, gflops in sorted(points, key=lambda p: p[3] / min(peak, bandwidth * p[2])):
+        roof = min(peak, bandwidth * intensity)
+        print(f"{name:<40} {intensity:>10.3f} {gflops:>10.2f} {roof:>10.2f} {gflops / roof:>7.0%}")
+
+    width = 800
+    height = 600
+    left, top, right, bottom = 80, 40, width - 40, height - 70
+    x_low = min(min(p[2] for p in points), ridge) / 4
+    x_high = max(max(p[2] for p in points), ridge) * 4
+    y_low = min(min(p[3] for p in points), bandwidth * x_low) / 2
+    y_high = peak * 2
+
+    def x_pos(value):
+        return left + (math.log10(value) - math.log10(x_low)) / (math.log10(x_high) - math.log10(x_low)) * (right - left)
+
+    def y_pos(value):
+        return bottom - (math.log10(value) - math.log10(y_low)) / (math.log10(y_high) - math.log10(y_low)) * (bottom - top)
+
+    items = []
+    axes(items, left, top, right, bottom, "Arithmetic intensity (flop/byte)", "GFLOP/s")
+    for tick in log_ticks(x_low, x_high):
+        items.append(f'<line x1="{x_pos(tick)}" y1="{bottom}" x2="{x_pos(tick)}" y2="{bottom + 6}" stroke="black"/>')
+        items.append(f'<text x="{x_pos(tick)}" y="{bottom + 20}" font-size="12" text-anchor="middle">{tick:g}</text>')
+    for tick in log_ticks(y_low, y_high):
+        items.append(f'<line x1="{left - 6}" y1="{y_pos(tick)}" x2="{left}" y2="{y_pos(tick)}" stroke="black"/>')
+        items.append(f'<text x="{left - 10}" y="{y_pos(tick) + 4}" font-size="12" text-anchor="end">{tick:g}</text>')
+
+    roof = f"{x_pos(x_low)},{y_pos(bandwidth * x_low)} {x_pos(ridge)},{y_pos(peak)} {x_pos(x_high)},{y_pos(peak)}"
+    items.append(f'<polyline points="{roof}" fill="none" stroke="gray" stroke-width="3"/>')
+    items.append(f'<text x="{right}" y="{y_pos(peak) - 8}" font-size="12" text-anchor="end">FMA peak {peak:.1f} GFLOP/s</text>')
+    items.append(f'<text x="{x_pos(x_low) + 5}" y="{y_pos(bandwidth * x_low) - 8}" font-size="12">STREAM triad {bandwidth:.1f} GB/s</text>')
+
+    variants = {"scalar": COLORS[0], "vector": COLORS[1]}
+    for name, variant, intensity, gflops in points:
+        color = variants.get(variant, COLORS[2])
+        items.append(f'<circle cx="{x_pos(intensity)}" cy="{y_pos(gflops)}" r="4" fill="{color}"><title>{name}</title></circle>')
+    legend(items, left + 20, top + 10, [(variant, color, None) for variant, color in variants.items()])
+    write_svg(output, width, height, items)
+    return 0
+
+def scaling(results_path, output):
+    strong, weak = load_scaling(results_path)
+    if not strong and not weak:
+        print(f"{results_path}: no scaling lines", file=sys.stderr)
+        return 1
+
+    efficiency = {}
+    for name, points in strong.items():
+        efficiency[name] = {workers: speedup / workers for workers, speedup in points.items()}
+    for name, points in weak.items():
+        base = points[min(points)]
+        efficiency[name] = {workers: base / value for workers, value in points.items()}
+    print(f"{'series':<24} " + " ".join(f"{'N=' + str(w):>7}" for w in sorted({w for p in efficiency.values() for w in p})))
+    for name, points in efficiency.items():
+        print(f"{name:<24} " + " ".join(f"{points[w]:>7.0%}" if w in points else f"{'':>7}"
+                                        for w in sorted({w for p in efficiency.values() for w in p})))
+
+    width = 1100
+    height = 500
+    panel = 440
+    workers = sorted({w for points in efficiency.values() for w in points})
+    max_speedup = max([max(points.values()) for points in strong.values()] + [workers[-1]])
+    max_efficiency = max(1.0, max(max(points.values()) for points in efficiency.values()))
+
+    def x_pos(left, value):
+        span = workers[-1] - workers[0] or 1
+        return left + (value - workers[0]) / span * panel
+
+    items = []
+    panels = [(80, "Speedup (strong)", max_speedup, strong, workers[-1]),
+              (80 + panel + 100, "Parallel efficiency", max_efficiency, efficiency, 1.0)]
+    for left, title, y_max, series, ideal in panels:
+        top, bottom = 40, height - 70
+
+        def y_pos(value):
+            return bottom - value / y_max * (bottom - top)
+
+        axes(items, left, top, left + panel, bottom, "N (workers)", title)
+        for w in workers:
+            items.append(f'<line x1="{x_pos(left, w)}" y1="{bottom}" x2="{x_pos(left, w)}" y2="{bottom + 6}" stroke="black"/>')
+            items.append(f'<text x="{x_pos(left, w)}" y="{bottom + 20}" font-size="12" text-anchor="middle">{w}</text>')
+        for step in range(6):
+            value = y_max * step / 5
+            items.append(f'<line x1="{left - 6}" y1="{y_pos(value)}" x2="{left}" y2="{y_pos(value)}" stroke="black"/>')
+            items.append(f'<text x="{left - 10}" y="{y_pos(value) + 4}" font-size="12" text-anchor="end">{value:.2g}</text>')
+        if ideal == 1.0:
+            ideal_points = f"{x_pos(left, workers[0])},{y_pos(1.0)} {x_pos(left, workers[-1])},{y_pos(1.0)}"
+        else:
+            ideal_points = " ".join(f"{x_pos(left, w)},{y_pos(w)}" for w in workers)
+        items.append(f'<polyline points="{ideal_points}" fill="none" stroke="gray" stroke-width="2" stroke-dasharray="6,4"/>')
+        for idx, (name, points) in enumerate(series.items()):
+            color = COLORS[idx % len(COLORS)]
+            dash = ' stroke-dasharray="2,3"' if name in weak else ""
+            text = " ".join(f"{x_pos(left, w)},{y_pos(points[w])}" for w in sorted(points))
+            items.append(f'<polyline points="{text}" fill="none" stroke="{color}" stroke-width="2"{dash}/>')
+            for w in sorted(points):
+                items.append(f'<circle cx="{x_pos(left, w)}" cy="{y_pos(points[w])}" r="3" fill="{color}"/>')
+    entries = [("ideal", "gray", "6,4")]
+    entries += [(name, COLORS[idx % len(COLORS)], "2,3" if name in weak else None) for idx, name in enumerate(efficiency)]
+    legend(items, width - 150, 50, entries)
+    write_svg(output, width, height, items)
+    return 0
+
+def compare(base_path, new_path, output, threshold):
+    base = {(r["tag"], r["label"], r["variant"]): r["median_ms"] for r in load_records(base_path)}
+    rows = []
+    for record in load_records(new_path):
+        key = (record["tag"], record["label"], record["variant"])
+        if key in base and base[key] > 0:
+            rows.append((record_name(record), base[key], record["median_ms"], record["median_ms"] / base[key] - 1.0))
+    if not rows:
+        print(f"no rows in common between {base_path} and {new_path}", file=sys.stderr)
+        return 1
+
+    regressions = 0
+    print(f"{'benchmark':<40} {'base ms':>12} {'new ms':>12} {'change':>8}")
+    for name, old, new, change in rows:
+        mark = ""
+        if change > threshold:
+            mark = "  regression"
+            regressions += 1
+        elif change < -threshold:
+            mark = "  faster"
+        print(f"{name:<40} {old:>12.6f} {new:>12.6f} {change:>+8.1%}{mark}")
+    print(f"{regressions} of {len(rows)} slower by more than {threshold:.0%}")
+
+    if output:
+        width = 800
+        row = 18
+        height = 80 + row * len(rows)
+        middle = 520
+        limit = max(max(abs(change) for *_, change in rows), threshold) * 1.1
+        items = []
+        items.append(f'<line x1="{middle}" y1="30" x2="{middle}" y2="{height - 30}" stroke="black"/>')
+        for sign in (-1, 1):
+            x = middle + sign * threshold / limit * 250
+            items.append(f'<line x1="{x}" y1="30" x2="{x}" y2="{height - 30}" stroke="gray" stroke-dasharray="4,4"/>')
+        for idx, (name, _, _, change) in enumerate(rows):
+            y = 40 + row * idx
+            x = middle + change / limit * 250
+            color = COLORS[0] if change > threshold else COLORS[2] if change < -threshold else "gray"
+            items.append(f'<rect x="{min(x, middle)}" y="{y}" width="{abs(x - middle)}" height="{row - 4}" fill="{color}"/>')
+            items.append(f'<text x="{middle - 260}" y="{y + row - 6}" font-size="11" text-anchor="end">{name}</text>')
+            items.append(f'<text x="{max(x, middle) + 4}" y="{y + row - 6}" font-size="11">{change:+.1%}</text>')
+        items.append(f'<text x="{middle}" y="20" font-size="14" text-anchor="middle">Median time change, new vs base</text>')
+        write_svg(output, width, height, items)
+    return 1 if regressions else 0
+
+def main():
+    parser = argparse.ArgumentParser(description="Roofline, scaling and regression reports from benchmark output.")
+    commands = parser.add_subparsers(dest="command", required=True)
+    command = commands.add_parser("roofline", help="kernels against probe.c ceilings")
+    command.add_argument("probe")
+    command.add_argument("results")
+    command.add_argument("output")
+    command.add_argument("--threads", type=int, default=0, help="probe thread count to take ceilings from")
+    command = commands.add_parser("scaling", help="strong and weak scaling with parallel efficiency")
+    command.add_argument("results")
+    command.add_argument("output")
+    command = commands.add_parser("compare", help="median time change between two runs")
+    command.add_argument("base")
+    command.add_argument("new")
+    command.add_argument("output", nargs="?")
+    command.add_argument("--threshold", type=float, default=5.0, help="percent slowdown counted as a regression")
+    args = parser.parse_args()
+
+    if args.command == "roofline":
+        return roofline(Path(args.probe), Path(args.results), Path(args.output), args.threads)
+    if args.command == "scaling":
+        return scaling(Path(args.results), Path(args.output))
+    return compare(Path(args.base), Path(args.new), args.output and Path(args.output), args.threshold / 100.0)
+
+if __name__ == "__main__":
+    sys.exit(main())